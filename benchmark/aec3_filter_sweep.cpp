@@ -0,0 +1,300 @@
+// AEC3 filter length cost sweep
+//
+// Measures what the refined/coarse filter length (and the initial-phase
+// settings) cost so the shortest filter that still covers our Bluetooth
+// delays can be picked from data:
+//   - per-block time of AdaptiveFirFilter::Filter / Adapt
+//   - per-block time of Subtractor::Process
+//   - per-block time of the matched-filter delay search
+//     (EchoPathDelayEstimator, which drives MatchedFilter), which grows
+//     with the lag range of the delay-compensated points
+//   - end-to-end AudioProcessing time per 10 ms frame and ERLE after the run
+//   - resident memory per AudioProcessing instance
+//
+// Usage: aec3_filter_sweep [--seconds 10] [--instances 8]
+//
+// Build with scripts/build-host-benchmark.sh.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "api/audio/echo_canceller3_config.h"
+#include "api/audio/echo_canceller3_factory.h"
+#include "modules/audio_processing/aec3/adaptive_fir_filter.h"
+#include "modules/audio_processing/aec3/aec3_common.h"
+#include "modules/audio_processing/aec3/aec_state.h"
+#include "modules/audio_processing/aec3/block.h"
+#include "modules/audio_processing/aec3/echo_path_delay_estimator.h"
+#include "modules/audio_processing/aec3/fft_data.h"
+#include "modules/audio_processing/aec3/render_delay_buffer.h"
+#include "modules/audio_processing/aec3/render_signal_analyzer.h"
+#include "modules/audio_processing/aec3/subtractor.h"
+#include "modules/audio_processing/aec3/subtractor_output.h"
+#include "modules/audio_processing/include/audio_processing.h"
+#include "modules/audio_processing/logging/apm_data_dumper.h"
+
+using namespace webrtc;
+
+namespace {
+
+constexpr int kSampleRateHz = 16000;
+constexpr size_t kEchoDelayBlocks = 150;  // ~600 ms at 4 ms per block
+
+struct SweepPoint {
+    const char* name;
+    size_t length_blocks;
+    size_t initial_length_blocks;
+    bool conservative_initial_phase;
+    size_t num_matched_filters;  // 0 keeps the default lag range
+};
+
+// Upstream default, the JNI wrapper's CreateAec3Config and the 1200 ms patch,
+// each with the upstream initial phase and with the initial phase at full
+// length, plus delay-compensated placement (11 matched filters cover ~1 s,
+// the FIR only the room response; see nativeSetDelayCompensation)
+const SweepPoint kSweep[] = {
+    {"upstream-13", 13, 12, false, 0},
+    {"upstream-13-full-initial", 13, 13, false, 0},
+    {"jni-40", 40, 12, false, 0},
+    {"jni-40-full-initial", 40, 40, false, 0},
+    {"jni-40-conservative", 40, 12, true, 0},
+    {"patch-60", 60, 12, false, 0},
+    {"patch-60-full-initial", 60, 60, false, 0},
+    {"patch-60-conservative", 60, 12, true, 0},
+    {"delay-comp-12", 12, 12, false, 11},
+    {"delay-comp-20", 20, 12, false, 11},
+};
+
+struct Timing {
+    std::vector<double> samples_ns;
+
+    void Add(std::chrono::steady_clock::time_point start) {
+        samples_ns.push_back(std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    double Mean() const {
+        double total = 0.0;
+        for (double v : samples_ns) total += v;
+        return samples_ns.empty() ? 0.0 : total / samples_ns.size();
+    }
+
+    double P99() {
+        if (samples_ns.empty()) return 0.0;
+        std::sort(samples_ns.begin(), samples_ns.end());
+        return samples_ns[static_cast<size_t>(0.99 * (samples_ns.size() - 1))];
+    }
+};
+
+EchoCanceller3Config MakeConfig(const SweepPoint& point) {
+    EchoCanceller3Config config;
+    config.filter.refined.length_blocks = point.length_blocks;
+    config.filter.coarse.length_blocks = point.length_blocks;
+    config.filter.refined_initial.length_blocks = point.initial_length_blocks;
+    config.filter.coarse_initial.length_blocks = point.initial_length_blocks;
+    config.filter.conservative_initial_phase = point.conservative_initial_phase;
+    if (point.num_matched_filters > 0) config.delay.num_filters = point.num_matched_filters;
+    return config;
+}
+
+size_t ResidentBytes() {
+    long pages = 0;
+    long resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(statm);
+    return static_cast<size_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// Speech-band noise for render and its attenuated echo, kEchoDelayBlocks later
+class SignalSource {
+public:
+    SignalSource() : rng_(42), noise_(0.0f, 3000.0f), history_(kEchoDelayBlocks + 1) {}
+
+    void NextBlock(Block* render, Block* capture) {
+        std::array<float, kBlockSize>& newest = history_[position_];
+        for (float& sample : newest) {
+            lowpass_ = 0.7f * lowpass_ + 0.3f * noise_(rng_);
+            sample = lowpass_;
+        }
+        const std::array<float, kBlockSize>& delayed = history_[(position_ + 1) % history_.size()];
+        std::copy(newest.begin(), newest.end(), render->begin(0, 0));
+        for (size_t i = 0; i < kBlockSize; i++) {
+            capture->View(0, 0)[i] = 0.5f * delayed[i] + 0.01f * noise_(rng_);
+        }
+        position_ = (position_ + 1) % history_.size();
+    }
+
+private:
+    std::mt19937 rng_;
+    std::normal_distribution<float> noise_;
+    std::vector<std::array<float, kBlockSize>> history_;
+    size_t position_ = 0;
+    float lowpass_ = 0.0f;
+};
+
+void RunComponents(const SweepPoint& point, size_t num_blocks) {
+    const EchoCanceller3Config config = MakeConfig(point);
+    const Aec3Optimization optimization = DetectOptimization();
+    ApmDataDumper data_dumper(0);
+
+    std::unique_ptr<RenderDelayBuffer> render_delay_buffer(
+        RenderDelayBuffer::Create(config, kSampleRateHz, 1));
+    AdaptiveFirFilter filter(point.length_blocks, point.length_blocks,
+                             config.filter.config_change_duration_blocks, 1,
+                             optimization, &data_dumper);
+    Subtractor subtractor(config, 1, 1, &data_dumper, optimization);
+    EchoPathDelayEstimator delay_estimator(&data_dumper, config, 1);
+    RenderSignalAnalyzer render_signal_analyzer(config);
+    AecState aec_state(config, 1);
+
+    Block render(NumBandsForRate(kSampleRateHz), 1);
+    Block capture(NumBandsForRate(kSampleRateHz), 1);
+    std::array<SubtractorOutput, 1> subtractor_output;
+    FftData S;
+    FftData G;
+    G.Clear();
+    for (size_t k = 0; k < kFftLengthBy2Plus1; k++) G.re[k] = 0.01f;
+
+    SignalSource source;
+    Timing filter_time, adapt_time, subtractor_time, matched_filter_time;
+    for (size_t block = 0; block < num_blocks; block++) {
+        source.NextBlock(&render, &capture);
+        render_delay_buffer->Insert(render);
+        render_delay_buffer->PrepareCaptureProcessing();
+        const RenderBuffer& render_buffer = *render_delay_buffer->GetRenderBuffer();
+
+        auto start = std::chrono::steady_clock::now();
+        filter.Filter(render_buffer, &S);
+        filter_time.Add(start);
+
+        start = std::chrono::steady_clock::now();
+        filter.Adapt(render_buffer, G);
+        adapt_time.Add(start);
+
+        start = std::chrono::steady_clock::now();
+        subtractor.Process(render_buffer, capture, render_signal_analyzer, aec_state,
+                           subtractor_output);
+        subtractor_time.Add(start);
+
+        start = std::chrono::steady_clock::now();
+        delay_estimator.EstimateDelay(render_delay_buffer->GetDownsampledRenderBuffer(), capture);
+        matched_filter_time.Add(start);
+    }
+
+    printf("%-26s fir_filter_ns=%.0f/%.0f fir_adapt_ns=%.0f/%.0f subtractor_ns=%.0f/%.0f "
+           "matched_filter_ns=%.0f/%.0f\n",
+           point.name,
+           filter_time.Mean(), filter_time.P99(),
+           adapt_time.Mean(), adapt_time.P99(),
+           subtractor_time.Mean(), subtractor_time.P99(),
+           matched_filter_time.Mean(), matched_filter_time.P99());
+}
+
+rtc::scoped_refptr<AudioProcessing> CreateApm(const EchoCanceller3Config& aec3_config) {
+    AudioProcessing::Config config;
+    config.echo_canceller.enabled = true;
+    config.echo_canceller.mobile_mode = false;
+    rtc::scoped_refptr<AudioProcessing> apm = AudioProcessingBuilder()
+        .SetEchoControlFactory(std::make_unique<EchoCanceller3Factory>(aec3_config))
+        .Create();
+    if (apm) apm->ApplyConfig(config);
+    return apm;
+}
+
+void RunEndToEnd(const SweepPoint& point, size_t num_blocks, int num_instances) {
+    const EchoCanceller3Config config = MakeConfig(point);
+    const StreamConfig stream_config(kSampleRateHz, 1);
+    const size_t frame_size = stream_config.num_frames();
+
+    // Resident memory per instance, after every instance has processed audio
+    // so lazily allocated state is included
+    std::vector<float> silence(frame_size, 0.0f);
+    float* silence_channels[] = {silence.data()};
+    const size_t rss_before = ResidentBytes();
+    std::vector<rtc::scoped_refptr<AudioProcessing>> instances;
+    for (int i = 0; i < num_instances; i++) {
+        instances.push_back(CreateApm(config));
+        instances.back()->ProcessReverseStream(silence_channels, stream_config, stream_config,
+                                               silence_channels);
+        instances.back()->ProcessStream(silence_channels, stream_config, stream_config,
+                                        silence_channels);
+    }
+    const size_t rss_after = ResidentBytes();
+    instances.resize(1);
+
+    // Reuse the block source; 10 ms frames are assembled from 2.5 blocks
+    SignalSource source;
+    Block render(NumBandsForRate(kSampleRateHz), 1);
+    Block capture(NumBandsForRate(kSampleRateHz), 1);
+    std::vector<float> render_stream, capture_stream;
+    const size_t num_samples = num_blocks * kBlockSize;
+    render_stream.reserve(num_samples);
+    capture_stream.reserve(num_samples);
+    for (size_t block = 0; block < num_blocks; block++) {
+        source.NextBlock(&render, &capture);
+        render_stream.insert(render_stream.end(), render.begin(0, 0), render.begin(0, 0) + kBlockSize);
+        capture_stream.insert(capture_stream.end(), capture.begin(0, 0), capture.begin(0, 0) + kBlockSize);
+    }
+
+    AudioProcessing* apm = instances[0].get();
+    std::vector<float> render_frame(frame_size), capture_frame(frame_size);
+    float* render_channels[] = {render_frame.data()};
+    float* capture_channels[] = {capture_frame.data()};
+    Timing frame_time;
+    for (size_t offset = 0; offset + frame_size <= num_samples; offset += frame_size) {
+        std::copy_n(&render_stream[offset], frame_size, render_frame.begin());
+        std::copy_n(&capture_stream[offset], frame_size, capture_frame.begin());
+        auto start = std::chrono::steady_clock::now();
+        apm->ProcessReverseStream(render_channels, stream_config, stream_config, render_channels);
+        apm->ProcessStream(capture_channels, stream_config, stream_config, capture_channels);
+        frame_time.Add(start);
+    }
+
+    AudioProcessingStats stats = apm->GetStatistics();
+    printf("%-26s apm_frame_us=%.1f/%.1f erle_db=%.1f delay_ms=%d rss_kb_per_instance=%zu\n",
+           point.name, frame_time.Mean() / 1000.0, frame_time.P99() / 1000.0,
+           stats.echo_return_loss_enhancement.value_or(0.0), stats.delay_ms.value_or(-1),
+           rss_after > rss_before ? (rss_after - rss_before) / num_instances / 1024 : 0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    double seconds = 10.0;
+    int num_instances = 8;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (arg == "--instances" && i + 1 < argc) {
+            num_instances = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: aec3_filter_sweep [--seconds N] [--instances N]\n");
+            return 1;
+        }
+    }
+    if (seconds <= 0.0 || num_instances <= 0) return 1;
+
+    const size_t num_blocks = static_cast<size_t>(seconds * kSampleRateHz / kBlockSize);
+    printf("blocks=%zu echo_delay_ms=%zu (values are mean/p99)\n",
+           num_blocks, kEchoDelayBlocks * kBlockSize * 1000 / kSampleRateHz);
+
+    printf("\n# Per-block component cost\n");
+    for (const SweepPoint& point : kSweep) RunComponents(point, num_blocks);
+
+    printf("\n# End-to-end AudioProcessing\n");
+    for (const SweepPoint& point : kSweep) RunEndToEnd(point, num_blocks, num_instances);
+
+    return 0;
+}
@@ -0,0 +1,293 @@
+// Host benchmark for the patched WebRTC AEC3 Audio Processing Module
+//
+// Streams a render/capture WAV pair (or a synthetic Bluetooth echo scenario)
+// through AudioProcessing the same way the JNI wrapper does: int16 frames are
+// converted to float planes, the render frame is passed to
+// ProcessReverseStream and the capture frame to ProcessStream. Reports
+// per-frame latency percentiles and the realtime factor so regressions show
+// up on a dev box before they reach devices.
+//
+// Usage:
+//   apm_benchmark [--render far.wav --capture near.wav] [--output out.wav]
+//                 [--seconds 60] [--sample-rate 16000] [--delay-ms 600]
+//                 [--filter-blocks N] [--no-ns]
+//
+// Build with scripts/build-host-benchmark.sh.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "api/audio/echo_canceller3_config.h"
+#include "api/audio/echo_canceller3_factory.h"
+#include "common_audio/wav_file.h"
+#include "modules/audio_processing/include/audio_processing.h"
+
+#include "sample_conversion.h"
+
+using namespace webrtc;
+
+namespace {
+
+struct Options {
+    std::string render_path;
+    std::string capture_path;
+    std::string output_path;
+    int sample_rate_hz = 16000;
+    double seconds = 60.0;
+    int delay_ms = 600;
+    int filter_blocks = 0;  // 0 keeps the (patched) EchoCanceller3Config default
+    bool noise_suppression = true;
+};
+
+struct LatencySummary {
+    double p50_us = 0.0;
+    double p99_us = 0.0;
+    double max_us = 0.0;
+    double mean_us = 0.0;
+};
+
+void PrintUsage() {
+    fprintf(stderr,
+            "Usage: apm_benchmark [--render far.wav --capture near.wav] [--output out.wav]\n"
+            "                     [--seconds N] [--sample-rate HZ] [--delay-ms N]\n"
+            "                     [--filter-blocks N] [--no-ns]\n"
+            "Without WAV input a synthetic echo scenario with the given delay is used.\n");
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--render" && has_value) {
+            options->render_path = argv[++i];
+        } else if (arg == "--capture" && has_value) {
+            options->capture_path = argv[++i];
+        } else if (arg == "--output" && has_value) {
+            options->output_path = argv[++i];
+        } else if (arg == "--seconds" && has_value) {
+            options->seconds = atof(argv[++i]);
+        } else if (arg == "--sample-rate" && has_value) {
+            options->sample_rate_hz = atoi(argv[++i]);
+        } else if (arg == "--delay-ms" && has_value) {
+            options->delay_ms = atoi(argv[++i]);
+        } else if (arg == "--filter-blocks" && has_value) {
+            options->filter_blocks = atoi(argv[++i]);
+        } else if (arg == "--no-ns") {
+            options->noise_suppression = false;
+        } else {
+            return false;
+        }
+    }
+    if (options->render_path.empty() != options->capture_path.empty()) return false;
+    return options->sample_rate_hz > 0 && options->seconds > 0.0;
+}
+
+// Mono int16 signal of the requested length, read from a WAV file (first
+// channel only) or left empty if the file cannot be used.
+std::vector<int16_t> ReadWavMono(const std::string& path, int expected_rate_hz) {
+    WavReader reader(path);
+    if (reader.sample_rate() != expected_rate_hz) {
+        fprintf(stderr, "%s: sample rate %d Hz, expected %d Hz\n",
+                path.c_str(), reader.sample_rate(), expected_rate_hz);
+        return {};
+    }
+    std::vector<int16_t> interleaved(reader.num_samples());
+    interleaved.resize(reader.ReadSamples(interleaved.size(), interleaved.data()));
+
+    const size_t num_channels = reader.num_channels();
+    std::vector<int16_t> mono(interleaved.size() / num_channels);
+    for (size_t i = 0; i < mono.size(); i++) {
+        mono[i] = interleaved[i * num_channels];
+    }
+    return mono;
+}
+
+// Speech-like far-end (amplitude-modulated low-passed noise with pauses) and
+// a capture signal holding its delayed, reverberant echo plus sensor noise.
+void Synthesize(const Options& options, std::vector<int16_t>* render, std::vector<int16_t>* capture) {
+    const size_t num_samples = static_cast<size_t>(options.seconds * options.sample_rate_hz);
+    const size_t delay_samples = static_cast<size_t>(options.delay_ms) * options.sample_rate_hz / 1000;
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> noise(0.0f, 1.0f);
+
+    std::vector<float> far(num_samples);
+    float lowpass = 0.0f;
+    for (size_t i = 0; i < num_samples; i++) {
+        double t = static_cast<double>(i) / options.sample_rate_hz;
+        float envelope = static_cast<float>(std::max(0.0, std::sin(2.0 * M_PI * 3.0 * t)));
+        bool talking = std::fmod(t, 4.0) < 3.0;
+        lowpass = 0.8f * lowpass + 0.2f * noise(rng);
+        far[i] = talking ? 6000.0f * envelope * lowpass : 0.0f;
+    }
+
+    // Short exponentially decaying room response after the bulk delay
+    const size_t tail_samples = options.sample_rate_hz / 20;
+    std::vector<float> echo_path(tail_samples);
+    for (size_t k = 0; k < tail_samples; k++) {
+        echo_path[k] = 0.5f * std::exp(-8.0f * k / tail_samples) * (k % 7 == 0 ? 1.0f : 0.15f);
+    }
+
+    render->resize(num_samples);
+    capture->resize(num_samples);
+    for (size_t i = 0; i < num_samples; i++) {
+        float echo = 0.0f;
+        if (i >= delay_samples) {
+            size_t n = i - delay_samples;
+            size_t taps = std::min(tail_samples, n + 1);
+            for (size_t k = 0; k < taps; k += 7) {
+                echo += echo_path[k] * far[n - k];
+            }
+        }
+        float mic = echo + 30.0f * noise(rng);
+        (*render)[i] = static_cast<int16_t>(std::max(-32768.0f, std::min(32767.0f, far[i])));
+        (*capture)[i] = static_cast<int16_t>(std::max(-32768.0f, std::min(32767.0f, mic)));
+    }
+}
+
+rtc::scoped_refptr<AudioProcessing> CreateApm(const Options& options) {
+    EchoCanceller3Config aec3_config;
+    if (options.filter_blocks > 0) {
+        aec3_config.filter.refined.length_blocks = options.filter_blocks;
+        aec3_config.filter.coarse.length_blocks = options.filter_blocks;
+        aec3_config.filter.refined_initial.length_blocks = options.filter_blocks;
+        aec3_config.filter.coarse_initial.length_blocks = options.filter_blocks;
+    }
+
+    // Same submodules as nativeCreateApmInstance with AEC3 enabled
+    AudioProcessing::Config config;
+    config.echo_canceller.enabled = true;
+    config.echo_canceller.mobile_mode = false;
+    config.high_pass_filter.enabled = true;
+    config.noise_suppression.enabled = options.noise_suppression;
+    config.noise_suppression.level = AudioProcessing::Config::NoiseSuppression::kHigh;
+
+    rtc::scoped_refptr<AudioProcessing> apm = AudioProcessingBuilder()
+        .SetEchoControlFactory(std::make_unique<EchoCanceller3Factory>(aec3_config))
+        .Create();
+    if (apm) apm->ApplyConfig(config);
+    return apm;
+}
+
+LatencySummary Summarize(std::vector<double> samples_us) {
+    LatencySummary summary;
+    if (samples_us.empty()) return summary;
+    std::sort(samples_us.begin(), samples_us.end());
+    auto percentile = [&samples_us](double p) {
+        size_t index = static_cast<size_t>(p * (samples_us.size() - 1) + 0.5);
+        return samples_us[index];
+    };
+    double total = 0.0;
+    for (double v : samples_us) total += v;
+    summary.p50_us = percentile(0.50);
+    summary.p99_us = percentile(0.99);
+    summary.max_us = samples_us.back();
+    summary.mean_us = total / samples_us.size();
+    return summary;
+}
+
+void PrintSummary(const char* label, const LatencySummary& summary) {
+    printf("%s_us p50=%.1f p99=%.1f max=%.1f mean=%.1f\n",
+           label, summary.p50_us, summary.p99_us, summary.max_us, summary.mean_us);
+}
+
+double ElapsedUs(std::chrono::steady_clock::time_point start,
+                 std::chrono::steady_clock::time_point end) {
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, &options)) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<int16_t> render;
+    std::vector<int16_t> capture;
+    if (!options.render_path.empty()) {
+        render = ReadWavMono(options.render_path, options.sample_rate_hz);
+        capture = ReadWavMono(options.capture_path, options.sample_rate_hz);
+        if (render.empty() || capture.empty()) return 1;
+    } else {
+        Synthesize(options, &render, &capture);
+    }
+
+    rtc::scoped_refptr<AudioProcessing> apm = CreateApm(options);
+    if (!apm) {
+        fprintf(stderr, "Failed to create APM instance\n");
+        return 1;
+    }
+
+    const StreamConfig stream_config(options.sample_rate_hz, 1);
+    const size_t frame_size = stream_config.num_frames();
+    const size_t num_frames = std::min(render.size(), capture.size()) / frame_size;
+
+    std::vector<float> render_buffer(frame_size);
+    std::vector<float> capture_buffer(frame_size);
+    float* render_channels[] = {render_buffer.data()};
+    float* capture_channels[] = {capture_buffer.data()};
+    std::vector<int16_t> output(num_frames * frame_size);
+
+    std::vector<double> render_us;
+    std::vector<double> capture_us;
+    std::vector<double> frame_us;
+    render_us.reserve(num_frames);
+    capture_us.reserve(num_frames);
+    frame_us.reserve(num_frames);
+
+    int errors = 0;
+    for (size_t frame = 0; frame < num_frames; frame++) {
+        const size_t offset = frame * frame_size;
+
+        auto render_start = std::chrono::steady_clock::now();
+        apm_jni::S16ToFloatPlane(&render[offset], render_buffer.data(), frame_size);
+        errors += apm->ProcessReverseStream(render_channels, stream_config, stream_config,
+                                            render_channels) != AudioProcessing::kNoError;
+        auto capture_start = std::chrono::steady_clock::now();
+        apm_jni::S16ToFloatPlane(&capture[offset], capture_buffer.data(), frame_size);
+        errors += apm->ProcessStream(capture_channels, stream_config, stream_config,
+                                     capture_channels) != AudioProcessing::kNoError;
+        apm_jni::FloatToS16Plane(capture_buffer.data(), &output[offset], frame_size);
+        auto end = std::chrono::steady_clock::now();
+
+        render_us.push_back(ElapsedUs(render_start, capture_start));
+        capture_us.push_back(ElapsedUs(capture_start, end));
+        frame_us.push_back(ElapsedUs(render_start, end));
+    }
+
+    double processing_s = 0.0;
+    for (double v : frame_us) processing_s += v / 1e6;
+    const double audio_s = static_cast<double>(num_frames) * AudioProcessing::kChunkSizeMs / 1000.0;
+
+    printf("input=%s sample_rate=%d filter_blocks=%d conversion=%s\n",
+           options.render_path.empty() ? "synthetic" : options.render_path.c_str(),
+           options.sample_rate_hz, options.filter_blocks, apm_jni::ConversionBackend());
+    printf("frames=%zu audio_s=%.2f processing_s=%.3f realtime_factor=%.1f errors=%d\n",
+           num_frames, audio_s, processing_s, processing_s > 0.0 ? audio_s / processing_s : 0.0, errors);
+    PrintSummary("frame", Summarize(frame_us));
+    PrintSummary("render", Summarize(render_us));
+    PrintSummary("capture", Summarize(capture_us));
+
+    AudioProcessingStats stats = apm->GetStatistics();
+    printf("aec3 erle_db=%.1f erl_db=%.1f delay_ms=%d\n",
+           stats.echo_return_loss_enhancement.value_or(0.0),
+           stats.echo_return_loss.value_or(0.0),
+           stats.delay_ms.value_or(-1));
+
+    if (!options.output_path.empty()) {
+        WavWriter writer(options.output_path, options.sample_rate_hz, 1);
+        writer.WriteSamples(output.data(), output.size());
+    }
+
+    return errors == 0 ? 0 : 2;
+}
@@ -0,0 +1,29 @@
+// Host stand-in for the NDK log header, so JNI wrapper sources that only
+// log can be built into the host tests. Debug and info messages are dropped;
+// warnings and errors go to stderr.
+
+#ifndef APM_JNI_HOST_ANDROID_LOG_H_
+#define APM_JNI_HOST_ANDROID_LOG_H_
+
+#include <cstdarg>
+#include <cstdio>
+
+enum {
+    ANDROID_LOG_DEBUG = 3,
+    ANDROID_LOG_INFO = 4,
+    ANDROID_LOG_WARN = 5,
+    ANDROID_LOG_ERROR = 6,
+};
+
+inline int __android_log_print(int priority, const char* tag, const char* format, ...) {
+    if (priority < ANDROID_LOG_WARN) return 0;
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%s: ", tag);
+    int written = vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+    return written;
+}
+
+#endif  // APM_JNI_HOST_ANDROID_LOG_H_
@@ -0,0 +1,189 @@
+// Lifetime check for the instance arenas (jni/instance_arena.cpp)
+//
+// Builds APM instances with AEC3 inside an ArenaScope the way the JNI
+// wrapper does, runs audio through them, destroys them and builds again, so
+// arena blocks are recycled through the pool. Meant to run under
+// AddressSanitizer: pooled blocks are poisoned, so touching an object after
+// its arena went back to the pool is reported. It also checks that
+//   - the second build of a configuration is served from an arena, and
+//     nothing built in it is still alive when the instance is gone
+//   - an arena object deleted on another thread drops its reference
+//   - in release builds, an object outliving its arena keeps the block until
+//     it is deleted instead of being handed to free() (debug builds assert)
+// Exits non-zero on the first failure.
+//
+// Usage:
+//   instance_arena_test
+//
+// Build with scripts/build-host-benchmark.sh, which builds it with
+// -fsanitize=address.
+
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "api/audio/echo_canceller3_config.h"
+#include "api/audio/echo_canceller3_factory.h"
+#include "instance_arena.h"
+#include "modules/audio_processing/include/audio_processing.h"
+
+using webrtc::AudioProcessing;
+using webrtc::AudioProcessingBuilder;
+using webrtc::EchoCanceller3Config;
+using webrtc::EchoCanceller3Factory;
+using webrtc::ProcessingConfig;
+using webrtc::StreamConfig;
+
+namespace {
+
+constexpr int kSampleRateHz = 16000;
+constexpr int kCycles = 24;
+constexpr int kFramesPerCycle = 100;
+
+// Test-only arena keys, apart from the wrapper's
+constexpr uint64_t kShortFilterKey = 0x7465737400000001ull;
+constexpr uint64_t kLongFilterKey = 0x7465737400000002ull;
+constexpr uint64_t kObjectKey = 0x7465737400000003ull;
+
+bool Check(bool condition, const char* what) {
+    if (!condition) fprintf(stderr, "FAILED: %s\n", what);
+    return condition;
+}
+
+// Declared in release order: the APM first, then its arena
+struct Instance {
+    std::unique_ptr<apm_jni::InstanceArena> arena;
+    rtc::scoped_refptr<AudioProcessing> apm;
+};
+
+Instance Build(uint64_t key, int filter_blocks) {
+    Instance instance;
+    apm_jni::ArenaScope scope(key);
+
+    EchoCanceller3Config aec3_config;
+    aec3_config.filter.refined.length_blocks = filter_blocks;
+    instance.apm = AudioProcessingBuilder()
+        .SetEchoControlFactory(std::make_unique<EchoCanceller3Factory>(aec3_config))
+        .Create();
+
+    AudioProcessing::Config config;
+    config.echo_canceller.enabled = true;
+    config.noise_suppression.enabled = true;
+    config.high_pass_filter.enabled = true;
+    instance.apm->ApplyConfig(config);
+
+    // Creates the echo controller inside the scope, as the wrapper's format
+    // setters do
+    const StreamConfig stream(kSampleRateHz, 1);
+    ProcessingConfig processing_config;
+    processing_config.input_stream() = stream;
+    processing_config.output_stream() = stream;
+    processing_config.reverse_input_stream() = stream;
+    processing_config.reverse_output_stream() = stream;
+    instance.apm->Initialize(processing_config);
+
+    instance.arena = scope.TakeArena();
+    return instance;
+}
+
+int Process(AudioProcessing* apm, int frames) {
+    const StreamConfig stream(kSampleRateHz, 1);
+    std::vector<float> render(stream.num_frames());
+    std::vector<float> capture(stream.num_frames());
+    float* render_channels[] = {render.data()};
+    float* capture_channels[] = {capture.data()};
+
+    int errors = 0;
+    uint32_t noise = 12345;
+    for (int frame = 0; frame < frames; frame++) {
+        for (size_t i = 0; i < render.size(); i++) {
+            noise = noise * 1664525u + 1013904223u;
+            render[i] = static_cast<float>(static_cast<int16_t>(noise >> 16)) * 0.25f;
+            capture[i] = render[i] * 0.5f;
+        }
+        errors += apm->ProcessReverseStream(render_channels, stream, stream, render_channels) !=
+                  AudioProcessing::kNoError;
+        errors += apm->ProcessStream(capture_channels, stream, stream, capture_channels) !=
+                  AudioProcessing::kNoError;
+    }
+    return errors;
+}
+
+bool BuildAndRecycle() {
+    for (int cycle = 0; cycle < kCycles; cycle++) {
+        const bool long_filter = cycle % 2 == 1;
+        Instance instance = Build(long_filter ? kLongFilterKey : kShortFilterKey,
+                                  long_filter ? 80 : 13);
+        if (!Check(instance.apm != nullptr, "APM built")) return false;
+
+        // The first build of each key is measured on the heap
+        if (cycle >= 2) {
+            if (!Check(instance.arena != nullptr, "repeat build gets an arena")) return false;
+            if (!Check(apm_jni::ArenaOwns(instance.apm.get()), "APM lies in its arena")) return false;
+        }
+        if (!Check(Process(instance.apm.get(), kFramesPerCycle) == 0, "frames processed")) {
+            return false;
+        }
+
+        instance.apm = nullptr;
+        if (instance.arena) {
+            if (!Check(instance.arena->live_objects() == 0, "nothing outlives the APM")) {
+                fprintf(stderr, "  %zu objects still alive in the arena\n",
+                        instance.arena->live_objects());
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Builds one vector in an arena (after a measuring build of the same key)
+std::unique_ptr<apm_jni::InstanceArena> BuildObject(std::vector<float>** object) {
+    { apm_jni::ArenaScope measure(kObjectKey); delete new std::vector<float>(4096); }
+    apm_jni::ArenaScope scope(kObjectKey);
+    *object = new std::vector<float>(4096, 1.0f);
+    return scope.TakeArena();
+}
+
+bool DeleteOnOtherThread() {
+    std::vector<float>* object = nullptr;
+    std::unique_ptr<apm_jni::InstanceArena> arena = BuildObject(&object);
+    if (!Check(arena && apm_jni::ArenaOwns(object), "object lies in its arena")) return false;
+    if (!Check(arena->live_objects() == 2, "vector and its buffer counted")) return false;
+
+    std::thread([object] { delete object; }).join();
+    return Check(arena->live_objects() == 0, "delete on another thread drops the references");
+}
+
+bool OutliveArena() {
+#ifdef NDEBUG
+    std::vector<float>* object = nullptr;
+    std::unique_ptr<apm_jni::InstanceArena> arena = BuildObject(&object);
+    if (!Check(arena != nullptr, "object built in an arena")) return false;
+
+    arena.reset();
+    if (!Check(apm_jni::ArenaOwns(object), "block kept while an object is alive")) return false;
+    if (!Check((*object)[4095] == 1.0f, "object still readable")) return false;
+    delete object;
+    return Check(!apm_jni::ArenaOwns(object), "block released with the last object");
+#else
+    printf("Debug build: skipping the outlived-arena case (it asserts)\n");
+    return true;
+#endif
+}
+
+}  // namespace
+
+int main() {
+    apm_jni::SetArenaAllocation(true);
+
+    int failures = 0;
+    failures += !BuildAndRecycle();
+    failures += !DeleteOnOtherThread();
+    failures += !OutliveArena();
+
+    apm_jni::SetArenaAllocation(false);
+    printf("%s\n", failures == 0 ? "All arena checks passed" : "Arena checks FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,167 @@
+// Bit-exactness check for the JNI sample conversion kernels
+//
+// Runs every kernel set the build and CPU support (see
+// SupportedConversionKernels) against the scalar reference: all 65536 int16
+// values, float boundary values around full scale, zero and the int16 step
+// size, and random input. Each case is run at every length up to 72 samples
+// and at 10 ms frame lengths, with unaligned source and destination offsets,
+// so the SIMD main loops and their scalar tails are both covered. Results
+// are compared bitwise (float outputs included). Exits non-zero on the first
+// mismatching kernel.
+//
+// NaN input is not covered: the scalar reference casts it to int16, which is
+// undefined, so there is nothing to be bit-exact with.
+//
+// On x86 this covers SSE2 and, where the CPU has it, AVX2. NEON kernels are
+// only covered when this is built for arm and run on a device.
+//
+// Usage:
+//   sample_conversion_test
+//
+// Build with scripts/build-host-benchmark.sh.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "sample_conversion.h"
+
+using apm_jni::ConversionKernels;
+
+namespace {
+
+// Lengths that hit every tail length of 4-, 8- and 16-wide loops, plus the
+// 10 ms frame lengths of the supported rates
+std::vector<size_t> TestLengths() {
+    std::vector<size_t> lengths;
+    for (size_t n = 0; n <= 72; n++) lengths.push_back(n);
+    for (size_t n : {80, 159, 160, 161, 320, 441, 480, 960}) lengths.push_back(n);
+    return lengths;
+}
+
+constexpr size_t kMaxOffset = 3;
+
+std::vector<int16_t> S16Input() {
+    std::vector<int16_t> values;
+    for (int v = -32768; v <= 32767; v++) values.push_back(static_cast<int16_t>(v));
+    return values;
+}
+
+std::vector<float> FloatInput() {
+    const float inf = std::numeric_limits<float>::infinity();
+    std::vector<float> values = {
+        0.0f, -0.0f, 1.0f, -1.0f, 0.5f, -0.5f, inf, -inf, 1e10f, -1e10f,
+        std::numeric_limits<float>::denorm_min(), -std::numeric_limits<float>::denorm_min(),
+        std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(),
+    };
+    // Around every step of interest: +-1 LSB, half steps and full scale
+    for (float step : {0.0f, 0.5f, 1.0f, 1.5f, 32766.5f, 32767.0f, 32767.5f, 32768.0f, 32768.5f}) {
+        for (float sign : {1.0f, -1.0f}) {
+            const float center = sign * step / 32768.0f;
+            values.push_back(center);
+            values.push_back(std::nextafter(center, inf));
+            values.push_back(std::nextafter(center, -inf));
+        }
+    }
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> wide(-1.5f, 1.5f);
+    while (values.size() < 4096) values.push_back(wide(rng));
+    return values;
+}
+
+// Fills count samples starting at position start of a cyclic value pool
+template <typename T>
+void Fill(const std::vector<T>& pool, size_t start, T* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) dst[i] = pool[(start + i) % pool.size()];
+}
+
+template <typename T>
+bool SameBits(const T* a, const T* b, size_t count) {
+    return std::memcmp(a, b, count * sizeof(T)) == 0;
+}
+
+bool CheckKernels(const ConversionKernels& k, const ConversionKernels& ref) {
+    const std::vector<int16_t> s16_pool = S16Input();
+    const std::vector<float> float_pool = FloatInput();
+
+    for (size_t length : TestLengths()) {
+        const size_t size = 2 * length + kMaxOffset;
+        std::vector<int16_t> s16_in(size), s16_out(size), s16_ref(size);
+        std::vector<float> f_in(size), f_in2(size), f_out(size), f_out2(size), f_ref(size), f_ref2(size);
+
+        for (size_t offset = 0; offset <= kMaxOffset; offset++) {
+            // Sweep the pools so every input value is seen at every length
+            for (size_t start = 0; start < s16_pool.size(); start += std::max<size_t>(2 * length, 1)) {
+                Fill(s16_pool, start, s16_in.data() + offset, 2 * length);
+
+                k.s16_to_float(s16_in.data() + offset, f_out.data() + offset, length);
+                ref.s16_to_float(s16_in.data() + offset, f_ref.data() + offset, length);
+                if (!SameBits(f_out.data() + offset, f_ref.data() + offset, length)) {
+                    fprintf(stderr, "%s S16ToFloatPlane: mismatch (length %zu, offset %zu)\n",
+                            k.name, length, offset);
+                    return false;
+                }
+
+                k.s16_to_float_stereo(s16_in.data() + offset, f_out.data() + offset,
+                                      f_out2.data() + offset, length);
+                ref.s16_to_float_stereo(s16_in.data() + offset, f_ref.data() + offset,
+                                        f_ref2.data() + offset, length);
+                if (!SameBits(f_out.data() + offset, f_ref.data() + offset, length) ||
+                    !SameBits(f_out2.data() + offset, f_ref2.data() + offset, length)) {
+                    fprintf(stderr, "%s S16ToFloatStereo: mismatch (length %zu, offset %zu)\n",
+                            k.name, length, offset);
+                    return false;
+                }
+                if (length == 0) break;
+            }
+
+            for (size_t start = 0; start < float_pool.size(); start += std::max<size_t>(length, 1)) {
+                Fill(float_pool, start, f_in.data() + offset, length);
+                // Reverse order on the right channel so both lanes see every value
+                Fill(float_pool, float_pool.size() - start, f_in2.data() + offset, length);
+
+                k.float_to_s16(f_in.data() + offset, s16_out.data() + offset, length);
+                ref.float_to_s16(f_in.data() + offset, s16_ref.data() + offset, length);
+                if (!SameBits(s16_out.data() + offset, s16_ref.data() + offset, length)) {
+                    fprintf(stderr, "%s FloatToS16Plane: mismatch (length %zu, offset %zu)\n",
+                            k.name, length, offset);
+                    return false;
+                }
+
+                k.float_to_s16_stereo(f_in.data() + offset, f_in2.data() + offset,
+                                      s16_out.data() + offset, length);
+                ref.float_to_s16_stereo(f_in.data() + offset, f_in2.data() + offset,
+                                        s16_ref.data() + offset, length);
+                if (!SameBits(s16_out.data() + offset, s16_ref.data() + offset, 2 * length)) {
+                    fprintf(stderr, "%s FloatToS16Stereo: mismatch (length %zu, offset %zu)\n",
+                            k.name, length, offset);
+                    return false;
+                }
+                if (length == 0) break;
+            }
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main() {
+    const std::vector<ConversionKernels> kernels = apm_jni::SupportedConversionKernels();
+    const ConversionKernels& reference = kernels.back();
+
+    printf("Selected backend: %s\n", apm_jni::ConversionBackend());
+    int failures = 0;
+    for (const ConversionKernels& k : kernels) {
+        if (&k == &reference) continue;
+        bool ok = CheckKernels(k, reference);
+        printf("%-6s %s\n", k.name, ok ? "bit-exact" : "MISMATCH");
+        if (!ok) failures++;
+    }
+    if (kernels.size() == 1) printf("No SIMD kernels in this build, nothing to compare\n");
+    return failures == 0 ? 0 : 1;
+}
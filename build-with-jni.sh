@@ -47,7 +47,7 @@ echo "Build configuration:"
 echo "  NDK: $NDK_VERSION"
 echo "  Architecture: $ANDROID_ARCH"
 echo "  API Level: $API_LEVEL"
-echo "  JNI Wrapper: webrtc_apm_jni.cpp"
+echo "  JNI Wrapper: webrtc_apm_jni.cpp + adaptive_echo_control.cpp + background_worker.cpp + capture_pipeline.cpp + deadline_governor.cpp + delay_estimator.cpp + device_resampler.cpp + instance_arena.cpp + render_queue.cpp + route_profile_cache.cpp + sample_conversion.cpp + session_engine.cpp + stage_timing.cpp"
 echo ""
 
 # Find WebRTC static libraries
@@ -81,16 +81,26 @@ echo ""
 echo "Compiling JNI wrapper..."
 mkdir -p "$OUTPUT_DIR/$ANDROID_ARCH/obj"
 
-$CXX -c "$JNI_DIR/webrtc_apm_jni.cpp" \
-    -o "$OUTPUT_DIR/$ANDROID_ARCH/obj/webrtc_apm_jni.o" \
-    -I"$WEBRTC_SRC" \
-    -I"$WEBRTC_SRC/third_party/abseil-cpp" \
-    -std=c++17 \
-    -fPIC \
-    -DWEBRTC_POSIX \
-    -DWEBRTC_ANDROID \
-    -DWEBRTC_LINUX \
-    -O2
+JNI_SOURCES="webrtc_apm_jni.cpp adaptive_echo_control.cpp background_worker.cpp capture_pipeline.cpp deadline_governor.cpp delay_estimator.cpp device_resampler.cpp instance_arena.cpp render_queue.cpp route_profile_cache.cpp sample_conversion.cpp session_engine.cpp stage_timing.cpp"
+JNI_OBJECTS=""
+
+for src in $JNI_SOURCES; do
+    obj="$OUTPUT_DIR/$ANDROID_ARCH/obj/${src%.cpp}.o"
+    $CXX -c "$JNI_DIR/$src" \
+        -o "$obj" \
+        -I"$WEBRTC_SRC" \
+        -I"$WEBRTC_SRC/third_party/abseil-cpp" \
+        -std=c++17 \
+        -fPIC \
+        -fvisibility=hidden \
+        -DWEBRTC_POSIX \
+        -DWEBRTC_ANDROID \
+        -DWEBRTC_LINUX \
+        -DWEBRTC_HAS_NEON \
+        -DNDEBUG \
+        -O2
+    JNI_OBJECTS="$JNI_OBJECTS $obj"
+done
 
 echo "✓ JNI wrapper compiled"
 
@@ -100,7 +110,7 @@ echo "Linking shared library..."
 mkdir -p "$OUTPUT_DIR/$ANDROID_ARCH"
 
 $CXX -shared -o "$OUTPUT_DIR/$ANDROID_ARCH/libwebrtc_apms.so" \
-    "$OUTPUT_DIR/$ANDROID_ARCH/obj/webrtc_apm_jni.o" \
+    $JNI_OBJECTS \
     -Wl,--whole-archive \
     $WEBRTC_LIBS \
     -Wl,--no-whole-archive \
@@ -108,7 +118,8 @@ $CXX -shared -o "$OUTPUT_DIR/$ANDROID_ARCH/libwebrtc_apms.so" \
     -static-libstdc++ \
     -Wl,-soname,libwebrtc_apms.so \
     -Wl,--gc-sections \
-    -Wl,--exclude-libs,ALL
+    -Wl,--exclude-libs,ALL \
+    -Wl,--version-script="$JNI_DIR/libwebrtc_apms.map"
 
 echo "✓ Shared library created"
 echo ""
@@ -0,0 +1,926 @@
+// Adaptive AEC3 echo control for the APM JNI wrapper
+// See adaptive_echo_control.h for the switching model.
+
+#include "adaptive_echo_control.h"
+
+#include <android/log.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "capture_pipeline.h"
+#include "instance_arena.h"
+#include "modules/audio_processing/aec3/echo_canceller3.h"
+#include "modules/audio_processing/audio_buffer.h"
+
+#define LOG_TAG "WebRTC-APM"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+
+using namespace webrtc;
+
+namespace apm_jni {
+
+namespace {
+
+// The shadow instance runs alongside the active one for at most this long
+// before it takes over, enough for the matched filter to lock onto the delay
+constexpr int kShadowWarmupFrames = 150;  // 1.5 s
+
+// It takes over earlier once it has run kMinShadowFrames and its ERLE is
+// converged and within kShadowErleMarginDb of the active instance's
+constexpr int kMinShadowFrames = 30;  // 0.3 s
+constexpr int kShadowCheckIntervalFrames = 10;
+constexpr double kShadowErleMarginDb = 3.0;
+
+// The tier policy looks at the metrics every kEvaluationIntervalFrames, and
+// leaves a freshly switched instance alone for kSettleFrames so its ERLE
+// reflects the new filter
+constexpr int kEvaluationIntervalFrames = 50;  // 0.5 s
+constexpr int kSettleFrames = 300;             // 3 s
+
+// Consecutive evaluations that must agree before switching. Growing is quick
+// (echo leaks until it happens); shrinking is slow to avoid flapping.
+constexpr int kGrowVotes = 2;
+constexpr int kShrinkVotes = 10;
+
+// ERLE this low after settling means echo energy beyond the filter tail
+constexpr double kLowErleDb = 6.0;
+
+// Delay movement that counts as a different echo path
+constexpr int kDelayChangeMs = 40;
+
+// An echo path counts as converged, and is exported, once ERLE has stayed
+// above kConvergedErleDb at a steady delay for kStableSnapshots evaluations
+constexpr double kConvergedErleDb = 10.0;
+constexpr int kStableSnapshots = 4;  // 2 s
+
+// Warm-started instances: AEC3 works in 4 ms blocks, the initial state lasts
+// long enough to confirm the stored delay, and the initial echo path gain is
+// never set below -10 dB in case the stored ERL is optimistic
+constexpr int kBlockMs = 4;
+constexpr float kWarmStartInitialStateSeconds = 0.5f;
+constexpr float kMinWarmStartGain = 0.1f;
+
+// Serialized EchoPathState: magic, four fields, FNV-1a checksum
+constexpr uint32_t kEchoPathMagic = 0x31504541;  // "AEP1"
+constexpr int kMaxEchoPathDelayMs = 5000;
+constexpr int kMaxEchoPathLengthBlocks = 250;
+
+// Standard-length tiers below the configured (full) length, each covering
+// echo paths up to max_delay_ms
+struct FilterTier {
+    size_t length_blocks;
+    int max_delay_ms;
+};
+
+constexpr FilterTier kShortTiers[] = {
+    {13, 120},  // upstream default, wired headsets and handsets
+    {24, 320},  // car kits, low-latency Bluetooth
+};
+
+// Identifies an AEC3 build by what sizes its buffers: filter lengths, delay
+// estimator and stream format
+uint64_t AecArenaKey(const EchoCanceller3Config& config,
+                     int sample_rate_hz,
+                     int num_render_channels,
+                     int num_capture_channels) {
+    const uint64_t fields[] = {
+        config.filter.refined.length_blocks,
+        config.filter.coarse.length_blocks,
+        config.filter.refined_initial.length_blocks,
+        config.filter.coarse_initial.length_blocks,
+        config.delay.num_filters,
+        config.delay.down_sampling_factor,
+        config.buffering.max_allowed_excess_render_blocks,
+        static_cast<uint64_t>(sample_rate_hz),
+        static_cast<uint64_t>(num_render_channels),
+        static_cast<uint64_t>(num_capture_channels),
+    };
+    uint64_t hash = 14695981039346656037ull;
+    for (uint64_t field : fields) hash = (hash ^ field) * 1099511628211ull;
+    return hash;
+}
+
+// Built directly rather than through EchoCanceller3Factory, which would hide
+// SetSuppressorTuning behind EchoControl. Same instance otherwise: no
+// separate multichannel config.
+std::unique_ptr<Aec3Instance> CreateEchoCanceller3(const EchoCanceller3Config& config,
+                                                   int sample_rate_hz,
+                                                   int num_render_channels,
+                                                   int num_capture_channels) {
+    std::unique_ptr<EchoCanceller3> instance;
+    std::unique_ptr<InstanceArena> arena;
+    {
+        ArenaScope scope(
+            AecArenaKey(config, sample_rate_hz, num_render_channels, num_capture_channels));
+        instance = std::make_unique<EchoCanceller3>(
+            config, absl::nullopt, sample_rate_hz, static_cast<size_t>(num_render_channels),
+            static_cast<size_t>(num_capture_channels));
+        arena = scope.TakeArena();
+    }
+    // The wrapper itself lives on the heap, outside the scope
+    return std::make_unique<Aec3Instance>(std::move(instance), std::move(arena));
+}
+
+void CopySplitBands(AudioBuffer* src, AudioBuffer* dst) {
+    dst->set_num_channels(src->num_channels());
+    const size_t bytes = src->num_frames_per_band() * sizeof(float);
+    for (size_t ch = 0; ch < src->num_channels(); ch++) {
+        for (size_t band = 0; band < src->num_bands(); band++) {
+            memcpy(dst->split_bands(ch)[band], src->split_bands_const(ch)[band], bytes);
+        }
+    }
+}
+
+// Linear crossfade from the output already in |out| to |in| over one frame
+void CrossfadeSplitBands(AudioBuffer* in, AudioBuffer* out) {
+    const size_t num_frames = out->num_frames_per_band();
+    for (size_t ch = 0; ch < out->num_channels(); ch++) {
+        for (size_t band = 0; band < out->num_bands(); band++) {
+            const float* from = in->split_bands_const(ch)[band];
+            float* to = out->split_bands(ch)[band];
+            for (size_t i = 0; i < num_frames; i++) {
+                float weight = static_cast<float>(i + 1) / num_frames;
+                to[i] += weight * (from[i] - to[i]);
+            }
+        }
+    }
+}
+
+void PutU32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+uint32_t GetU32(const uint8_t* in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) value |= static_cast<uint32_t>(in[i]) << (8 * i);
+    return value;
+}
+
+uint32_t Checksum(const uint8_t* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+uint32_t FloatBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float BitsFloat(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+}  // namespace
+
+// ============================================================================
+// Aec3Instance
+// ============================================================================
+
+Aec3Instance::Aec3Instance(std::unique_ptr<EchoCanceller3> aec3,
+                           std::unique_ptr<InstanceArena> arena)
+    : arena_(std::move(arena)), aec3_(std::move(aec3)) {}
+
+Aec3Instance::~Aec3Instance() = default;
+
+void Aec3Instance::AnalyzeRender(AudioBuffer* render) { aec3_->AnalyzeRender(render); }
+
+void Aec3Instance::AnalyzeCapture(AudioBuffer* capture) { aec3_->AnalyzeCapture(capture); }
+
+void Aec3Instance::ProcessCapture(AudioBuffer* capture, bool level_change) {
+    aec3_->ProcessCapture(capture, level_change);
+}
+
+void Aec3Instance::ProcessCapture(AudioBuffer* capture, AudioBuffer* linear_output,
+                                  bool level_change) {
+    aec3_->ProcessCapture(capture, linear_output, level_change);
+}
+
+EchoControl::Metrics Aec3Instance::GetMetrics() const { return aec3_->GetMetrics(); }
+
+void Aec3Instance::SetAudioBufferDelay(int delay_ms) { aec3_->SetAudioBufferDelay(delay_ms); }
+
+void Aec3Instance::SetCaptureOutputUsage(bool capture_output_used) {
+    aec3_->SetCaptureOutputUsage(capture_output_used);
+}
+
+bool Aec3Instance::ActiveProcessing() const { return aec3_->ActiveProcessing(); }
+
+void Aec3Instance::SetSuppressorTuning(const EchoCanceller3Config::Suppressor& suppressor) {
+    aec3_->SetSuppressorTuning(suppressor);
+}
+
+// ============================================================================
+// EchoPathState
+// ============================================================================
+
+std::vector<uint8_t> SerializeEchoPathState(const EchoPathState& state) {
+    std::vector<uint8_t> blob(kEchoPathStateSize);
+    PutU32(&blob[0], kEchoPathMagic);
+    PutU32(&blob[4], static_cast<uint32_t>(state.delay_ms));
+    PutU32(&blob[8], static_cast<uint32_t>(state.filter_length_blocks));
+    PutU32(&blob[12], FloatBits(state.erl_db));
+    PutU32(&blob[16], FloatBits(state.erle_db));
+    PutU32(&blob[20], Checksum(blob.data(), 20));
+    return blob;
+}
+
+bool ParseEchoPathState(const uint8_t* data, size_t size, EchoPathState* state) {
+    if (!data || size != kEchoPathStateSize) return false;
+    if (GetU32(&data[0]) != kEchoPathMagic || GetU32(&data[20]) != Checksum(data, 20)) return false;
+
+    EchoPathState parsed;
+    parsed.delay_ms = static_cast<int>(GetU32(&data[4]));
+    parsed.filter_length_blocks = static_cast<int>(GetU32(&data[8]));
+    parsed.erl_db = BitsFloat(GetU32(&data[12]));
+    parsed.erle_db = BitsFloat(GetU32(&data[16]));
+    if (parsed.delay_ms < 0 || parsed.delay_ms > kMaxEchoPathDelayMs ||
+        parsed.filter_length_blocks < 1 || parsed.filter_length_blocks > kMaxEchoPathLengthBlocks ||
+        !std::isfinite(parsed.erl_db) || !std::isfinite(parsed.erle_db)) {
+        return false;
+    }
+    *state = parsed;
+    return true;
+}
+
+// ============================================================================
+// EchoControlHandle
+// ============================================================================
+
+EchoControlHandle::EchoControlHandle(const EchoCanceller3Config& config,
+                                     std::shared_ptr<StageTimings> timings)
+    : timings_(std::move(timings)), config_(config) {}
+
+void EchoControlHandle::Reconfigure(const EchoCanceller3Config& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_ = config;
+    if (instance_) instance_->Reconfigure(config);
+}
+
+void EchoControlHandle::Reset(const EchoCanceller3Config& config) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_ = config;
+    adaptive_length_ = false;
+    length_cap_ = 0;
+    external_delay_ms_ = -1;
+    warm_start_.reset();
+}
+
+void EchoControlHandle::SetSuppressorTuning(const EchoCanceller3Config::Suppressor& suppressor) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_.suppressor = suppressor;
+    if (instance_) instance_->SetSuppressorTuning(suppressor);
+}
+
+void EchoControlHandle::SetAdaptiveLength(bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    adaptive_length_ = enabled;
+    if (instance_) instance_->SetAdaptiveLength(enabled);
+}
+
+bool EchoControlHandle::adaptive_length() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return adaptive_length_;
+}
+
+void EchoControlHandle::SetFilterLengthCap(size_t length_blocks, bool shed_load) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    length_cap_ = length_blocks;
+    if (instance_) instance_->SetFilterLengthCap(length_blocks, shed_load);
+}
+
+size_t EchoControlHandle::filter_length_cap() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return length_cap_;
+}
+
+void EchoControlHandle::SetExternalDelay(int delay_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    external_delay_ms_ = delay_ms;
+    if (instance_) instance_->SetExternalDelay(delay_ms);
+}
+
+bool EchoControlHandle::ExportEchoPath(EchoPathState* state) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!instance_) return false;
+    std::optional<EchoPathState> converged = instance_->converged_state();
+    if (!converged) return false;
+    *state = *converged;
+    return true;
+}
+
+void EchoControlHandle::ClearEchoPath() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (instance_) instance_->ClearConvergedState();
+}
+
+void EchoControlHandle::ImportEchoPath(const EchoPathState& state) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    warm_start_ = state;
+    if (instance_) instance_->ImportEchoPath(state);
+}
+
+int EchoControlHandle::FilterLengthBlocks() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return instance_ ? static_cast<int>(instance_->filter_length_blocks()) : -1;
+}
+
+EchoCanceller3Config EchoControlHandle::config() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return config_;
+}
+
+void EchoControlHandle::Register(AdaptiveEchoControl* instance) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    instance_ = instance;
+}
+
+void EchoControlHandle::Unregister(AdaptiveEchoControl* instance) {
+    // APM creates the replacement before destroying the old instance
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (instance_ == instance) instance_ = nullptr;
+}
+
+// ============================================================================
+// AdaptiveEchoControlFactory
+// ============================================================================
+
+AdaptiveEchoControlFactory::AdaptiveEchoControlFactory(std::shared_ptr<EchoControlHandle> handle)
+    : handle_(std::move(handle)) {}
+
+std::unique_ptr<EchoControl> AdaptiveEchoControlFactory::Create(int sample_rate_hz,
+                                                                int num_render_channels,
+                                                                int num_capture_channels) {
+    return std::make_unique<AdaptiveEchoControl>(handle_, sample_rate_hz,
+                                                 num_render_channels, num_capture_channels);
+}
+
+// ============================================================================
+// AdaptiveEchoControl
+// ============================================================================
+
+AdaptiveEchoControl::AdaptiveEchoControl(std::shared_ptr<EchoControlHandle> handle,
+                                         int sample_rate_hz,
+                                         int num_render_channels,
+                                         int num_capture_channels)
+    : handle_(std::move(handle)),
+      timings_(handle_->timings_.get()),
+      sample_rate_hz_(sample_rate_hz),
+      num_render_channels_(num_render_channels),
+      num_capture_channels_(num_capture_channels),
+      base_config_(handle_->config()),
+      adaptive_length_(handle_->adaptive_length()),
+      length_cap_(handle_->filter_length_cap()),
+      pending_adaptive_length_(adaptive_length_),
+      pending_length_cap_(length_cap_),
+      builder_(this) {
+    BuildTiers();
+    {
+        std::lock_guard<std::mutex> lock(handle_->mutex_);
+        external_delay_ms_.store(handle_->external_delay_ms_, std::memory_order_relaxed);
+        warm_start_ = handle_->warm_start_;
+    }
+
+    // Adaptive sessions start short and grow once the delay is known, unless
+    // a warm start already says how long the echo path is
+    if (!adaptive_length_) {
+        active_tier_ = tier_lengths_.size() - 1;
+    } else {
+        active_tier_ = warm_start_ ? WarmStartTier() : 0;
+    }
+    // APM needs a working instance right away, so the first one is built
+    // here on the thread creating the echo control
+    active_ = CreateEchoCanceller3(InstanceConfig(active_tier_), sample_rate_hz_,
+                                   num_render_channels_, num_capture_channels_);
+    ConfigureInstance(active_.get());
+    length_blocks_.store(tier_lengths_[active_tier_], std::memory_order_relaxed);
+    frames_until_evaluation_ = kSettleFrames;
+    frames_until_snapshot_ = kSettleFrames;
+
+    // Allocated up front so that starting a shadow does not allocate
+    shadow_capture_ = std::make_unique<AudioBuffer>(
+        sample_rate_hz_, num_capture_channels_, sample_rate_hz_, num_capture_channels_,
+        sample_rate_hz_, num_capture_channels_);
+
+    handle_->Register(this);
+}
+
+AdaptiveEchoControl::~AdaptiveEchoControl() {
+    handle_->Unregister(this);
+
+    // A build or teardown may still be running on the worker
+    BackgroundWorker::Get().Wait(&builder_);
+    delete builder_.built.load(std::memory_order_acquire);
+    DestroyRetired(builder_.retired.exchange(nullptr, std::memory_order_acquire));
+}
+
+AdaptiveEchoControl::Builder::Builder(const AdaptiveEchoControl* owner) : owner(owner) {}
+
+void AdaptiveEchoControl::Builder::Run() {
+    DestroyRetired(retired.exchange(nullptr, std::memory_order_acquire));
+    if (!build.exchange(false, std::memory_order_acquire)) return;
+
+    std::unique_ptr<Aec3Instance> instance =
+        CreateEchoCanceller3(config, owner->sample_rate_hz_, owner->num_render_channels_,
+                             owner->num_capture_channels_);
+    built.store(instance.release(), std::memory_order_release);
+}
+
+void AdaptiveEchoControl::AnalyzeRender(AudioBuffer* render) {
+    ScopedStageTimer timer(timings_, StageTimings::kAec3AnalyzeRender);
+    std::lock_guard<std::mutex> lock(render_mutex_);
+    active_->AnalyzeRender(render);
+    if (shadow_) shadow_->AnalyzeRender(render);
+}
+
+void AdaptiveEchoControl::AnalyzeCapture(AudioBuffer* capture) {
+    ScopedStageTimer timer(timings_, StageTimings::kAec3AnalyzeCapture);
+
+    // APM calls AnalyzeCapture first on every capture frame, so this is where
+    // requests are applied and a finished build is put to use
+    if (has_pending_.load(std::memory_order_acquire)) ApplyPendingRequest();
+    if (building_) CollectBuild();
+
+    const int external_delay_ms = external_delay_ms_.load(std::memory_order_relaxed);
+    if (external_delay_ms != applied_external_delay_ms_) {
+        applied_external_delay_ms_ = external_delay_ms;
+        audio_buffer_delay_ms_ = external_delay_ms >= 0 ? std::optional<int>(external_delay_ms)
+                                                        : apm_stream_delay_ms_;
+        if (audio_buffer_delay_ms_) {
+            active_->SetAudioBufferDelay(*audio_buffer_delay_ms_);
+            if (shadow_) shadow_->SetAudioBufferDelay(*audio_buffer_delay_ms_);
+        }
+    }
+
+    if (!shadow_ && !reconfigure_needed_ && !building_) {
+        if (adaptive_length_) UpdateTier();
+        UpdateConvergedState();
+    }
+    if (reconfigure_needed_ && !building_) {
+        reconfigure_needed_ = false;
+        RequestBuild(shadow_tier_);
+    }
+
+    active_->AnalyzeCapture(capture);
+    if (shadow_) shadow_->AnalyzeCapture(capture);
+}
+
+void AdaptiveEchoControl::ProcessCapture(AudioBuffer* capture, bool level_change) {
+    ProcessCapture(capture, nullptr, level_change);
+}
+
+void AdaptiveEchoControl::ProcessCapture(AudioBuffer* capture,
+                                         AudioBuffer* linear_output,
+                                         bool level_change) {
+    ScopedStageTimer timer(timings_, StageTimings::kAec3ProcessCapture);
+    capture_started_ = true;
+    if (shadow_) {
+        CopySplitBands(capture, shadow_capture_.get());
+        shadow_->ProcessCapture(shadow_capture_.get(), level_change);
+        shadow_frames_++;
+    }
+
+    if (linear_output) {
+        active_->ProcessCapture(capture, linear_output, level_change);
+    } else {
+        active_->ProcessCapture(capture, level_change);
+    }
+
+    if (shadow_) {
+        bool ready = shadow_frames_ >= kShadowWarmupFrames;
+        if (!ready && shadow_frames_ >= kMinShadowFrames &&
+            shadow_frames_ % kShadowCheckIntervalFrames == 0) {
+            const double shadow_erle = shadow_->GetMetrics().echo_return_loss_enhancement;
+            const double active_erle = active_->GetMetrics().echo_return_loss_enhancement;
+            ready = shadow_erle >= std::max(kConvergedErleDb, active_erle - kShadowErleMarginDb);
+        }
+        if (ready) FinishShadow(capture);
+    }
+
+    if (CapturePipeline* pipeline = handle_->output_tap_.load(std::memory_order_acquire)) {
+        pipeline->StoreEchoOutput(*capture);
+    }
+}
+
+EchoControl::Metrics AdaptiveEchoControl::GetMetrics() const {
+    return active_->GetMetrics();
+}
+
+void AdaptiveEchoControl::SetAudioBufferDelay(int delay_ms) {
+    // APM passes set_stream_delay_ms here; a wrapper estimate overrides it
+    apm_stream_delay_ms_ = delay_ms;
+    if (applied_external_delay_ms_ >= 0) return;
+    audio_buffer_delay_ms_ = delay_ms;
+    active_->SetAudioBufferDelay(delay_ms);
+    if (shadow_) shadow_->SetAudioBufferDelay(delay_ms);
+}
+
+void AdaptiveEchoControl::SetCaptureOutputUsage(bool capture_output_used) {
+    capture_output_used_ = capture_output_used;
+    active_->SetCaptureOutputUsage(capture_output_used);
+    if (shadow_) shadow_->SetCaptureOutputUsage(capture_output_used);
+}
+
+bool AdaptiveEchoControl::ActiveProcessing() const {
+    return active_->ActiveProcessing();
+}
+
+void AdaptiveEchoControl::Reconfigure(const EchoCanceller3Config& config) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_config_ = config;
+    pending_has_config_ = true;
+    has_pending_.store(true, std::memory_order_release);
+}
+
+void AdaptiveEchoControl::SetSuppressorTuning(const EchoCanceller3Config::Suppressor& suppressor) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_suppressor_ = suppressor;
+    has_pending_.store(true, std::memory_order_release);
+}
+
+void AdaptiveEchoControl::SetAdaptiveLength(bool enabled) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_adaptive_length_ = enabled;
+    has_pending_.store(true, std::memory_order_release);
+}
+
+void AdaptiveEchoControl::SetFilterLengthCap(size_t length_blocks, bool shed_load) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_length_cap_ = length_blocks;
+    pending_shed_load_ = shed_load;
+    has_pending_.store(true, std::memory_order_release);
+}
+
+void AdaptiveEchoControl::ImportEchoPath(const EchoPathState& state) {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    pending_warm_start_ = state;
+    has_pending_.store(true, std::memory_order_release);
+}
+
+std::optional<EchoPathState> AdaptiveEchoControl::converged_state() const {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    return converged_state_;
+}
+
+void AdaptiveEchoControl::ClearConvergedState() {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    converged_state_.reset();
+}
+
+void AdaptiveEchoControl::ApplyPendingRequest() {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    has_pending_.store(false, std::memory_order_relaxed);
+
+    // Tier indices and the base config may change below, so a build in
+    // flight is discarded when it arrives; the request itself asks for a
+    // new one if it needs it. A suppressor tuning alone is applied in place
+    // and does not invalidate it.
+    const bool rebuild_request = pending_has_config_ ||
+                                 pending_adaptive_length_ != adaptive_length_ ||
+                                 pending_length_cap_ != length_cap_ || pending_warm_start_;
+    if (building_ && rebuild_request) build_stale_ = true;
+
+    const size_t active_length = tier_lengths_[active_tier_];
+    if (pending_has_config_) {
+        pending_has_config_ = false;
+        base_config_ = pending_config_;
+
+        BuildTiers();
+
+        // Keep the current length if it is still a tier, otherwise go full
+        auto it = std::find(tier_lengths_.begin(), tier_lengths_.end(), active_length);
+        active_tier_ = it != tier_lengths_.end() ? it - tier_lengths_.begin() : tier_lengths_.size() - 1;
+        shadow_tier_ = active_tier_;
+        reconfigure_needed_ = true;
+    }
+
+    if (pending_adaptive_length_ != adaptive_length_) {
+        adaptive_length_ = pending_adaptive_length_;
+        grow_votes_ = 0;
+        shrink_votes_ = 0;
+        frames_until_evaluation_ = kSettleFrames;
+        if (!adaptive_length_ && active_tier_ != tier_lengths_.size() - 1) {
+            shadow_tier_ = tier_lengths_.size() - 1;
+            reconfigure_needed_ = true;
+        }
+        LOGI("AEC3 adaptive filter length %s", adaptive_length_ ? "enabled" : "disabled");
+    }
+
+    if (pending_length_cap_ != length_cap_) {
+        length_cap_ = pending_length_cap_;
+        const size_t current_length = tier_lengths_[active_tier_];
+        BuildTiers();
+
+        // Capped sessions shrink to the cap. When it is lifted, fixed-length
+        // sessions return to full length and adaptive ones grow as needed.
+        const size_t top_tier = tier_lengths_.size() - 1;
+        auto it = std::find(tier_lengths_.begin(), tier_lengths_.end(), current_length);
+        active_tier_ = it != tier_lengths_.end() ? it - tier_lengths_.begin() : top_tier;
+        const size_t wanted = adaptive_length_ ? active_tier_ : top_tier;
+        if (tier_lengths_[wanted] != current_length) {
+            shadow_tier_ = wanted;
+            reconfigure_needed_ = true;
+            // The echo path is unchanged, so the replacement can start from it
+            if (!warm_start_) {
+                std::lock_guard<std::mutex> state_lock(state_mutex_);
+                warm_start_ = converged_state_;
+            }
+            if (pending_shed_load_) {
+                // Stop paying for a second instance now rather than after
+                // the capped one is built
+                switch_direct_ = true;
+                std::unique_ptr<Aec3Instance> shadow;
+                {
+                    std::lock_guard<std::mutex> render_lock(render_mutex_);
+                    shadow = std::move(shadow_);
+                }
+                Retire(std::move(shadow));
+            }
+        }
+        pending_shed_load_ = false;
+        if (length_cap_ > 0) {
+            LOGI("AEC3 filter length capped at %zu blocks", length_cap_);
+        } else {
+            LOGI("AEC3 filter length cap lifted");
+        }
+    }
+
+    if (pending_warm_start_) {
+        warm_start_ = pending_warm_start_;
+        pending_warm_start_.reset();
+        shadow_tier_ = adaptive_length_ ? WarmStartTier() : tier_lengths_.size() - 1;
+        reconfigure_needed_ = true;
+    }
+
+    if (pending_suppressor_) {
+        base_config_.suppressor = *pending_suppressor_;
+        pending_suppressor_.reset();
+        // Only the suppressor gains change, so the running instances take it
+        // at this block boundary, and a build in flight when it arrives
+        active_->SetSuppressorTuning(base_config_.suppressor);
+        if (shadow_) shadow_->SetSuppressorTuning(base_config_.suppressor);
+        LOGI("AEC3 suppressor tuning updated");
+    }
+}
+
+void AdaptiveEchoControl::BuildTiers() {
+    tier_lengths_.clear();
+    size_t full_length = base_config_.filter.refined.length_blocks;
+    if (length_cap_ > 0) full_length = std::min(full_length, length_cap_);
+    for (const FilterTier& tier : kShortTiers) {
+        if (tier.length_blocks < full_length) {
+            tier_lengths_.push_back(tier.length_blocks);
+        }
+    }
+    tier_lengths_.push_back(full_length);
+    erle_floor_tier_ = 0;
+}
+
+void AdaptiveEchoControl::UpdateTier() {
+    if (--frames_until_evaluation_ > 0) return;
+    frames_until_evaluation_ = kEvaluationIntervalFrames;
+
+    const Metrics metrics = active_->GetMetrics();
+    const size_t top_tier = tier_lengths_.size() - 1;
+
+    size_t wanted = top_tier;
+    for (size_t tier = 0; tier < top_tier; tier++) {
+        if (metrics.delay_ms <= kShortTiers[tier].max_delay_ms) {
+            wanted = tier;
+            break;
+        }
+    }
+
+    // Echo the filter tail cannot reach keeps ERLE low even at the right
+    // delay. The tier that fixed it stays the floor until the delay moves.
+    if (erle_floor_tier_ > 0 && std::abs(metrics.delay_ms - erle_floor_delay_ms_) > kDelayChangeMs) {
+        erle_floor_tier_ = 0;
+    }
+    if (wanted <= active_tier_ && active_tier_ < top_tier &&
+        metrics.echo_return_loss_enhancement < kLowErleDb) {
+        wanted = active_tier_ + 1;
+        if (grow_votes_ + 1 >= kGrowVotes) {
+            erle_floor_tier_ = wanted;
+            erle_floor_delay_ms_ = metrics.delay_ms;
+        }
+    }
+    wanted = std::max(wanted, erle_floor_tier_);
+
+    if (wanted > active_tier_) {
+        shrink_votes_ = 0;
+        if (++grow_votes_ < kGrowVotes) return;
+    } else if (wanted < active_tier_) {
+        grow_votes_ = 0;
+        if (++shrink_votes_ < kShrinkVotes) return;
+    } else {
+        grow_votes_ = 0;
+        shrink_votes_ = 0;
+        return;
+    }
+
+    LOGD("AEC3 filter tier change: delay=%d ms erle=%.1f dB, %zu -> %zu blocks",
+         metrics.delay_ms, metrics.echo_return_loss_enhancement,
+         tier_lengths_[active_tier_], tier_lengths_[wanted]);
+    grow_votes_ = 0;
+    shrink_votes_ = 0;
+    shadow_tier_ = wanted;
+    reconfigure_needed_ = true;
+}
+
+void AdaptiveEchoControl::UpdateConvergedState() {
+    if (--frames_until_snapshot_ > 0) return;
+    frames_until_snapshot_ = kEvaluationIntervalFrames;
+
+    const Metrics metrics = active_->GetMetrics();
+    const int delay_ms = applied_external_delay_ms_ >= 0 ? applied_external_delay_ms_ : metrics.delay_ms;
+    if (metrics.echo_return_loss_enhancement < kConvergedErleDb || delay_ms < 0 ||
+        std::abs(delay_ms - snapshot_delay_ms_) > kDelayChangeMs) {
+        stable_snapshots_ = 0;
+        snapshot_delay_ms_ = delay_ms;
+        return;
+    }
+    if (++stable_snapshots_ < kStableSnapshots) return;
+
+    EchoPathState state;
+    state.delay_ms = delay_ms;
+    state.filter_length_blocks = static_cast<int>(tier_lengths_[active_tier_]);
+    state.erl_db = static_cast<float>(metrics.echo_return_loss);
+    state.erle_db = static_cast<float>(metrics.echo_return_loss_enhancement);
+
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    if (!converged_state_) {
+        LOGI("AEC3 echo path converged: delay=%d ms erle=%.1f dB", delay_ms,
+             metrics.echo_return_loss_enhancement);
+    }
+    converged_state_ = state;
+}
+
+// Shortest tier that holds the stored filter length
+size_t AdaptiveEchoControl::WarmStartTier() const {
+    for (size_t tier = 0; tier < tier_lengths_.size(); tier++) {
+        if (tier_lengths_[tier] >= static_cast<size_t>(warm_start_->filter_length_blocks)) return tier;
+    }
+    return tier_lengths_.size() - 1;
+}
+
+EchoCanceller3Config AdaptiveEchoControl::TierConfig(size_t tier) const {
+    EchoCanceller3Config config = base_config_;
+    const size_t length = tier_lengths_[tier];
+    config.filter.refined.length_blocks = length;
+    config.filter.coarse.length_blocks = length;
+    config.filter.refined_initial.length_blocks =
+        std::min(config.filter.refined_initial.length_blocks, length);
+    config.filter.coarse_initial.length_blocks =
+        std::min(config.filter.coarse_initial.length_blocks, length);
+    return config;
+}
+
+// Config of the next instance at tier; consumes the warm start
+EchoCanceller3Config AdaptiveEchoControl::InstanceConfig(size_t tier) {
+    EchoCanceller3Config config = TierConfig(tier);
+    if (warm_start_) {
+        // The render buffer starts at default_delay unless the app supplies a
+        // stream delay, and the initial filter is the full tier length
+        config.delay.default_delay = static_cast<size_t>(warm_start_->delay_ms / kBlockMs);
+        config.filter.refined_initial.length_blocks = config.filter.refined.length_blocks;
+        config.filter.coarse_initial.length_blocks = config.filter.coarse.length_blocks;
+        config.filter.conservative_initial_phase = false;
+        config.filter.initial_state_seconds =
+            std::min(config.filter.initial_state_seconds, kWarmStartInitialStateSeconds);
+        const float gain = std::pow(10.0f, -warm_start_->erl_db / 10.0f);
+        config.ep_strength.default_gain =
+            std::min(config.ep_strength.default_gain, std::max(gain, kMinWarmStartGain));
+        LOGI("AEC3 warm start: delay=%d ms, %zu-block filter", warm_start_->delay_ms,
+             tier_lengths_[tier]);
+        warm_start_.reset();
+    }
+    return config;
+}
+
+// Brings a new instance in line with the stream settings APM has passed,
+// and with a suppressor tuning that changed while it was being built
+void AdaptiveEchoControl::ConfigureInstance(Aec3Instance* instance) {
+    if (audio_buffer_delay_ms_) instance->SetAudioBufferDelay(*audio_buffer_delay_ms_);
+    instance->SetCaptureOutputUsage(capture_output_used_);
+    instance->SetSuppressorTuning(base_config_.suppressor);
+}
+
+void AdaptiveEchoControl::RequestBuild(size_t tier) {
+    building_warm_start_ = warm_start_;
+    builder_.config = InstanceConfig(tier);
+    builder_.build.store(true, std::memory_order_release);
+    building_tier_ = tier;
+    building_length_ = tier_lengths_[tier];
+    building_direct_ = switch_direct_;
+    switch_direct_ = false;
+    building_ = true;
+    BackgroundWorker::Get().Post(&builder_);
+}
+
+void AdaptiveEchoControl::CollectBuild() {
+    std::unique_ptr<Aec3Instance> instance(builder_.built.exchange(nullptr, std::memory_order_acquire));
+    if (!instance) return;
+    building_ = false;
+
+    if (build_stale_) {
+        build_stale_ = false;
+        Retire(std::move(instance));
+        // The echo path it was warm started from still holds, and unless the
+        // new request replaced it the switch is still wanted
+        if (!warm_start_) warm_start_ = building_warm_start_;
+        switch_direct_ = switch_direct_ || building_direct_;
+        auto it = std::find(tier_lengths_.begin(), tier_lengths_.end(), building_length_);
+        if (!reconfigure_needed_ && it != tier_lengths_.end() &&
+            (*it != length_blocks_.load(std::memory_order_relaxed) || building_warm_start_)) {
+            shadow_tier_ = it - tier_lengths_.begin();
+            reconfigure_needed_ = true;
+        }
+        return;
+    }
+
+    ConfigureInstance(instance.get());
+    if (capture_started_ && !building_direct_) {
+        StartShadow(std::move(instance), building_tier_);
+    } else {
+        // Nothing has converged yet, so there is nothing to warm up for, or
+        // the switch sheds load and cannot afford a warm-up
+        std::unique_ptr<Aec3Instance> shadow;
+        {
+            std::lock_guard<std::mutex> lock(render_mutex_);
+            shadow = std::move(shadow_);
+        }
+        Retire(std::move(shadow));
+        ReplaceActive(std::move(instance), building_tier_);
+    }
+}
+
+// Hands an instance that no render call can reach any more to the worker.
+// The list has no bound, so however far behind the worker is, the capture
+// thread never pays for a destructor.
+void AdaptiveEchoControl::Retire(std::unique_ptr<Aec3Instance> instance) {
+    if (!instance) return;
+    Aec3Instance* node = instance.release();
+    node->retired_next_ = builder_.retired.load(std::memory_order_relaxed);
+    while (!builder_.retired.compare_exchange_weak(node->retired_next_, node,
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed)) {
+    }
+    BackgroundWorker::Get().Post(&builder_);
+}
+
+void AdaptiveEchoControl::DestroyRetired(Aec3Instance* list) {
+    while (list) {
+        Aec3Instance* next = list->retired_next_;
+        delete list;
+        list = next;
+    }
+}
+
+void AdaptiveEchoControl::ReplaceActive(std::unique_ptr<Aec3Instance> instance, size_t tier) {
+    std::unique_ptr<Aec3Instance> retired;
+    {
+        std::lock_guard<std::mutex> lock(render_mutex_);
+        retired = std::move(active_);
+        active_ = std::move(instance);
+    }
+    Retire(std::move(retired));
+    active_tier_ = tier;
+    length_blocks_.store(tier_lengths_[active_tier_], std::memory_order_relaxed);
+    frames_until_evaluation_ = kSettleFrames;
+    frames_until_snapshot_ = kSettleFrames;
+    stable_snapshots_ = 0;
+
+    LOGI("AEC3 switched to %zu-block filter", tier_lengths_[active_tier_]);
+}
+
+void AdaptiveEchoControl::StartShadow(std::unique_ptr<Aec3Instance> shadow, size_t tier) {
+    {
+        // A shadow still warming up for an older request is replaced
+        std::lock_guard<std::mutex> lock(render_mutex_);
+        shadow.swap(shadow_);
+    }
+    Retire(std::move(shadow));
+    shadow_tier_ = tier;
+    shadow_frames_ = 0;
+
+    LOGI("AEC3 reconfiguring: warming up %zu-block filter", tier_lengths_[tier]);
+}
+
+void AdaptiveEchoControl::FinishShadow(AudioBuffer* capture) {
+    CrossfadeSplitBands(shadow_capture_.get(), capture);
+
+    std::unique_ptr<Aec3Instance> shadow;
+    {
+        std::lock_guard<std::mutex> lock(render_mutex_);
+        shadow = std::move(shadow_);
+    }
+    ReplaceActive(std::move(shadow), shadow_tier_);
+}
+
+}  // namespace apm_jni
@@ -0,0 +1,331 @@
+// Adaptive AEC3 echo control for the APM JNI wrapper
+//
+// Wraps EchoCanceller3 behind the EchoControl interface so its configuration
+// can change while a stream is running. A reconfiguration builds a shadow
+// EchoCanceller3 with the new config and feeds it the same render and capture
+// audio while the active instance keeps producing output. Once the shadow's
+// ERLE has caught up with the active instance (or after 1.5 s at most) it is
+// crossfaded in over one frame and the old instance is retired. Before the
+// first capture frame a reconfiguration simply replaces the instance.
+//
+// Only the first instance is built when APM creates the echo control. Later
+// ones are built, and retired ones destroyed, on the background worker (see
+// background_worker.h): the capture thread posts the config and picks up the
+// finished instance on a later frame, so it never allocates or frees one.
+//
+// The filter length tier policy builds on that primitive. It picks the
+// refined/coarse filter length from the delay and ERLE reported by the active
+// instance. Short echo paths (wired headsets) run a standard-length filter,
+// and only long Bluetooth paths pay for the full-length one.
+//
+// The converged echo path of a session can be exported and used to warm
+// start the next session on the same route (see EchoPathState).
+
+#ifndef APM_JNI_ADAPTIVE_ECHO_CONTROL_H_
+#define APM_JNI_ADAPTIVE_ECHO_CONTROL_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "api/audio/echo_canceller3_config.h"
+#include "api/audio/echo_control.h"
+#include "background_worker.h"
+#include "stage_timing.h"
+
+namespace webrtc {
+class AudioBuffer;
+class EchoCanceller3;
+}
+
+namespace apm_jni {
+
+class AdaptiveEchoControl;
+class CapturePipeline;
+class InstanceArena;
+
+// One EchoCanceller3, kept together with the arena it was built in (if any)
+// and destroyed before it. Unlike the EchoControl interface it exposes the
+// in-place suppressor tuning of patches/0002.
+class Aec3Instance : public webrtc::EchoControl {
+public:
+    Aec3Instance(std::unique_ptr<webrtc::EchoCanceller3> aec3,
+                 std::unique_ptr<InstanceArena> arena);
+    ~Aec3Instance() override;
+
+    void AnalyzeRender(webrtc::AudioBuffer* render) override;
+    void AnalyzeCapture(webrtc::AudioBuffer* capture) override;
+    void ProcessCapture(webrtc::AudioBuffer* capture, bool level_change) override;
+    void ProcessCapture(webrtc::AudioBuffer* capture,
+                        webrtc::AudioBuffer* linear_output,
+                        bool level_change) override;
+    Metrics GetMetrics() const override;
+    void SetAudioBufferDelay(int delay_ms) override;
+    void SetCaptureOutputUsage(bool capture_output_used) override;
+    bool ActiveProcessing() const override;
+
+    // Takes effect from the next capture block; capture thread only
+    void SetSuppressorTuning(const webrtc::EchoCanceller3Config::Suppressor& suppressor);
+
+private:
+    friend class AdaptiveEchoControl;
+
+    const std::unique_ptr<InstanceArena> arena_;
+    const std::unique_ptr<webrtc::EchoCanceller3> aec3_;
+    Aec3Instance* retired_next_ = nullptr;  // link in the retired list
+};
+
+// What a converged session knows about its echo path. For a given audio
+// route it barely changes between calls, so the next call can skip the delay
+// search and the conservative initial phase. It holds no filter
+// coefficients: the adaptive filters of a warm started instance still
+// converge from zero.
+struct EchoPathState {
+    int delay_ms = 0;              // render-to-capture delay
+    int filter_length_blocks = 0;  // filter length the session settled on
+    float erl_db = 0.0f;           // echo return loss
+    float erle_db = 0.0f;          // enhancement reached when exported
+};
+
+// Versioned, checksummed blob for app-side storage
+constexpr size_t kEchoPathStateSize = 24;
+std::vector<uint8_t> SerializeEchoPathState(const EchoPathState& state);
+bool ParseEchoPathState(const uint8_t* data, size_t size, EchoPathState* state);
+
+// State shared between the factory, the live echo control and the JNI
+// context. APM owns the factory and the echo control and may recreate the
+// latter on format changes, so JNI calls go through this handle rather than
+// holding a pointer to either.
+class EchoControlHandle {
+public:
+    // timings, if set, receives the AEC3 call durations of every instance
+    explicit EchoControlHandle(const webrtc::EchoCanceller3Config& config,
+                               std::shared_ptr<StageTimings> timings = nullptr);
+
+    // Replaces the base AEC3 configuration. A running stream switches to it
+    // after a shadow warm-up, without resetting the audio.
+    void Reconfigure(const webrtc::EchoCanceller3Config& config);
+
+    // Replaces only the suppressor tuning. It is applied to the running
+    // instance in place on the next capture frame (patches/0002), so the
+    // filters and echo path estimates are kept and nothing is rebuilt.
+    void SetSuppressorTuning(const webrtc::EchoCanceller3Config::Suppressor& suppressor);
+
+    // Lets the filter length follow the echo path (off: always full length)
+    void SetAdaptiveLength(bool enabled);
+    bool adaptive_length() const;
+
+    // Caps the filter length of the running and future instances (0 lifts
+    // the cap), e.g. to shed load when processing overruns its deadline.
+    // config() keeps the configured length, which returns with the cap.
+    // With shed_load the switch skips the shadow warm-up, which would run a
+    // second instance exactly when there is no time for one: any shadow is
+    // dropped and the capped instance replaces the active one once built.
+    void SetFilterLengthCap(size_t length_blocks, bool shed_load = false);
+    size_t filter_length_cap() const;
+
+    // Filter length of the active instance, or -1 before the first stream
+    int FilterLengthBlocks() const;
+
+    // Render-to-capture delay from a wrapper-side estimator, handed to AEC3
+    // as its audio buffer delay (requires delay.use_external_delay_estimator).
+    // Unlike set_stream_delay_ms this is not clamped to 500 ms. -1 clears it
+    // and restores the APM stream delay.
+    void SetExternalDelay(int delay_ms);
+
+    // Echo path of the live session once it has converged (stable delay and
+    // ERLE above 10 dB for 2 s); false before that
+    bool ExportEchoPath(EchoPathState* state) const;
+
+    // Forgets the converged echo path, e.g. when the audio route changes
+    void ClearEchoPath();
+
+    // Starts the next AEC3 instance from a known echo path: render buffer
+    // aligned at the stored delay, filter at the stored length from the
+    // first block, no conservative initial phase and an initial echo path
+    // gain from the stored ERL. Later instances start cold again.
+    void ImportEchoPath(const EchoPathState& state);
+
+    webrtc::EchoCanceller3Config config() const;
+
+    // Pipelined capture: every capture frame's output is handed to the
+    // pipeline's second stage (null stops it). Set only while no stream
+    // thread is inside a process call.
+    void SetOutputTap(CapturePipeline* pipeline) { output_tap_.store(pipeline, std::memory_order_release); }
+
+    // Returns the handle to the state of a new one with the given config:
+    // no adaptive length, cap, external delay or warm start. The running
+    // instance is left alone; the next one created starts from this state.
+    void Reset(const webrtc::EchoCanceller3Config& config);
+
+private:
+    friend class AdaptiveEchoControl;
+
+    void Register(AdaptiveEchoControl* instance);
+    void Unregister(AdaptiveEchoControl* instance);
+
+    const std::shared_ptr<StageTimings> timings_;
+
+    mutable std::mutex mutex_;
+    webrtc::EchoCanceller3Config config_;
+    bool adaptive_length_ = false;
+    size_t length_cap_ = 0;
+    int external_delay_ms_ = -1;
+    std::optional<EchoPathState> warm_start_;
+    AdaptiveEchoControl* instance_ = nullptr;
+    std::atomic<CapturePipeline*> output_tap_{nullptr};
+};
+
+class AdaptiveEchoControlFactory : public webrtc::EchoControlFactory {
+public:
+    explicit AdaptiveEchoControlFactory(std::shared_ptr<EchoControlHandle> handle);
+
+    std::unique_ptr<webrtc::EchoControl> Create(int sample_rate_hz,
+                                                int num_render_channels,
+                                                int num_capture_channels) override;
+
+private:
+    std::shared_ptr<EchoControlHandle> handle_;
+};
+
+class AdaptiveEchoControl : public webrtc::EchoControl {
+public:
+    AdaptiveEchoControl(std::shared_ptr<EchoControlHandle> handle,
+                        int sample_rate_hz,
+                        int num_render_channels,
+                        int num_capture_channels);
+    ~AdaptiveEchoControl() override;
+
+    // webrtc::EchoControl
+    void AnalyzeRender(webrtc::AudioBuffer* render) override;
+    void AnalyzeCapture(webrtc::AudioBuffer* capture) override;
+    void ProcessCapture(webrtc::AudioBuffer* capture, bool level_change) override;
+    void ProcessCapture(webrtc::AudioBuffer* capture,
+                        webrtc::AudioBuffer* linear_output,
+                        bool level_change) override;
+    Metrics GetMetrics() const override;
+    void SetAudioBufferDelay(int delay_ms) override;
+    void SetCaptureOutputUsage(bool capture_output_used) override;
+    bool ActiveProcessing() const override;
+
+    // Requests from other threads, applied on the next capture frame
+    void Reconfigure(const webrtc::EchoCanceller3Config& config);
+    void SetSuppressorTuning(const webrtc::EchoCanceller3Config::Suppressor& suppressor);
+    void SetAdaptiveLength(bool enabled);
+    void SetFilterLengthCap(size_t length_blocks, bool shed_load);
+    void SetExternalDelay(int delay_ms) { external_delay_ms_.store(delay_ms, std::memory_order_relaxed); }
+    void ImportEchoPath(const EchoPathState& state);
+
+    std::optional<EchoPathState> converged_state() const;
+    void ClearConvergedState();
+
+    size_t filter_length_blocks() const { return length_blocks_.load(std::memory_order_relaxed); }
+
+private:
+    // Builds the requested instance and destroys retired ones on the
+    // background worker. The capture thread writes config only while no
+    // build is in flight, then sets build and posts. Retired instances are
+    // pushed onto an intrusive lock-free list that only the worker empties,
+    // so retiring never blocks, allocates or destroys on the capture thread.
+    class Builder : public BackgroundTask {
+    public:
+        explicit Builder(const AdaptiveEchoControl* owner);
+        void Run() override;
+
+        const AdaptiveEchoControl* const owner;
+        webrtc::EchoCanceller3Config config;
+        std::atomic<bool> build{false};
+        std::atomic<Aec3Instance*> built{nullptr};
+        std::atomic<Aec3Instance*> retired{nullptr};
+    };
+
+    void ApplyPendingRequest();
+    void BuildTiers();
+    void UpdateTier();
+    void UpdateConvergedState();
+    size_t WarmStartTier() const;
+    webrtc::EchoCanceller3Config TierConfig(size_t tier) const;
+    webrtc::EchoCanceller3Config InstanceConfig(size_t tier);
+    void ConfigureInstance(Aec3Instance* instance);
+    void RequestBuild(size_t tier);
+    void CollectBuild();
+    void Retire(std::unique_ptr<Aec3Instance> instance);
+    static void DestroyRetired(Aec3Instance* list);
+    void ReplaceActive(std::unique_ptr<Aec3Instance> instance, size_t tier);
+    void StartShadow(std::unique_ptr<Aec3Instance> instance, size_t tier);
+    void FinishShadow(webrtc::AudioBuffer* capture);
+
+    const std::shared_ptr<EchoControlHandle> handle_;
+    StageTimings* const timings_;
+    const int sample_rate_hz_;
+    const int num_render_channels_;
+    const int num_capture_channels_;
+
+    // Render calls hold render_mutex_, and the capture thread takes it
+    // whenever it replaces an instance, so a render call never sees one
+    // being destroyed.
+    std::mutex render_mutex_;
+    std::unique_ptr<Aec3Instance> active_;
+    std::unique_ptr<Aec3Instance> shadow_;
+
+    // Capture-thread state
+    webrtc::EchoCanceller3Config base_config_;
+    std::vector<size_t> tier_lengths_;
+    size_t active_tier_ = 0;
+    size_t shadow_tier_ = 0;
+    std::unique_ptr<webrtc::AudioBuffer> shadow_capture_;
+    int shadow_frames_ = 0;
+    bool reconfigure_needed_ = false;
+    bool building_ = false;
+    bool build_stale_ = false;  // a request arrived while building
+    bool switch_direct_ = false;    // next build replaces active_, no shadow
+    bool building_direct_ = false;
+    size_t building_tier_ = 0;
+    size_t building_length_ = 0;
+    std::optional<EchoPathState> building_warm_start_;
+    bool capture_started_ = false;
+    bool adaptive_length_ = false;
+    size_t length_cap_ = 0;
+    int frames_until_evaluation_ = 0;
+    int grow_votes_ = 0;
+    int shrink_votes_ = 0;
+    size_t erle_floor_tier_ = 0;
+    int erle_floor_delay_ms_ = 0;
+    std::optional<int> audio_buffer_delay_ms_;
+    std::optional<int> apm_stream_delay_ms_;
+    int applied_external_delay_ms_ = -1;
+    bool capture_output_used_ = true;
+
+    // Warm start for the next instance created, then cleared
+    std::optional<EchoPathState> warm_start_;
+    int frames_until_snapshot_ = 0;
+    int stable_snapshots_ = 0;
+    int snapshot_delay_ms_ = -1;
+
+    // Cross-thread requests
+    std::mutex pending_mutex_;
+    std::atomic<bool> has_pending_{false};
+    bool pending_has_config_ = false;
+    webrtc::EchoCanceller3Config pending_config_;
+    bool pending_adaptive_length_ = false;
+    size_t pending_length_cap_ = 0;
+    bool pending_shed_load_ = false;
+    std::optional<EchoPathState> pending_warm_start_;
+    std::optional<webrtc::EchoCanceller3Config::Suppressor> pending_suppressor_;
+
+    // Converged echo path (capture thread writes, JNI thread reads)
+    mutable std::mutex state_mutex_;
+    std::optional<EchoPathState> converged_state_;
+
+    std::atomic<int> external_delay_ms_{-1};
+    std::atomic<size_t> length_blocks_{0};
+
+    Builder builder_;
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_ADAPTIVE_ECHO_CONTROL_H_
@@ -10,6 +10,8 @@
 #include <jni.h>
 #include <android/log.h>
 
+#include <vector>
+
 #include "modules/audio_processing/include/audio_processing.h"
 #include "rtc_base/ref_counted_object.h"
 #include "api/audio/echo_canceller3_config.h"
@@ -21,11 +23,57 @@
 
 using namespace webrtc;
 
-// Global APM instance holder
-static rtc::scoped_refptr<AudioProcessing> g_apm;
+// 10 ms at 48 kHz, the largest frame APM processes natively
+static const size_t kMaxFrameSamples = 480;
+
+// Per-instance state. The jlong returned by nativeCreateApmInstance points to
+// one of these; Java keeps it in Apm.nativeApmInstance, so any number of Apm
+// objects can run independently in one process.
+struct ApmInstance {
+    rtc::scoped_refptr<AudioProcessing> apm;
+
+    // Float conversion buffers, one per direction because render and capture
+    // are called from different threads. Sized up front; they only grow if a
+    // caller passes frames longer than kMaxFrameSamples.
+    std::vector<float> capture_buffer = std::vector<float>(kMaxFrameSamples);
+    std::vector<float> render_buffer = std::vector<float>(kMaxFrameSamples);
+};
+
+// Apm.nativeApmInstance field ID, resolved once in JNI_OnLoad
+static jfieldID g_instance_field = nullptr;
+
+static jfieldID GetInstanceField(JNIEnv* env, jobject thiz) {
+    if (g_instance_field) return g_instance_field;
+    jclass cls = env->GetObjectClass(thiz);
+    return env->GetFieldID(cls, "nativeApmInstance", "J");
+}
+
+static ApmInstance* GetInstance(JNIEnv* env, jobject thiz) {
+    return reinterpret_cast<ApmInstance*>(env->GetLongField(thiz, GetInstanceField(env, thiz)));
+}
 
 extern "C" {
 
+JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM* vm, void* reserved) {
+    JNIEnv* env = nullptr;
+    if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR;
+    }
+
+    jclass cls = env->FindClass("com/webrtc/audioprocessing/Apm");
+    if (cls) {
+        g_instance_field = env->GetFieldID(cls, "nativeApmInstance", "J");
+        env->DeleteLocalRef(cls);
+    }
+    if (!g_instance_field) {
+        env->ExceptionClear();
+        LOGE("Apm.nativeApmInstance not found at load time, using per-call lookup");
+    }
+
+    return JNI_VERSION_1_6;
+}
+
 JNIEXPORT jlong JNICALL
 Java_com_webrtc_audioprocessing_Apm_nativeCreateApmInstance(
     JNIEnv* env,
@@ -94,24 +142,28 @@ Java_com_webrtc_audioprocessing_Apm_nativeCreateApmInstance(
     // Log the configuration
     LOGD("AEC3 Config: filter length = 40 blocks (800ms delay support)");
 
+    ApmInstance* instance = new ApmInstance();
+
     // Create APM instance with custom AEC3 factory
     if (nextGenerationAec) {
-        g_apm = AudioProcessingBuilder()
+        instance->apm = AudioProcessingBuilder()
+            .SetConfig(config)
             .SetEchoControlFactory(
                 std::make_unique<EchoCanceller3Factory>(aec3_config))
-            .Create(config);
+            .Create();
     } else {
         // Legacy AEC without custom config
-        g_apm = AudioProcessingBuilder().Create(config);
+        instance->apm = AudioProcessingBuilder().SetConfig(config).Create();
     }
 
-    if (!g_apm) {
+    if (!instance->apm) {
         LOGE("Failed to create APM instance");
+        delete instance;
         return 0;
     }
 
     LOGD("APM instance created successfully (AEC3 with 40-block filter for 800ms support)");
-    return reinterpret_cast<jlong>(g_apm.get());
+    return reinterpret_cast<jlong>(instance);
 }
 
 JNIEXPORT jint JNICALL
@@ -120,7 +172,8 @@ Java_com_webrtc_audioprocessing_Apm_ProcessStream(
     jobject thiz,
     jshortArray nearEnd) {
 
-    if (!g_apm) {
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (!instance) {
         LOGE("APM not initialized");
         return -1;
     }
@@ -133,8 +186,12 @@ Java_com_webrtc_audioprocessing_Apm_ProcessStream(
     const size_t kNumChannels = 1;
     const size_t kNumSamples = nearEndLength;
 
+    std::vector<float>& float_buffer = instance->capture_buffer;
+    if (float_buffer.size() < kNumSamples) {
+        float_buffer.resize(kNumSamples);
+    }
+
     // Convert short to float
-    std::vector<float> float_buffer(kNumSamples);
     for (size_t i = 0; i < kNumSamples; i++) {
         float_buffer[i] = nearEndData[i] / 32768.0f;
     }
@@ -144,7 +201,7 @@ Java_com_webrtc_audioprocessing_Apm_ProcessStream(
 
     // Process the stream
     float* channel_ptrs[] = {float_buffer.data()};
-    int result = g_apm->ProcessStream(
+    int result = instance->apm->ProcessStream(
         channel_ptrs,
         stream_config,
         stream_config,
@@ -172,7 +229,8 @@ Java_com_webrtc_audioprocessing_Apm_ProcessReverseStream(
     jobject thiz,
     jshortArray farEnd) {
 
-    if (!g_apm) {
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (!instance) {
         LOGE("APM not initialized");
         return -1;
     }
@@ -184,8 +242,12 @@ Java_com_webrtc_audioprocessing_Apm_ProcessReverseStream(
     const size_t kNumChannels = 1;
     const size_t kNumSamples = farEndLength;
 
+    std::vector<float>& float_buffer = instance->render_buffer;
+    if (float_buffer.size() < kNumSamples) {
+        float_buffer.resize(kNumSamples);
+    }
+
     // Convert short to float
-    std::vector<float> float_buffer(kNumSamples);
     for (size_t i = 0; i < kNumSamples; i++) {
         float_buffer[i] = farEndData[i] / 32768.0f;
     }
@@ -195,7 +257,7 @@ Java_com_webrtc_audioprocessing_Apm_ProcessReverseStream(
 
     // Process reverse stream (speaker reference)
     float* channel_ptrs[] = {float_buffer.data()};
-    int result = g_apm->ProcessReverseStream(
+    int result = instance->apm->ProcessReverseStream(
         channel_ptrs,
         stream_config,
         stream_config,
@@ -215,7 +277,8 @@ Java_com_webrtc_audioprocessing_Apm_SetStreamDelay(
     jobject thiz,
     jint delay_ms) {
 
-    if (!g_apm) {
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (!instance) {
         LOGE("APM not initialized");
         return -1;
     }
@@ -226,7 +289,7 @@ Java_com_webrtc_audioprocessing_Apm_SetStreamDelay(
 
     // Note: With delay-agnostic mode, this is optional but can improve
     // convergence time for delays up to 800ms
-    g_apm->set_stream_delay_ms(delay_ms);
+    instance->apm->set_stream_delay_ms(delay_ms);
 
     return 0;
 }
@@ -236,8 +299,12 @@ Java_com_webrtc_audioprocessing_Apm_nativeDestroyApmInstance(
     JNIEnv* env,
     jobject thiz) {
 
-    LOGD("Destroying APM instance");
-    g_apm = nullptr;
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (instance) {
+        LOGD("Destroying APM instance");
+        delete instance;
+        env->SetLongField(thiz, GetInstanceField(env, thiz), 0);
+    }
 }
 
 // Legacy AEC methods (for compatibility)
@@ -247,11 +314,12 @@ Java_com_webrtc_audioprocessing_Apm_aec_1enable(
     jobject thiz,
     jboolean enable) {
 
-    if (!g_apm) return -1;
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (!instance) return -1;
 
-    AudioProcessing::Config config = g_apm->GetConfig();
+    AudioProcessing::Config config = instance->apm->GetConfig();
     config.echo_canceller.enabled = enable;
-    g_apm->ApplyConfig(config);
+    instance->apm->ApplyConfig(config);
 
     LOGD("AEC %s", enable ? "enabled" : "disabled");
     return 0;
@@ -275,12 +343,13 @@ Java_com_webrtc_audioprocessing_Apm_aecm_1enable(
     jobject thiz,
     jboolean enable) {
 
-    if (!g_apm) return -1;
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (!instance) return -1;
 
-    AudioProcessing::Config config = g_apm->GetConfig();
+    AudioProcessing::Config config = instance->apm->GetConfig();
     config.echo_canceller.enabled = enable;
     config.echo_canceller.mobile_mode = true;  // Mobile mode (AECM)
-    g_apm->ApplyConfig(config);
+    instance->apm->ApplyConfig(config);
 
     LOGD("AECM %s", enable ? "enabled" : "disabled");
     return 0;
@@ -292,11 +361,12 @@ Java_com_webrtc_audioprocessing_Apm_ns_1enable(
     jobject thiz,
     jboolean enable) {
 
-    if (!g_apm) return -1;
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (!instance) return -1;
 
-    AudioProcessing::Config config = g_apm->GetConfig();
+    AudioProcessing::Config config = instance->apm->GetConfig();
     config.noise_suppression.enabled = enable;
-    g_apm->ApplyConfig(config);
+    instance->apm->ApplyConfig(config);
 
     LOGD("NS %s", enable ? "enabled" : "disabled");
     return 0;
@@ -308,9 +378,10 @@ Java_com_webrtc_audioprocessing_Apm_ns_1set_1level(
     jobject thiz,
     jint level) {
 
-    if (!g_apm) return -1;
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (!instance) return -1;
 
-    AudioProcessing::Config config = g_apm->GetConfig();
+    AudioProcessing::Config config = instance->apm->GetConfig();
 
     switch (level) {
         case 0:
@@ -329,7 +400,7 @@ Java_com_webrtc_audioprocessing_Apm_ns_1set_1level(
             config.noise_suppression.level = AudioProcessing::Config::NoiseSuppression::kHigh;
     }
 
-    g_apm->ApplyConfig(config);
+    instance->apm->ApplyConfig(config);
     LOGD("NS level set to: %d", level);
     return 0;
 }
@@ -340,11 +411,12 @@ Java_com_webrtc_audioprocessing_Apm_agc_1enable(
     jobject thiz,
     jboolean enable) {
 
-    if (!g_apm) return -1;
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (!instance) return -1;
 
-    AudioProcessing::Config config = g_apm->GetConfig();
+    AudioProcessing::Config config = instance->apm->GetConfig();
     config.gain_controller1.enabled = enable;
-    g_apm->ApplyConfig(config);
+    instance->apm->ApplyConfig(config);
 
     LOGD("AGC %s", enable ? "enabled" : "disabled");
     return 0;
@@ -358,9 +430,10 @@ Java_com_webrtc_audioprocessing_Apm_agc_1set_1config(
     jint targetLevelDbfs,
     jint compressionGainDb) {
 
-    if (!g_apm) return -1;
+    ApmInstance* instance = GetInstance(env, thiz);
+    if (!instance) return -1;
 
-    AudioProcessing::Config config = g_apm->GetConfig();
+    AudioProcessing::Config config = instance->apm->GetConfig();
 
     switch (mode) {
         case 0:
@@ -376,7 +449,7 @@ Java_com_webrtc_audioprocessing_Apm_agc_1set_1config(
             config.gain_controller1.mode = AudioProcessing::Config::GainController1::kAdaptiveDigital;
     }
 
-    g_apm->ApplyConfig(config);
+    instance->apm->ApplyConfig(config);
     LOGD("AGC config: mode=%d, target=%d, compression=%d", mode, targetLevelDbfs, compressionGainDb);
     return 0;
 }
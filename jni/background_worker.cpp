@@ -0,0 +1,78 @@
+// Background worker for the APM JNI wrapper
+// See background_worker.h for the model.
+
+#include "background_worker.h"
+
+#include <pthread.h>
+
+#include <cerrno>
+#include <thread>
+
+namespace apm_jni {
+
+BackgroundWorker& BackgroundWorker::Get() {
+    // Never destroyed: tasks may still be posted while statics are torn down
+    static BackgroundWorker* worker = new BackgroundWorker();
+    return *worker;
+}
+
+BackgroundWorker::BackgroundWorker() {
+    sem_init(&posted_, 0, 0);
+    std::thread(&BackgroundWorker::Run, this).detach();
+}
+
+void BackgroundWorker::Post(BackgroundTask* task) {
+    if (task->queued_.exchange(true, std::memory_order_acq_rel)) return;
+
+    BackgroundTask* head = head_.load(std::memory_order_relaxed);
+    do {
+        task->next_ = head;
+    } while (!head_.compare_exchange_weak(head, task, std::memory_order_release,
+                                          std::memory_order_relaxed));
+    sem_post(&posted_);
+}
+
+void BackgroundWorker::Wait(BackgroundTask* task) {
+    std::unique_lock<std::mutex> lock(done_mutex_);
+    done_.wait(lock, [task] {
+        return !task->running_ && !task->queued_.load(std::memory_order_acquire);
+    });
+}
+
+void BackgroundWorker::Run() {
+    pthread_setname_np(pthread_self(), "apm-background");
+
+    while (true) {
+        while (sem_wait(&posted_) != 0 && errno == EINTR) {
+        }
+
+        // Take everything posted so far and run it oldest first
+        BackgroundTask* newest = head_.exchange(nullptr, std::memory_order_acquire);
+        BackgroundTask* oldest = nullptr;
+        while (newest) {
+            BackgroundTask* next = newest->next_;
+            newest->next_ = oldest;
+            oldest = newest;
+            newest = next;
+        }
+
+        while (oldest) {
+            BackgroundTask* task = oldest;
+            oldest = task->next_;
+            {
+                std::lock_guard<std::mutex> lock(done_mutex_);
+                task->running_ = true;
+            }
+            // Posts from here on queue the task again
+            task->queued_.store(false, std::memory_order_release);
+            task->Run();
+            {
+                std::lock_guard<std::mutex> lock(done_mutex_);
+                task->running_ = false;
+            }
+            done_.notify_all();
+        }
+    }
+}
+
+}  // namespace apm_jni
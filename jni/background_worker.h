@@ -0,0 +1,70 @@
+// Background worker for the APM JNI wrapper
+//
+// Some work the capture thread asks for is far too slow for a 10 ms audio
+// callback: building an EchoCanceller3 (hundreds of allocations, an arena
+// block, FFT setup), destroying a retired one, or applying a configuration
+// under a lock other threads hold. The capture thread posts such work as a
+// BackgroundTask instead and picks up the result on a later frame. One
+// process-wide thread at normal priority runs the tasks in posting order.
+//
+// Posting is lock-free and allocation-free: a task is an object owned by its
+// poster and linked into an intrusive list, and posting one that is already
+// queued does nothing, so a task that is posted repeatedly runs at least once
+// after the last post.
+
+#ifndef APM_JNI_BACKGROUND_WORKER_H_
+#define APM_JNI_BACKGROUND_WORKER_H_
+
+#include <semaphore.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace apm_jni {
+
+class BackgroundTask {
+public:
+    virtual ~BackgroundTask() = default;
+
+    // Runs on the worker thread
+    virtual void Run() = 0;
+
+private:
+    friend class BackgroundWorker;
+
+    BackgroundTask* next_ = nullptr;
+    std::atomic<bool> queued_{false};
+    bool running_ = false;  // guarded by the worker's done mutex
+};
+
+class BackgroundWorker {
+public:
+    // The process-wide worker, started on first use
+    static BackgroundWorker& Get();
+
+    // Queues task unless it is already queued. Never blocks or allocates,
+    // so it is safe on the audio threads. The task must stay alive until it
+    // has run or Wait() returned.
+    void Post(BackgroundTask* task);
+
+    // Blocks until task is neither queued nor running. For teardown, off
+    // the audio threads; nothing may post the task concurrently.
+    void Wait(BackgroundTask* task);
+
+private:
+    BackgroundWorker();
+
+    void Run();
+
+    // Treiber stack of posted tasks, newest first
+    std::atomic<BackgroundTask*> head_{nullptr};
+    sem_t posted_;
+
+    std::mutex done_mutex_;
+    std::condition_variable done_;
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_BACKGROUND_WORKER_H_
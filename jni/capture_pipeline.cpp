@@ -0,0 +1,202 @@
+// Two-stage capture pipeline for the APM JNI wrapper
+// See capture_pipeline.h for the model.
+
+#include "capture_pipeline.h"
+
+#include <android/log.h>
+#include <sys/resource.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include "modules/audio_processing/audio_buffer.h"
+
+#define LOG_TAG "WebRTC-APM"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+namespace apm_jni {
+
+namespace {
+
+// ANDROID_PRIORITY_URGENT_AUDIO, as used for the platform's audio threads
+constexpr int kWorkerPriority = -19;
+
+int64_t NowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Wait(sem_t* semaphore) {
+    while (sem_wait(semaphore) != 0 && errno == EINTR) {
+    }
+}
+
+}  // namespace
+
+void CapturePipeline::TimingStats::Add(int64_t us) {
+    total_us_.fetch_add(us, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    if (us > max_us_.load(std::memory_order_relaxed)) max_us_.store(us, std::memory_order_relaxed);
+}
+
+CapturePipeline::StageTiming CapturePipeline::TimingStats::Read() {
+    StageTiming timing;
+    const int64_t count = count_.exchange(0, std::memory_order_relaxed);
+    const int64_t total_us = total_us_.exchange(0, std::memory_order_relaxed);
+    timing.mean_us = count > 0 ? static_cast<int>(total_us / count) : 0;
+    timing.max_us = static_cast<int>(max_us_.exchange(0, std::memory_order_relaxed));
+    return timing;
+}
+
+CapturePipeline::CapturePipeline(Stage first, Stage second, size_t max_frame_samples)
+    : first_(std::move(first)), second_(std::move(second)), max_frame_samples_(max_frame_samples) {
+    for (Slot& slot : slots_) {
+        slot.samples.resize(max_frame_samples);
+        slot.echo_output.resize(max_frame_samples);
+    }
+    sem_init(&work_, 0, 0);
+    sem_init(&done_, 0, 0);
+    worker_ = std::thread(&CapturePipeline::Run, this);
+}
+
+CapturePipeline::~CapturePipeline() {
+    stop_.store(true, std::memory_order_release);
+    sem_post(&work_);
+    worker_.join();
+    sem_destroy(&work_);
+    sem_destroy(&done_);
+}
+
+int CapturePipeline::Process(float* const* channels, size_t num_frames, size_t num_channels) {
+    // Copy the frame into its slot before the first stage changes it. The
+    // slot was last used two frames ago, and that frame was collected by the
+    // previous call.
+    const uint64_t frame = submitted_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[frame % kNumSlots];
+    const bool fits = num_channels <= kMaxChannels && num_frames * num_channels <= max_frame_samples_;
+    slot.num_frames = fits ? num_frames : 0;
+    slot.num_channels = fits ? num_channels : 0;
+    for (size_t ch = 0; ch < num_channels && fits; ch++) {
+        slot.channels[ch] = slot.samples.data() + ch * num_frames;
+        memcpy(slot.channels[ch], channels[ch], num_frames * sizeof(float));
+    }
+    slot.has_echo_output = false;
+
+    first_slot_ = &slot;
+    const int64_t start_us = NowUs();
+    const int first_status = first_(channels, num_frames, num_channels);
+    first_timing_.Add(NowUs() - start_us);
+    first_slot_ = nullptr;
+
+    submitted_.store(frame + 1, std::memory_order_release);
+    sem_post(&work_);
+
+    // Collect the previous frame, which the worker has usually finished
+    // while the first stage ran
+    const Slot* previous = nullptr;
+    if (frame > 0) {
+        while (completed_.load(std::memory_order_acquire) < frame) Wait(&done_);
+        previous = &slots_[(frame - 1) % kNumSlots];
+    }
+
+    int second_status = 0;
+    if (previous && previous->num_frames == num_frames && previous->num_channels == num_channels) {
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            memcpy(channels[ch], previous->channels[ch], num_frames * sizeof(float));
+        }
+        second_status = previous->status;
+    } else {
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            memset(channels[ch], 0, num_frames * sizeof(float));
+        }
+    }
+    return first_status != 0 ? first_status : second_status;
+}
+
+void CapturePipeline::StoreEchoOutput(const webrtc::AudioBuffer& capture) {
+    Slot* slot = first_slot_;
+    const size_t num_channels = capture.num_channels();
+    const size_t num_bands = capture.num_bands();
+    const size_t band_frames = capture.num_frames_per_band();
+    if (!slot || num_channels * num_bands * band_frames > slot->echo_output.size()) return;
+
+    float* out = slot->echo_output.data();
+    for (size_t ch = 0; ch < num_channels; ch++) {
+        for (size_t band = 0; band < num_bands; band++) {
+            memcpy(out, capture.split_bands_const(ch)[band], band_frames * sizeof(float));
+            out += band_frames;
+        }
+    }
+    slot->echo_channels = num_channels;
+    slot->echo_bands = num_bands;
+    slot->echo_band_frames = band_frames;
+    slot->has_echo_output = true;
+}
+
+bool CapturePipeline::LoadEchoOutput(webrtc::AudioBuffer* capture) const {
+    const Slot* slot = second_slot_;
+    if (!slot || !slot->has_echo_output) return false;
+    const size_t num_channels = capture->num_channels();
+    const size_t num_bands = capture->num_bands();
+    const size_t band_frames = capture->num_frames_per_band();
+    if (slot->echo_channels != num_channels || slot->echo_bands != num_bands ||
+        slot->echo_band_frames != band_frames) {
+        return false;
+    }
+
+    const float* in = slot->echo_output.data();
+    for (size_t ch = 0; ch < num_channels; ch++) {
+        for (size_t band = 0; band < num_bands; band++) {
+            memcpy(capture->split_bands(ch)[band], in, band_frames * sizeof(float));
+            in += band_frames;
+        }
+    }
+    return true;
+}
+
+void CapturePipeline::ReadTimings(StageTiming* first, StageTiming* second) {
+    *first = first_timing_.Read();
+    *second = second_timing_.Read();
+}
+
+void CapturePipeline::Run() {
+    if (setpriority(PRIO_PROCESS, 0, kWorkerPriority) != 0) {
+        LOGD("Capture pipeline worker keeps default priority: %s", strerror(errno));
+    }
+
+    uint64_t next = 0;
+    while (true) {
+        Wait(&work_);
+        if (stop_.load(std::memory_order_acquire)) break;
+
+        while (next < submitted_.load(std::memory_order_acquire)) {
+            Slot& slot = slots_[next % kNumSlots];
+            if (slot.num_frames > 0) {
+                second_slot_ = &slot;
+                const int64_t start_us = NowUs();
+                slot.status = second_(slot.channels, slot.num_frames, slot.num_channels);
+                second_timing_.Add(NowUs() - start_us);
+                second_slot_ = nullptr;
+            }
+            completed_.store(++next, std::memory_order_release);
+            sem_post(&done_);
+        }
+    }
+}
+
+// ============================================================================
+// EchoOutputRelay
+// ============================================================================
+
+void EchoOutputRelay::ProcessCapture(webrtc::AudioBuffer* capture, bool level_change) {
+    relayed_ = pipeline_->LoadEchoOutput(capture);
+}
+
+void EchoOutputRelay::ProcessCapture(webrtc::AudioBuffer* capture,
+                                     webrtc::AudioBuffer* linear_output,
+                                     bool level_change) {
+    relayed_ = pipeline_->LoadEchoOutput(capture);
+}
+
+}  // namespace apm_jni
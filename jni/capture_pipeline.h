@@ -0,0 +1,175 @@
+// Two-stage capture pipeline for the APM JNI wrapper
+//
+// On low-end devices a single ProcessStream with a long AEC3 filter, NS and
+// AGC can exceed the 10 ms frame budget of one core. The pipeline splits
+// the capture path into two stages. The first runs on the calling thread
+// and the second on a worker thread, so both cores work on consecutive
+// frames at the same time. The price is exactly one frame (10 ms) of added
+// capture latency.
+//
+// Frames are handed between the threads through a fixed two-slot ring with
+// atomic positions; semaphores only wake a thread that has run out of work.
+//
+// The split is at the APM boundary, not inside AEC3: the wrapper can only
+// run whole APM instances, so the first stage runs all of AEC3 (linear
+// filter and suppressor) and the second runs NS and AGC in a second APM.
+// To keep the output that of one APM, the second stage gets the raw frame
+// and repeats everything before the echo canceller (pre-gain, high-pass),
+// so AGC1 and NS analyze the same pre-AEC3 signal they would in one APM.
+// In place of AEC3 it runs an EchoOutputRelay, which swaps in the split-band
+// output the first stage's AEC3 produced for the frame; NS, AGC and the
+// transient suppressor then process that.
+
+#ifndef APM_JNI_CAPTURE_PIPELINE_H_
+#define APM_JNI_CAPTURE_PIPELINE_H_
+
+#include <semaphore.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "api/audio/echo_control.h"
+
+namespace webrtc {
+class AudioBuffer;
+}
+
+namespace apm_jni {
+
+class CapturePipeline {
+public:
+    // Processes one frame of float channel planes in place and returns an
+    // AudioProcessing status
+    using Stage = std::function<int(float* const* channels, size_t num_frames, size_t num_channels)>;
+
+    struct StageTiming {
+        int mean_us = 0;
+        int max_us = 0;
+    };
+
+    // The second stage is only ever called from the worker thread, on the
+    // frame as it was before the first stage
+    CapturePipeline(Stage first, Stage second, size_t max_frame_samples);
+    ~CapturePipeline();
+
+    CapturePipeline(const CapturePipeline&) = delete;
+    CapturePipeline& operator=(const CapturePipeline&) = delete;
+
+    // Hands the unprocessed frame to the worker, runs the first stage on it
+    // and replaces it with the previous frame's second-stage output (silence
+    // on the first call, after a format change, or for more than
+    // kMaxChannels channels). Returns the first stage's error if any, else
+    // the second stage's status for the frame returned.
+    int Process(float* const* channels, size_t num_frames, size_t num_channels);
+
+    // Per-stage processing time since the previous call
+    void ReadTimings(StageTiming* first, StageTiming* second);
+
+    // Split-band AEC3 output of the frame, from the first stage to the
+    // second. StoreEchoOutput is only called from inside the first stage,
+    // LoadEchoOutput from inside the second; each uses the slot of the frame
+    // its stage is on. Load returns false, leaving the buffer alone, if the
+    // first stage stored nothing for the frame or in another format.
+    void StoreEchoOutput(const webrtc::AudioBuffer& capture);
+    bool LoadEchoOutput(webrtc::AudioBuffer* capture) const;
+
+    static constexpr size_t kMaxChannels = 2;
+
+private:
+    static constexpr size_t kNumSlots = 2;
+
+    struct Slot {
+        std::vector<float> samples;
+        float* channels[kMaxChannels] = {};
+        size_t num_frames = 0;
+        size_t num_channels = 0;
+        int status = 0;
+
+        // AEC3 output, channel-major then band-major
+        std::vector<float> echo_output;
+        bool has_echo_output = false;
+        size_t echo_channels = 0;
+        size_t echo_bands = 0;
+        size_t echo_band_frames = 0;
+    };
+
+    class TimingStats {
+    public:
+        void Add(int64_t us);
+        StageTiming Read();
+
+    private:
+        std::atomic<int64_t> total_us_{0};
+        std::atomic<int64_t> count_{0};
+        std::atomic<int64_t> max_us_{0};
+    };
+
+    void Run();
+
+    const Stage first_;
+    const Stage second_;
+    const size_t max_frame_samples_;
+    Slot slots_[kNumSlots];
+
+    // Frames handed over (caller writes) and finished (worker writes)
+    alignas(64) std::atomic<uint64_t> submitted_{0};
+    alignas(64) std::atomic<uint64_t> completed_{0};
+    std::atomic<bool> stop_{false};
+    sem_t work_;
+    sem_t done_;
+
+    TimingStats first_timing_;
+    TimingStats second_timing_;
+
+    // Slot each stage is on, touched only by that stage's thread
+    Slot* first_slot_ = nullptr;
+    const Slot* second_slot_ = nullptr;
+
+    std::thread worker_;
+};
+
+// Echo control of the second stage's APM. It stands in for AEC3: it does
+// no echo processing of its own and only replaces the capture signal with
+// the first stage's AEC3 output for the frame.
+class EchoOutputRelay : public webrtc::EchoControl {
+public:
+    explicit EchoOutputRelay(const CapturePipeline* pipeline) : pipeline_(pipeline) {}
+
+    void AnalyzeRender(webrtc::AudioBuffer* render) override {}
+    void AnalyzeCapture(webrtc::AudioBuffer* capture) override {}
+    void ProcessCapture(webrtc::AudioBuffer* capture, bool level_change) override;
+    void ProcessCapture(webrtc::AudioBuffer* capture,
+                        webrtc::AudioBuffer* linear_output,
+                        bool level_change) override;
+    Metrics GetMetrics() const override { return Metrics(); }
+    void SetAudioBufferDelay(int delay_ms) override {}
+    void SetCaptureOutputUsage(bool capture_output_used) override {}
+    bool ActiveProcessing() const override { return relayed_; }
+
+private:
+    const CapturePipeline* const pipeline_;
+    bool relayed_ = false;
+};
+
+class EchoOutputRelayFactory : public webrtc::EchoControlFactory {
+public:
+    explicit EchoOutputRelayFactory(const CapturePipeline* pipeline) : pipeline_(pipeline) {}
+
+    std::unique_ptr<webrtc::EchoControl> Create(int sample_rate_hz,
+                                                int num_render_channels,
+                                                int num_capture_channels) override {
+        return std::make_unique<EchoOutputRelay>(pipeline_);
+    }
+
+private:
+    const CapturePipeline* const pipeline_;
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_CAPTURE_PIPELINE_H_
@@ -0,0 +1,96 @@
+// Real-time deadline governor for the APM JNI wrapper
+// See deadline_governor.h for the model.
+
+#include "deadline_governor.h"
+
+namespace apm_jni {
+
+namespace {
+
+// Overruns are counted over 1 s windows
+constexpr int kWindowFrames = 100;
+
+// Step down on 5% overruns in a window, or at once on a burst
+constexpr int kStepDownOverruns = 5;
+constexpr int kStepDownBurst = 3;
+
+// Step up only after 5 s of windows without overruns and with the mean
+// frame under half the budget, so a tier that barely fits is kept
+constexpr int kStepUpCalmWindows = 5;
+constexpr int kStepUpMeanPercent = 50;
+
+// A tier change needs time to take effect (it is applied on the background
+// worker and AEC3 switches to a rebuilt instance), so no further change is
+// made for 3 s
+constexpr int kCooldownFrames = 300;
+
+}  // namespace
+
+DeadlineGovernor::DeadlineGovernor(int64_t budget_us)
+    : requested_budget_us_(budget_us), budget_us_(budget_us) {}
+
+int DeadlineGovernor::OnFrame(int64_t duration_us) {
+    if (reset_requested_.exchange(false, std::memory_order_acquire)) {
+        budget_us_ = requested_budget_us_.load(std::memory_order_relaxed);
+        tier_.store(0, std::memory_order_relaxed);
+        frames_.store(0, std::memory_order_relaxed);
+        overruns_.store(0, std::memory_order_relaxed);
+        worst_us_.store(0, std::memory_order_relaxed);
+        window_frames_ = 0;
+        window_overruns_ = 0;
+        window_total_us_ = 0;
+        consecutive_overruns_ = 0;
+        calm_windows_ = 0;
+        cooldown_frames_ = 0;
+    }
+
+    frames_.fetch_add(1, std::memory_order_relaxed);
+    if (duration_us > worst_us_.load(std::memory_order_relaxed)) {
+        worst_us_.store(duration_us, std::memory_order_relaxed);
+    }
+
+    const bool overrun = duration_us > budget_us_;
+    if (overrun) {
+        overruns_.fetch_add(1, std::memory_order_relaxed);
+        window_overruns_++;
+        consecutive_overruns_++;
+    } else {
+        consecutive_overruns_ = 0;
+    }
+    window_total_us_ += duration_us;
+    window_frames_++;
+
+    if (cooldown_frames_ > 0) cooldown_frames_--;
+
+    const int tier = tier_.load(std::memory_order_relaxed);
+    int next = -1;
+    if (cooldown_frames_ == 0 && tier < kNumTiers - 1 &&
+        (consecutive_overruns_ >= kStepDownBurst || window_overruns_ >= kStepDownOverruns)) {
+        next = tier + 1;
+    }
+
+    if (window_frames_ == kWindowFrames) {
+        const bool calm = window_overruns_ == 0 &&
+                          window_total_us_ * 100 < budget_us_ * kStepUpMeanPercent * kWindowFrames;
+        calm_windows_ = calm ? calm_windows_ + 1 : 0;
+        if (next < 0 && cooldown_frames_ == 0 && tier > 0 && calm_windows_ >= kStepUpCalmWindows) {
+            next = tier - 1;
+        }
+        window_frames_ = 0;
+        window_overruns_ = 0;
+        window_total_us_ = 0;
+    }
+
+    if (next < 0) return -1;
+
+    tier_.store(next, std::memory_order_relaxed);
+    window_frames_ = 0;
+    window_overruns_ = 0;
+    window_total_us_ = 0;
+    consecutive_overruns_ = 0;
+    calm_windows_ = 0;
+    cooldown_frames_ = kCooldownFrames;
+    return next;
+}
+
+}  // namespace apm_jni
@@ -0,0 +1,65 @@
+// Real-time deadline governor for the APM JNI wrapper
+//
+// When the device is thermally throttled, capture processing overruns the
+// 10 ms frame and the audio glitches. The governor measures every capture
+// frame against a budget. When overruns accumulate it steps down through
+// cheaper processing tiers, and it steps back up with hysteresis once there
+// is headroom again. It only decides on a tier. The wrapper maps tiers to
+// configurations (see ApplyGovernorTier in webrtc_apm_jni.cpp).
+
+#ifndef APM_JNI_DEADLINE_GOVERNOR_H_
+#define APM_JNI_DEADLINE_GOVERNOR_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace apm_jni {
+
+class DeadlineGovernor {
+public:
+    // 0 is full quality, kNumTiers - 1 the cheapest
+    static constexpr int kNumTiers = 4;
+
+    explicit DeadlineGovernor(int64_t budget_us);
+
+    // Capture thread, once per frame. Returns the tier to switch to, or -1
+    // to stay.
+    int OnFrame(int64_t duration_us);
+
+    // Back to tier 0 with cleared counters and the given budget; applied on
+    // the next frame, so it is safe while the capture thread is in OnFrame
+    void Reset(int64_t budget_us) {
+        requested_budget_us_.store(budget_us, std::memory_order_relaxed);
+        reset_requested_.store(true, std::memory_order_release);
+    }
+
+    // Counters, readable from any thread
+    int tier() const { return tier_.load(std::memory_order_relaxed); }
+    uint64_t frames() const { return frames_.load(std::memory_order_relaxed); }
+    uint64_t overruns() const { return overruns_.load(std::memory_order_relaxed); }
+    int64_t worst_us() const { return worst_us_.load(std::memory_order_relaxed); }
+    // Budget as last requested; the capture thread switches on its next frame
+    int64_t budget_us() const { return requested_budget_us_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> requested_budget_us_;
+
+    // Capture thread state
+    int64_t budget_us_;
+    int window_frames_ = 0;
+    int window_overruns_ = 0;
+    int64_t window_total_us_ = 0;
+    int consecutive_overruns_ = 0;
+    int calm_windows_ = 0;
+    int cooldown_frames_ = 0;
+
+    std::atomic<int> tier_{0};
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> overruns_{0};
+    std::atomic<int64_t> worst_us_{0};
+    std::atomic<bool> reset_requested_{false};
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_DEADLINE_GOVERNOR_H_
@@ -0,0 +1,338 @@
+// Coarse-to-fine echo delay estimator for the APM JNI wrapper
+// See delay_estimator.h for the approach.
+
+#include "delay_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace apm_jni {
+
+namespace {
+
+// Every supported stream rate (8/16/32/48 kHz) decimates to 40 fine samples
+// (4 kHz) and 5 coarse envelope samples (500 Hz) per 10 ms frame
+constexpr int kFineRateHz = 4000;
+constexpr size_t kFineSamplesPerFrame = 40;
+constexpr size_t kCoarseDecimation = 8;
+constexpr int kFineSamplesPerMs = kFineRateHz / 1000;
+
+// Correlation window (capture side) and search cadence
+constexpr int kWindowMs = 500;
+constexpr int kFineWindow = kWindowMs * kFineSamplesPerMs;
+constexpr int kCoarseWindow = kFineWindow / kCoarseDecimation;
+constexpr int kSearchIntervalFrames = 25;  // 250 ms
+
+// Lags correlated per capture frame, about 32k multiply-adds each way. A
+// full 2 s search takes 1 snapshot frame, up to 8 coarse and 13 fine frames,
+// and so finishes within one interval.
+constexpr int kCoarseLagsPerFrame = 128;
+constexpr int kFineLagsPerFrame = 8;
+
+// Fine refinement covers +-2 coarse steps around each coarse candidate
+constexpr int kRefineRadius = 2 * kCoarseDecimation;
+constexpr size_t kNumCandidates = 3;
+constexpr int kCandidateSeparation = 3;
+
+// How far the render thread may run ahead of capture (1 s)
+constexpr int kRenderLeadFine = kFineRateHz;
+
+// Acceptance: scores are normalized correlations, and two consecutive
+// searches must agree within 2 ms before the estimate is published
+constexpr float kMinCoarseScore = 0.2f;
+constexpr float kMinFineScore = 0.25f;
+constexpr int kAgreementFine = 2 * kFineSamplesPerMs;
+constexpr int kRequiredAgreement = 2;
+
+// Below about -80 dBFS the window carries no usable far-end or echo
+constexpr float kMinPower = 1e-8f;
+
+// Box-filter decimation of one frame to 4 kHz, then the magnitude envelope
+// of that to 500 Hz. Returns false for frame sizes that are not 10 ms at a
+// supported rate.
+bool Decimate(const float* frame, size_t num_samples, float* fine, float* coarse) {
+    if (num_samples == 0 || num_samples % kFineSamplesPerFrame != 0) return false;
+    const size_t factor = num_samples / kFineSamplesPerFrame;
+    const float scale = 1.0f / static_cast<float>(factor);
+    for (size_t i = 0; i < kFineSamplesPerFrame; i++) {
+        float sum = 0.0f;
+        for (size_t k = 0; k < factor; k++) sum += frame[i * factor + k];
+        fine[i] = sum * scale;
+    }
+    for (size_t i = 0; i < kFineSamplesPerFrame / kCoarseDecimation; i++) {
+        float sum = 0.0f;
+        for (size_t k = 0; k < kCoarseDecimation; k++) sum += std::fabs(fine[i * kCoarseDecimation + k]);
+        coarse[i] = sum / kCoarseDecimation;
+    }
+    return true;
+}
+
+}  // namespace
+
+CoarseToFineDelayEstimator::CoarseToFineDelayEstimator(int capacity_ms)
+    : capacity_ms_(capacity_ms), requested_max_delay_ms_(capacity_ms) {
+    const size_t fine_capacity =
+        kFineWindow + capacity_ms * kFineSamplesPerMs + kRefineRadius + kRenderLeadFine;
+    render_fine_.resize(fine_capacity);
+    render_coarse_.resize(fine_capacity / kCoarseDecimation);
+    capture_fine_.resize(kFineWindow);
+    capture_coarse_.resize(kCoarseWindow);
+    snapshot_fine_.resize(fine_capacity);
+    snapshot_coarse_.resize(fine_capacity / kCoarseDecimation);
+    window_fine_.resize(kFineWindow);
+    window_coarse_.resize(kCoarseWindow);
+    candidates_.reserve(kNumCandidates);
+    ResetState();
+}
+
+void CoarseToFineDelayEstimator::Reset(int max_delay_ms) {
+    requested_max_delay_ms_.store(std::min(max_delay_ms, capacity_ms_), std::memory_order_relaxed);
+    reset_requested_.store(true, std::memory_order_release);
+}
+
+void CoarseToFineDelayEstimator::AnalyzeRender(const float* frame, size_t num_samples) {
+    float fine[kFineSamplesPerFrame];
+    float coarse[kFineSamplesPerFrame / kCoarseDecimation];
+    if (!Decimate(frame, num_samples, fine, coarse)) return;
+
+    std::lock_guard<std::mutex> lock(render_mutex_);
+    const size_t fine_capacity = render_fine_.size();
+    const size_t coarse_capacity = render_coarse_.size();
+    for (size_t i = 0; i < kFineSamplesPerFrame; i++) {
+        render_fine_[(render_fine_count_ + i) % fine_capacity] = fine[i];
+    }
+    const int64_t coarse_count = render_fine_count_ / kCoarseDecimation;
+    for (size_t i = 0; i < kFineSamplesPerFrame / kCoarseDecimation; i++) {
+        render_coarse_[(coarse_count + i) % coarse_capacity] = coarse[i];
+    }
+    render_fine_count_ += kFineSamplesPerFrame;
+}
+
+void CoarseToFineDelayEstimator::AnalyzeCapture(const float* frame, size_t num_samples) {
+    if (reset_requested_.exchange(false, std::memory_order_acquire)) ResetState();
+
+    float fine[kFineSamplesPerFrame];
+    float coarse[kFineSamplesPerFrame / kCoarseDecimation];
+    if (!Decimate(frame, num_samples, fine, coarse)) return;
+
+    for (size_t i = 0; i < kFineSamplesPerFrame; i++) {
+        capture_fine_[(capture_fine_count_ + i) % kFineWindow] = fine[i];
+    }
+    const int64_t coarse_count = capture_fine_count_ / kCoarseDecimation;
+    for (size_t i = 0; i < kFineSamplesPerFrame / kCoarseDecimation; i++) {
+        capture_coarse_[(coarse_count + i) % kCoarseWindow] = coarse[i];
+    }
+    capture_fine_count_ += kFineSamplesPerFrame;
+
+    if (search_phase_ != SearchPhase::kIdle) ContinueSearch();
+
+    if (--frames_until_search_ > 0) return;
+    frames_until_search_ = kSearchIntervalFrames;
+    if (search_phase_ == SearchPhase::kIdle && capture_fine_count_ >= kFineWindow) StartSearch();
+}
+
+void CoarseToFineDelayEstimator::ResetState() {
+    const int max_delay_ms = requested_max_delay_ms_.load(std::memory_order_relaxed);
+    max_fine_lag_ = max_delay_ms * kFineSamplesPerMs;
+    max_coarse_lag_ = max_fine_lag_ / static_cast<int>(kCoarseDecimation);
+    {
+        std::lock_guard<std::mutex> lock(render_mutex_);
+        std::fill(render_fine_.begin(), render_fine_.end(), 0.0f);
+        std::fill(render_coarse_.begin(), render_coarse_.end(), 0.0f);
+        render_fine_count_ = 0;
+    }
+    std::fill(capture_fine_.begin(), capture_fine_.end(), 0.0f);
+    std::fill(capture_coarse_.begin(), capture_coarse_.end(), 0.0f);
+    capture_fine_count_ = 0;
+    frames_until_search_ = kSearchIntervalFrames;
+    search_phase_ = SearchPhase::kIdle;
+    last_lag_ = -1;
+    agreeing_searches_ = 0;
+    delay_ms_.store(-1, std::memory_order_relaxed);
+}
+
+// Takes the render snapshot and the capture windows the search runs on
+void CoarseToFineDelayEstimator::StartSearch() {
+    const int64_t capture_end = capture_fine_count_;
+
+    // Copy the render span any candidate lag can touch, so the render thread
+    // is only held up for a memcpy-sized critical section
+    {
+        std::lock_guard<std::mutex> lock(render_mutex_);
+        const int64_t capacity = static_cast<int64_t>(render_fine_.size());
+        int64_t start = std::max<int64_t>({0, render_fine_count_ - capacity,
+                                           capture_end - kFineWindow - max_fine_lag_ - kRefineRadius});
+        start = (start + kCoarseDecimation - 1) / kCoarseDecimation * kCoarseDecimation;
+        const int64_t end = std::min(render_fine_count_, capture_end);
+        if (end - start < kFineWindow) return;
+
+        for (int64_t n = start; n < end; n++) {
+            snapshot_fine_[n - start] = render_fine_[n % capacity];
+        }
+        const int64_t coarse_capacity = static_cast<int64_t>(render_coarse_.size());
+        const int64_t coarse_start = start / static_cast<int64_t>(kCoarseDecimation);
+        const int64_t coarse_end = end / static_cast<int64_t>(kCoarseDecimation);
+        for (int64_t n = coarse_start; n < coarse_end; n++) {
+            snapshot_coarse_[n - coarse_start] = render_coarse_[n % coarse_capacity];
+        }
+        snapshot_fine_start_ = start;
+        snapshot_fine_end_ = end;
+    }
+
+    // Capture windows in time order
+    for (int n = 0; n < kFineWindow; n++) {
+        window_fine_[n] = capture_fine_[(capture_end - kFineWindow + n) % kFineWindow];
+    }
+    const int64_t coarse_end = capture_end / kCoarseDecimation;
+    for (int n = 0; n < kCoarseWindow; n++) {
+        window_coarse_[n] = capture_coarse_[(coarse_end - kCoarseWindow + n) % kCoarseWindow];
+    }
+
+    float sum_x = 0.0f;
+    float sum_xx = 0.0f;
+    for (float x : window_coarse_) {
+        sum_x += x;
+        sum_xx += x * x;
+    }
+    mean_x_ = sum_x / kCoarseWindow;
+    var_x_ = sum_xx - kCoarseWindow * mean_x_ * mean_x_;
+    if (sum_xx < kMinPower * kCoarseWindow || var_x_ <= 0.0f) return;
+
+    search_capture_end_ = capture_end;
+    candidates_.clear();
+    next_coarse_lag_ = 0;
+    search_phase_ = SearchPhase::kCoarse;
+}
+
+void CoarseToFineDelayEstimator::ContinueSearch() {
+    if (search_phase_ == SearchPhase::kCoarse) {
+        const int last = std::min(max_coarse_lag_, next_coarse_lag_ + kCoarseLagsPerFrame - 1);
+        SearchCoarse(next_coarse_lag_, last);
+        next_coarse_lag_ = last + 1;
+        if (next_coarse_lag_ > max_coarse_lag_) {
+            search_phase_ = StartRefine() ? SearchPhase::kFine : SearchPhase::kIdle;
+        }
+        return;
+    }
+
+    if (!RefineFine(kFineLagsPerFrame)) return;
+    search_phase_ = SearchPhase::kIdle;
+    if (best_lag_ >= 0 && best_score_ >= kMinFineScore) FinishSearch(best_lag_);
+}
+
+void CoarseToFineDelayEstimator::FinishSearch(int lag) {
+    if (last_lag_ >= 0 && std::abs(lag - last_lag_) <= kAgreementFine) {
+        agreeing_searches_++;
+    } else {
+        agreeing_searches_ = 1;
+    }
+    last_lag_ = lag;
+
+    if (agreeing_searches_ >= kRequiredAgreement) {
+        delay_ms_.store((lag + kFineSamplesPerMs / 2) / kFineSamplesPerMs, std::memory_order_relaxed);
+    }
+}
+
+// Normalized (mean-removed) envelope correlation over first_lag..last_lag.
+// Keeps the kNumCandidates best local peaks, kCandidateSeparation apart.
+void CoarseToFineDelayEstimator::SearchCoarse(int first_lag, int last_lag) {
+    const int64_t capture_end = search_capture_end_ / kCoarseDecimation;
+    const int64_t snapshot_start = snapshot_fine_start_ / kCoarseDecimation;
+    const int64_t snapshot_end = snapshot_fine_end_ / kCoarseDecimation;
+
+    for (int lag = first_lag; lag <= last_lag; lag++) {
+        const int64_t start = capture_end - kCoarseWindow - lag;
+        if (start < snapshot_start || start + kCoarseWindow > snapshot_end) continue;
+        const float* r = &snapshot_coarse_[start - snapshot_start];
+
+        float sum_r = 0.0f;
+        float sum_rr = 0.0f;
+        float sum_xr = 0.0f;
+        for (int n = 0; n < kCoarseWindow; n++) {
+            sum_r += r[n];
+            sum_rr += r[n] * r[n];
+            sum_xr += window_coarse_[n] * r[n];
+        }
+        const float mean_r = sum_r / kCoarseWindow;
+        const float var_r = sum_rr - kCoarseWindow * mean_r * mean_r;
+        if (sum_rr < kMinPower * kCoarseWindow || var_r <= 0.0f) continue;
+
+        const float score = (sum_xr - kCoarseWindow * mean_x_ * mean_r) / std::sqrt(var_x_ * var_r);
+        if (score < kMinCoarseScore) continue;
+
+        // Keep the best few, suppressing neighbours of a stronger peak
+        bool merged = false;
+        for (Candidate& candidate : candidates_) {
+            if (std::abs(candidate.lag - lag) < kCandidateSeparation) {
+                if (score > candidate.score) candidate = {lag, score};
+                merged = true;
+                break;
+            }
+        }
+        if (!merged) {
+            if (candidates_.size() < kNumCandidates) {
+                candidates_.push_back({lag, score});
+            } else {
+                auto weakest = std::min_element(candidates_.begin(), candidates_.end(),
+                    [](const Candidate& a, const Candidate& b) { return a.score < b.score; });
+                if (score > weakest->score) *weakest = {lag, score};
+            }
+        }
+    }
+}
+
+// Prepares the fine stage; false if there is nothing to refine
+bool CoarseToFineDelayEstimator::StartRefine() {
+    if (candidates_.empty()) return false;
+
+    energy_x_ = 0.0f;
+    for (float x : window_fine_) energy_x_ += x * x;
+    if (energy_x_ < kMinPower * kFineWindow) return false;
+
+    refine_candidate_ = 0;
+    next_fine_lag_ = std::max(0, candidates_[0].lag * static_cast<int>(kCoarseDecimation) - kRefineRadius);
+    best_score_ = 0.0f;
+    best_lag_ = -1;
+    return true;
+}
+
+// Normalized waveform correlation at 4 kHz around each coarse candidate,
+// at most max_lags lags per call. Polarity is ignored since speaker and
+// microphone wiring may invert it. True once every candidate is done.
+bool CoarseToFineDelayEstimator::RefineFine(int max_lags) {
+    const int64_t capture_end = search_capture_end_;
+    while (refine_candidate_ < candidates_.size()) {
+        const int center = candidates_[refine_candidate_].lag * static_cast<int>(kCoarseDecimation);
+        const int last = std::min(max_fine_lag_, center + kRefineRadius);
+        for (; next_fine_lag_ <= last; next_fine_lag_++) {
+            if (max_lags-- == 0) return false;
+
+            const int fine_lag = next_fine_lag_;
+            const int64_t start = capture_end - kFineWindow - fine_lag;
+            if (start < snapshot_fine_start_ || start + kFineWindow > snapshot_fine_end_) continue;
+            const float* r = &snapshot_fine_[start - snapshot_fine_start_];
+
+            float energy_r = 0.0f;
+            float cross = 0.0f;
+            for (int n = 0; n < kFineWindow; n++) {
+                energy_r += r[n] * r[n];
+                cross += window_fine_[n] * r[n];
+            }
+            if (energy_r < kMinPower * kFineWindow) continue;
+
+            const float value = std::fabs(cross) / std::sqrt(energy_x_ * energy_r);
+            if (value > best_score_) {
+                best_score_ = value;
+                best_lag_ = fine_lag;
+            }
+        }
+        if (++refine_candidate_ < candidates_.size()) {
+            const int next_center = candidates_[refine_candidate_].lag * static_cast<int>(kCoarseDecimation);
+            next_fine_lag_ = std::max(0, next_center - kRefineRadius);
+        }
+    }
+    return true;
+}
+
+}  // namespace apm_jni
@@ -0,0 +1,118 @@
+// Coarse-to-fine echo delay estimator for the APM JNI wrapper
+//
+// AEC3's matched filters search every lag at 4 kHz on every block, and the
+// cost grows with the lag range the 1 s Bluetooth paths need. This estimator
+// does it in two stages on a slower cadence. First it correlates a 500 Hz
+// magnitude envelope of render and capture over the full range, which is
+// robust to the room response. Then it refines the best few candidates with
+// a 4 kHz waveform correlation in a +-4 ms neighbourhood. A search is
+// spread over the capture frames of one interval, so no frame pays for more
+// than a small slice of it.
+//
+// The result feeds AEC3 as an external delay
+// (EchoCanceller3Config::delay.use_external_delay_estimator), which takes
+// the matched filters out of the per-block path entirely.
+
+#ifndef APM_JNI_DELAY_ESTIMATOR_H_
+#define APM_JNI_DELAY_ESTIMATOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace apm_jni {
+
+class CoarseToFineDelayEstimator {
+public:
+    // Buffers are sized for delays up to capacity_ms, which is also the
+    // initial search range
+    explicit CoarseToFineDelayEstimator(int capacity_ms);
+
+    // One 10 ms mono frame at the stream rate (8/16/32/48 kHz). Render and
+    // capture may be called from different threads; capture must see the
+    // microphone signal before any processing.
+    void AnalyzeRender(const float* frame, size_t num_samples);
+    void AnalyzeCapture(const float* frame, size_t num_samples);
+
+    // Last confirmed render-to-capture delay in ms, or -1 if none yet
+    int delay_ms() const { return delay_ms_.load(std::memory_order_relaxed); }
+
+    // Drops all history and the estimate and searches 0..max_delay_ms (at
+    // most the capacity) from then on. Applied on the next capture frame, so
+    // it is safe while the audio threads are inside the estimator.
+    void Reset(int max_delay_ms);
+
+    // Search range last requested
+    int max_delay_ms() const { return requested_max_delay_ms_.load(std::memory_order_relaxed); }
+
+private:
+    struct Candidate {
+        int lag;
+        float score;
+    };
+
+    enum class SearchPhase { kIdle, kCoarse, kFine };
+
+    void ResetState();
+    void StartSearch();
+    void ContinueSearch();
+    void SearchCoarse(int first_lag, int last_lag);
+    bool StartRefine();
+    bool RefineFine(int max_lags);
+    void FinishSearch(int lag);
+
+    const int capacity_ms_;
+
+    // Search range in use (capture thread)
+    int max_fine_lag_ = 0;
+    int max_coarse_lag_ = 0;
+
+    // Render history (render thread writes, capture thread snapshots).
+    // Indexed by absolute 4 kHz / 500 Hz sample number modulo the ring size.
+    std::mutex render_mutex_;
+    std::vector<float> render_fine_;
+    std::vector<float> render_coarse_;
+    int64_t render_fine_count_ = 0;
+    size_t render_frame_samples_ = 0;
+
+    // Capture thread state
+    std::vector<float> capture_fine_;
+    std::vector<float> capture_coarse_;
+    int64_t capture_fine_count_ = 0;
+    size_t capture_frame_samples_ = 0;
+    int frames_until_search_ = 0;
+    int last_lag_ = -1;
+    int agreeing_searches_ = 0;
+
+    // Search in progress: the capture position it looks back from, the
+    // next lag to correlate and the best result so far
+    SearchPhase search_phase_ = SearchPhase::kIdle;
+    int64_t search_capture_end_ = 0;
+    int next_coarse_lag_ = 0;
+    size_t refine_candidate_ = 0;
+    int next_fine_lag_ = 0;
+    float mean_x_ = 0.0f;
+    float var_x_ = 0.0f;
+    float energy_x_ = 0.0f;
+    float best_score_ = 0.0f;
+    int best_lag_ = -1;
+
+    // Search scratch, sized once
+    std::vector<float> snapshot_fine_;
+    std::vector<float> snapshot_coarse_;
+    int64_t snapshot_fine_start_ = 0;
+    int64_t snapshot_fine_end_ = 0;
+    std::vector<float> window_fine_;
+    std::vector<float> window_coarse_;
+    std::vector<Candidate> candidates_;
+
+    std::atomic<int> delay_ms_{-1};
+    std::atomic<int> requested_max_delay_ms_;
+    std::atomic<bool> reset_requested_{false};
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_DELAY_ESTIMATOR_H_
@@ -0,0 +1,56 @@
+// Device-rate resampling for the APM JNI wrapper
+// See device_resampler.h for the approach.
+
+#include "device_resampler.h"
+
+#include "sample_conversion.h"
+
+namespace apm_jni {
+
+namespace {
+
+constexpr int kMinDeviceRateHz = 8000;
+// A stereo frame at this rate still fits a render queue slot
+constexpr int kMaxDeviceRateHz = 48000;
+
+}  // namespace
+
+bool DeviceResampler::IsSupportedRate(int rate_hz) {
+    return rate_hz >= kMinDeviceRateHz && rate_hz <= kMaxDeviceRateHz && rate_hz % 100 == 0;
+}
+
+DeviceResampler::DeviceResampler(int device_rate_hz, int apm_rate_hz, size_t num_channels,
+                                 bool bidirectional)
+    : device_rate_hz_(device_rate_hz),
+      device_frames_(static_cast<size_t>(device_rate_hz / 100)),
+      apm_frames_(static_cast<size_t>(apm_rate_hz / 100)),
+      num_channels_(num_channels),
+      device_samples_(device_frames_ * num_channels),
+      device_channels_(num_channels) {
+    for (size_t ch = 0; ch < num_channels_; ch++) {
+        device_channels_[ch] = device_samples_.data() + ch * device_frames_;
+        to_apm_.push_back(std::make_unique<webrtc::PushSincResampler>(device_frames_, apm_frames_));
+        if (bidirectional) {
+            from_apm_.push_back(
+                std::make_unique<webrtc::PushSincResampler>(apm_frames_, device_frames_));
+        }
+    }
+}
+
+DeviceResampler::~DeviceResampler() = default;
+
+void DeviceResampler::ToApm(const int16_t* samples, float* const* apm_channels) {
+    S16ToFloat(samples, device_channels_.data(), device_frames_, num_channels_);
+    for (size_t ch = 0; ch < num_channels_; ch++) {
+        to_apm_[ch]->Resample(device_channels_[ch], device_frames_, apm_channels[ch], apm_frames_);
+    }
+}
+
+void DeviceResampler::FromApm(const float* const* apm_channels, int16_t* samples) {
+    for (size_t ch = 0; ch < num_channels_; ch++) {
+        from_apm_[ch]->Resample(apm_channels[ch], apm_frames_, device_channels_[ch], device_frames_);
+    }
+    FloatToS16(device_channels_.data(), samples, device_frames_, num_channels_);
+}
+
+}  // namespace apm_jni
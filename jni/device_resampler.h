@@ -0,0 +1,65 @@
+// Device-rate resampling for the APM JNI wrapper
+//
+// Android devices commonly deliver 44.1 or 48 kHz audio, while the APM may
+// run at a lower rate. Resampling in a separate JNI call costs two extra
+// array round trips and an int16 quantization step between the resampler
+// and APM. DeviceResampler instead converts one 10 ms device-rate frame
+// straight into the APM's float planes (and back for capture), with one
+// PushSincResampler per channel and direction. Nothing is allocated per
+// frame.
+
+#ifndef APM_JNI_DEVICE_RESAMPLER_H_
+#define APM_JNI_DEVICE_RESAMPLER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common_audio/resampler/push_sinc_resampler.h"
+
+namespace apm_jni {
+
+class DeviceResampler {
+public:
+    // Any rate with whole 10 ms frames, 8-48 kHz
+    static bool IsSupportedRate(int rate_hz);
+
+    // Converts between device_rate_hz and apm_rate_hz for num_channels
+    // interleaved channels. FromApm() is only available if bidirectional.
+    DeviceResampler(int device_rate_hz, int apm_rate_hz, size_t num_channels, bool bidirectional);
+    ~DeviceResampler();
+
+    DeviceResampler(const DeviceResampler&) = delete;
+    DeviceResampler& operator=(const DeviceResampler&) = delete;
+
+    // Deinterleaves one device-rate int16 frame and resamples each channel
+    // into the APM-rate planes of apm_channels (normalized floats)
+    void ToApm(const int16_t* samples, float* const* apm_channels);
+
+    // Resamples APM-rate planes back to device rate and interleaves them
+    // into one int16 frame
+    void FromApm(const float* const* apm_channels, int16_t* samples);
+
+    int device_rate_hz() const { return device_rate_hz_; }
+
+    // Interleaved int16 samples in one 10 ms device-rate frame
+    size_t device_frame_samples() const { return device_frames_ * num_channels_; }
+
+private:
+    const int device_rate_hz_;
+    const size_t device_frames_;
+    const size_t apm_frames_;
+    const size_t num_channels_;
+
+    std::vector<std::unique_ptr<webrtc::PushSincResampler>> to_apm_;
+    std::vector<std::unique_ptr<webrtc::PushSincResampler>> from_apm_;
+
+    // Device-rate float planes between deinterleaving and resampling
+    std::vector<float> device_samples_;
+    std::vector<float*> device_channels_;
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_DEVICE_RESAMPLER_H_
@@ -0,0 +1,360 @@
+// Arena allocation for APM and AEC3 instances in the JNI wrapper
+// See instance_arena.h for the model.
+//
+// This file replaces the global operator new/delete. The library's version
+// script (libwebrtc_apms.map) exports only the JNI entry points, so the
+// replacement binds locally: it covers code linked into libwebrtc_apms.so,
+// not the rest of the process. Outside an ArenaScope it is plain malloc/free.
+
+#include "instance_arena.h"
+
+#include <android/log.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define APM_JNI_ASAN 1
+#endif
+#elif defined(__SANITIZE_ADDRESS__)
+#define APM_JNI_ASAN 1
+#endif
+
+#if defined(APM_JNI_ASAN)
+#include <sanitizer/asan_interface.h>
+// Pooled blocks are poisoned, so ASan reports a use of an arena object
+// after its block went back to the pool
+#define POISON_BLOCK(base, size) ASAN_POISON_MEMORY_REGION(base, size)
+#define UNPOISON_BLOCK(base, size) ASAN_UNPOISON_MEMORY_REGION(base, size)
+#else
+#define POISON_BLOCK(base, size) ((void)(base), (void)(size))
+#define UNPOISON_BLOCK(base, size) ((void)(base), (void)(size))
+#endif
+
+#define LOG_TAG "WebRTC-APM"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+namespace apm_jni {
+
+namespace {
+
+constexpr size_t kArenaAlignment = 64;
+
+// Live arenas, looked up by every delete; arenas beyond this are not made
+constexpr int kMaxLiveArenas = 16;
+
+// A live range holds one reference for its InstanceArena and one per
+// object allocated in it and not yet deleted; the block is released when
+// the count reaches zero
+constexpr uint32_t kOwnerReference = 1;
+
+// Released blocks kept for reuse, and remembered build sizes
+constexpr int kMaxPooledBlocks = 4;
+constexpr int kMaxBuildSizes = 16;
+
+std::atomic<bool> g_enabled{false};
+thread_local ArenaScope* t_scope = nullptr;
+
+struct LiveRange {
+    std::atomic<uintptr_t> begin{0};
+    std::atomic<uintptr_t> end{0};
+    std::atomic<uint32_t> references{0};
+};
+LiveRange g_live[kMaxLiveArenas];
+std::atomic<int> g_live_count{0};
+// One past the highest slot in use, so a delete only scans the slots that
+// have been used (usually one or two) rather than all of them
+std::atomic<int> g_live_slots{0};
+
+// Pool and size table. Fixed arrays only: this bookkeeping must never
+// allocate, since it runs inside operator new's callers.
+struct PooledBlock {
+    uint8_t* base;
+    size_t capacity;
+};
+struct BuildSize {
+    uint64_t key;
+    size_t bytes;
+};
+std::mutex g_mutex;
+PooledBlock g_pool[kMaxPooledBlocks];
+int g_pool_size = 0;
+BuildSize g_sizes[kMaxBuildSizes];
+int g_sizes_used = 0;
+int g_sizes_next = 0;
+
+size_t RoundUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+size_t LookupBuildSize(uint64_t key) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    for (int i = 0; i < g_sizes_used; i++) {
+        if (g_sizes[i].key == key) return g_sizes[i].bytes;
+    }
+    return 0;
+}
+
+void RecordBuildSize(uint64_t key, size_t bytes) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    for (int i = 0; i < g_sizes_used; i++) {
+        if (g_sizes[i].key == key) {
+            g_sizes[i].bytes = bytes;
+            return;
+        }
+    }
+    if (g_sizes_used < kMaxBuildSizes) {
+        g_sizes[g_sizes_used++] = {key, bytes};
+    } else {
+        g_sizes[g_sizes_next] = {key, bytes};
+        g_sizes_next = (g_sizes_next + 1) % kMaxBuildSizes;
+    }
+}
+
+int RegisterRange(uint8_t* base, size_t capacity) {
+    for (int i = 0; i < kMaxLiveArenas; i++) {
+        uintptr_t expected = 0;
+        if (g_live[i].begin.compare_exchange_strong(expected, 1, std::memory_order_acq_rel)) {
+            g_live[i].references.store(kOwnerReference, std::memory_order_relaxed);
+            g_live[i].end.store(reinterpret_cast<uintptr_t>(base) + capacity, std::memory_order_release);
+            g_live[i].begin.store(reinterpret_cast<uintptr_t>(base), std::memory_order_release);
+            g_live_count.fetch_add(1, std::memory_order_acq_rel);
+            int slots = g_live_slots.load(std::memory_order_relaxed);
+            while (slots < i + 1 &&
+                   !g_live_slots.compare_exchange_weak(slots, i + 1, std::memory_order_acq_rel)) {
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+void UnregisterRange(int slot) {
+    g_live_count.fetch_sub(1, std::memory_order_acq_rel);
+    g_live[slot].end.store(0, std::memory_order_release);
+    g_live[slot].begin.store(0, std::memory_order_release);
+}
+
+// Slot of the live range holding ptr, or -1
+int FindRange(const void* ptr) {
+    if (g_live_count.load(std::memory_order_acquire) == 0) return -1;
+    const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+    const int slots = g_live_slots.load(std::memory_order_acquire);
+    for (int i = 0; i < slots; i++) {
+        const uintptr_t begin = g_live[i].begin.load(std::memory_order_acquire);
+        if (begin > 1 && address >= begin && address < g_live[i].end.load(std::memory_order_acquire)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Reuses a pooled block that fits without wasting more than half of it
+uint8_t* AcquireBlock(size_t bytes, size_t* capacity) {
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        for (int i = 0; i < g_pool_size; i++) {
+            if (g_pool[i].capacity >= bytes && g_pool[i].capacity / 2 <= bytes) {
+                uint8_t* base = g_pool[i].base;
+                *capacity = g_pool[i].capacity;
+                g_pool[i] = g_pool[--g_pool_size];
+                UNPOISON_BLOCK(base, *capacity);
+                return base;
+            }
+        }
+    }
+    void* base = nullptr;
+    if (posix_memalign(&base, kArenaAlignment, bytes) != 0) return nullptr;
+    *capacity = bytes;
+    return static_cast<uint8_t*>(base);
+}
+
+void ReleaseBlock(uint8_t* base, size_t capacity) {
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (g_pool_size < kMaxPooledBlocks) {
+            POISON_BLOCK(base, capacity);
+            g_pool[g_pool_size++] = {base, capacity};
+            return;
+        }
+    }
+    free(base);
+}
+
+// Drops one reference to a live range; the last one releases its block
+void ReleaseReference(int slot) {
+    if (g_live[slot].references.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    uint8_t* base = reinterpret_cast<uint8_t*>(g_live[slot].begin.load(std::memory_order_relaxed));
+    const size_t capacity = g_live[slot].end.load(std::memory_order_relaxed) -
+                            reinterpret_cast<uintptr_t>(base);
+    UnregisterRange(slot);
+    ReleaseBlock(base, capacity);
+}
+
+}  // namespace
+
+void* HeapAllocate(size_t size, size_t alignment) {
+    if (size == 0) size = 1;
+    if (alignment <= alignof(std::max_align_t)) return malloc(size);
+    void* ptr = nullptr;
+    return posix_memalign(&ptr, alignment, size) == 0 ? ptr : nullptr;
+}
+
+void SetArenaAllocation(bool enabled) {
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool ArenaAllocationEnabled() {
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+InstanceArena::~InstanceArena() {
+    // Everything built in the arena should be gone by now. In release
+    // builds a straggler keeps the block alive until it is deleted, rather
+    // than being handed to free() or left pointing into a reused block.
+    assert(g_live[slot_].references.load(std::memory_order_acquire) == kOwnerReference &&
+           "object built in an arena outlives it");
+    ReleaseReference(slot_);
+}
+
+size_t InstanceArena::live_objects() const {
+    return g_live[slot_].references.load(std::memory_order_acquire) - kOwnerReference;
+}
+
+ArenaScope::ArenaScope(uint64_t key)
+    : active_(ArenaAllocationEnabled()), key_(key), previous_(t_scope) {
+    if (!active_) return;
+
+    // A measured build gets an arena of its size plus slack; an unknown one
+    // runs on the heap and is measured
+    const size_t bytes = LookupBuildSize(key);
+    if (bytes > 0) {
+        // The arena's own bookkeeping must not land in an outer arena
+        t_scope = nullptr;
+        const size_t wanted = RoundUp(bytes + bytes / 8, 4096);
+        size_t capacity = 0;
+        uint8_t* base = AcquireBlock(wanted, &capacity);
+        const int slot = base ? RegisterRange(base, capacity) : -1;
+        if (slot >= 0) {
+            arena_ = new InstanceArena(base, capacity, slot);
+        } else if (base) {
+            ReleaseBlock(base, capacity);
+        }
+    }
+    t_scope = this;
+}
+
+ArenaScope::~ArenaScope() {
+    if (!active_) return;
+    t_scope = previous_;
+
+    RecordBuildSize(key_, requested_bytes_);
+    // A taken arena belongs to the caller and may already be gone
+    if (arena_ && owns_arena_) delete arena_;
+}
+
+std::unique_ptr<InstanceArena> ArenaScope::TakeArena() {
+    if (!arena_ || !owns_arena_) return nullptr;
+    LOGD("Arena build: %zu of %zu bytes%s", arena_->used(), arena_->capacity(),
+         requested_bytes_ > arena_->used() ? " (overflowed to heap)" : "");
+    owns_arena_ = false;
+    return std::unique_ptr<InstanceArena>(arena_);
+}
+
+void* ArenaAllocate(size_t size, size_t alignment) {
+    ArenaScope* scope = t_scope;
+    if (!scope) return nullptr;
+
+    const size_t rounded = RoundUp(size ? size : 1, kArenaAlignment);
+    alignment = alignment > kArenaAlignment ? alignment : kArenaAlignment;
+    scope->requested_bytes_ += rounded + (alignment - kArenaAlignment);
+
+    InstanceArena* arena = scope->arena_;
+    if (!arena) return nullptr;
+    const uintptr_t base = reinterpret_cast<uintptr_t>(arena->base_);
+    const uintptr_t start = RoundUp(base + arena->used_, alignment);
+    if (start + rounded > base + arena->capacity_) return nullptr;
+    arena->used_ = start + rounded - base;
+    g_live[arena->slot_].references.fetch_add(1, std::memory_order_relaxed);
+    return reinterpret_cast<void*>(start);
+}
+
+bool ArenaOwns(const void* ptr) {
+    return FindRange(ptr) >= 0;
+}
+
+void ArenaRelease(void* ptr) {
+    const int slot = FindRange(ptr);
+    if (slot >= 0) {
+        ReleaseReference(slot);
+    } else {
+        free(ptr);
+    }
+}
+
+}  // namespace apm_jni
+
+// ============================================================================
+// Replaced global allocation functions
+// ============================================================================
+
+namespace {
+
+void* Allocate(size_t size, size_t alignment) {
+    void* ptr = apm_jni::ArenaAllocate(size, alignment);
+    if (!ptr) ptr = apm_jni::HeapAllocate(size, alignment);
+    // WebRTC builds without exceptions, so there is nothing to throw to
+    if (!ptr) abort();
+    return ptr;
+}
+
+void* AllocateNoThrow(size_t size, size_t alignment) noexcept {
+    void* ptr = apm_jni::ArenaAllocate(size, alignment);
+    return ptr ? ptr : apm_jni::HeapAllocate(size, alignment);
+}
+
+void Release(void* ptr) noexcept {
+    if (ptr) apm_jni::ArenaRelease(ptr);
+}
+
+constexpr size_t kDefaultAlignment = alignof(std::max_align_t);
+
+}  // namespace
+
+void* operator new(size_t size) { return Allocate(size, kDefaultAlignment); }
+void* operator new[](size_t size) { return Allocate(size, kDefaultAlignment); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return AllocateNoThrow(size, kDefaultAlignment);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return AllocateNoThrow(size, kDefaultAlignment);
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+    return Allocate(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return Allocate(size, static_cast<size_t>(alignment));
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return AllocateNoThrow(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return AllocateNoThrow(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept { Release(ptr); }
+void operator delete[](void* ptr) noexcept { Release(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { Release(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { Release(ptr); }
+void operator delete(void* ptr, size_t) noexcept { Release(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { Release(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { Release(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { Release(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { Release(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { Release(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { Release(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { Release(ptr); }
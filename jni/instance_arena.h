@@ -0,0 +1,96 @@
+// Arena allocation for APM and AEC3 instances in the JNI wrapper
+//
+// Building an EchoCanceller3 with a long filter makes hundreds of scattered
+// heap allocations (render, FFT and spectrum buffers, filters, estimators).
+// Swapping shadows and churning sessions then makes creation slow and
+// fragments the heap. WebRTC has no allocator hook, so while an ArenaScope
+// is alive on a thread the library's operator new is served from one
+// contiguous, 64-byte aligned block instead. Everything built in the scope
+// lives in that block, deletes of it only drop a count, and teardown
+// returns the whole block to a small pool at once.
+//
+// The arena is sized from the config: the first build of a given key runs
+// on the heap and records how much it allocated, and later builds of the
+// same key get an arena of that size. A build that outgrows its arena falls
+// back to the heap for the rest. Measuring first also keeps lazily created
+// statics out of arenas, since those are made by the first build.
+
+#ifndef APM_JNI_INSTANCE_ARENA_H_
+#define APM_JNI_INSTANCE_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace apm_jni {
+
+// Process-wide switch, off by default. Affects builds started afterwards.
+void SetArenaAllocation(bool enabled);
+bool ArenaAllocationEnabled();
+
+// One contiguous block backing the objects built in an ArenaScope. It should
+// outlive all of them (debug builds assert it). Destroying it returns the
+// block to the pool, or, if objects built in it are still alive, leaves that
+// to the last one deleted.
+class InstanceArena {
+public:
+    ~InstanceArena();
+
+    InstanceArena(const InstanceArena&) = delete;
+    InstanceArena& operator=(const InstanceArena&) = delete;
+
+    size_t capacity() const { return capacity_; }
+    size_t used() const { return used_; }
+    // Objects allocated in the arena and not yet deleted
+    size_t live_objects() const;
+
+private:
+    friend class ArenaScope;
+    friend void* ArenaAllocate(size_t size, size_t alignment);
+
+    InstanceArena(uint8_t* base, size_t capacity, int slot)
+        : base_(base), capacity_(capacity), slot_(slot) {}
+
+    uint8_t* const base_;
+    const size_t capacity_;
+    const int slot_;
+    size_t used_ = 0;
+};
+
+// Routes this thread's operator new into an arena while alive. Scopes nest;
+// the innermost one wins. Does nothing while arena allocation is off.
+class ArenaScope {
+public:
+    // key identifies what is built (see AEC3 and APM callers), so the arena
+    // can be sized from what the same build needed before
+    explicit ArenaScope(uint64_t key);
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    // Hands over the arena backing this scope (null while measuring). Call
+    // before the scope ends and keep it until the objects are destroyed.
+    std::unique_ptr<InstanceArena> TakeArena();
+
+private:
+    friend void* ArenaAllocate(size_t size, size_t alignment);
+
+    const bool active_;
+    const uint64_t key_;
+    ArenaScope* const previous_;
+    InstanceArena* arena_ = nullptr;
+    bool owns_arena_ = true;
+    size_t requested_bytes_ = 0;
+};
+
+// Building blocks of the replaced operator new/delete
+void* ArenaAllocate(size_t size, size_t alignment);
+void* HeapAllocate(size_t size, size_t alignment);
+bool ArenaOwns(const void* ptr);
+// Frees ptr, or drops its reference if it lies in a live arena
+void ArenaRelease(void* ptr);
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_INSTANCE_ARENA_H_
@@ -0,0 +1,134 @@
+// Pool of ready-to-use instances for the APM JNI wrapper
+//
+// Building an APM with the long AEC3 filter takes long enough to show on
+// the call-setup path. The pool keeps a bounded number of fully built
+// instances, grouped by a key describing how they were built, so a new
+// session can take one instead of building it. Finished sessions hand
+// theirs back once reset.
+//
+// The pool only stores instances; building and resetting them is up to the
+// caller. Instances are destroyed outside the pool's lock.
+
+#ifndef APM_JNI_INSTANCE_POOL_H_
+#define APM_JNI_INSTANCE_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace apm_jni {
+
+template <typename T>
+class InstancePool {
+public:
+    struct Stats {
+        size_t idle = 0;        // instances waiting in the pool
+        size_t capacity = 0;
+        uint64_t hits = 0;      // checkouts served from the pool
+        uint64_t misses = 0;    // checkouts that found nothing to take
+        uint64_t recycled = 0;  // instances handed back and kept
+        uint64_t discarded = 0; // instances handed back or trimmed and destroyed
+    };
+
+    explicit InstancePool(size_t capacity = 0) : capacity_(capacity) {}
+
+    InstancePool(const InstancePool&) = delete;
+    InstancePool& operator=(const InstancePool&) = delete;
+
+    // Sets how many idle instances are kept (0 turns pooling off) and
+    // destroys any beyond it
+    void SetCapacity(size_t capacity) {
+        std::vector<std::unique_ptr<T>> evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            capacity_ = capacity;
+            EvictLocked(capacity, &evicted);
+        }
+    }
+
+    size_t capacity() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return capacity_;
+    }
+
+    // Takes an idle instance built for key, or null if there is none
+    std::unique_ptr<T> Checkout(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = idle_.size(); i-- > 0;) {
+            if (idle_[i].first != key) continue;
+            std::unique_ptr<T> instance = std::move(idle_[i].second);
+            idle_.erase(idle_.begin() + i);
+            stats_.hits++;
+            return instance;
+        }
+        stats_.misses++;
+        return nullptr;
+    }
+
+    // Keeps a reset instance for the next checkout of key. When the pool is
+    // full the oldest idle instance makes room; with pooling off the
+    // instance is destroyed. Returns whether it was kept.
+    bool Return(uint64_t key, std::unique_ptr<T> instance) {
+        std::vector<std::unique_ptr<T>> evicted;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (capacity_ == 0) {
+            stats_.discarded++;
+            evicted.push_back(std::move(instance));
+            return false;
+        }
+        EvictLocked(capacity_ - 1, &evicted);
+        idle_.emplace_back(key, std::move(instance));
+        stats_.recycled++;
+        return true;
+    }
+
+    // Number of idle instances built for key
+    size_t Idle(uint64_t key) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t count = 0;
+        for (const auto& entry : idle_) count += entry.first == key;
+        return count;
+    }
+
+    // Destroys idle instances, oldest first, until at most keep are left.
+    // Returns how many were destroyed.
+    size_t Trim(size_t keep) {
+        std::vector<std::unique_ptr<T>> evicted;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            EvictLocked(keep, &evicted);
+        }
+        return evicted.size();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats = stats_;
+        stats.idle = idle_.size();
+        stats.capacity = capacity_;
+        return stats;
+    }
+
+private:
+    // Moves out the oldest idle instances beyond keep. The caller destroys
+    // them after releasing the lock (evicted is declared before the lock).
+    void EvictLocked(size_t keep, std::vector<std::unique_ptr<T>>* evicted) {
+        if (idle_.size() <= keep) return;
+        const size_t count = idle_.size() - keep;
+        for (size_t i = 0; i < count; i++) evicted->push_back(std::move(idle_[i].second));
+        idle_.erase(idle_.begin(), idle_.begin() + count);
+        stats_.discarded += count;
+    }
+
+    mutable std::mutex mutex_;
+    size_t capacity_;
+    std::vector<std::pair<uint64_t, std::unique_ptr<T>>> idle_;
+    Stats stats_;
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_INSTANCE_POOL_H_
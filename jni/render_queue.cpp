@@ -0,0 +1,60 @@
+// Render frame queue for the APM JNI wrapper
+// See render_queue.h for the threading model.
+
+#include "render_queue.h"
+
+#include <cstring>
+
+namespace apm_jni {
+
+namespace {
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+    size_t result = 1;
+    while (result < value) result <<= 1;
+    return result;
+}
+
+}  // namespace
+
+RenderFrameQueue::RenderFrameQueue(size_t capacity_frames, size_t max_frame_samples)
+    : mask_(RoundUpToPowerOfTwo(capacity_frames < 2 ? 2 : capacity_frames) - 1),
+      slot_samples_(max_frame_samples),
+      samples_((mask_ + 1) * max_frame_samples),
+      lengths_(mask_ + 1),
+      limit_(mask_ + 1) {}
+
+void RenderFrameQueue::SetLimit(size_t frames) {
+    const size_t limit = RoundUpToPowerOfTwo(frames < 2 ? 2 : frames);
+    limit_.store(limit < mask_ + 1 ? limit : mask_ + 1, std::memory_order_relaxed);
+}
+
+bool RenderFrameQueue::Push(const int16_t* samples, size_t num_samples) {
+    const size_t write = write_pos_.load(std::memory_order_relaxed);
+    if (num_samples > slot_samples_ ||
+        write - read_pos_.load(std::memory_order_acquire) >= limit_.load(std::memory_order_relaxed)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    const size_t slot = write & mask_;
+    memcpy(&samples_[slot * slot_samples_], samples, num_samples * sizeof(int16_t));
+    lengths_[slot] = num_samples;
+    write_pos_.store(write + 1, std::memory_order_release);
+    return true;
+}
+
+const int16_t* RenderFrameQueue::Front(size_t* num_samples) const {
+    const size_t read = read_pos_.load(std::memory_order_relaxed);
+    if (read == write_pos_.load(std::memory_order_acquire)) return nullptr;
+
+    const size_t slot = read & mask_;
+    *num_samples = lengths_[slot];
+    return &samples_[slot * slot_samples_];
+}
+
+void RenderFrameQueue::Pop() {
+    read_pos_.store(read_pos_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+}  // namespace apm_jni
@@ -0,0 +1,67 @@
+// Render frame queue for the APM JNI wrapper
+//
+// Android delivers playback and capture callbacks on different threads. When
+// both call into AudioProcessing they contend on its render and capture
+// locks, and a playback callback can stall behind a capture frame's AEC work.
+// With the queue enabled the playback thread only copies its far-end frame
+// into this lock-free single-producer/single-consumer ring. The capture
+// thread drains it and runs ProcessReverseStream just before ProcessStream,
+// so all APM work happens on the capture thread.
+
+#ifndef APM_JNI_RENDER_QUEUE_H_
+#define APM_JNI_RENDER_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace apm_jni {
+
+class RenderFrameQueue {
+public:
+    // Capacity is rounded up to a power of two. Each slot holds one
+    // interleaved int16 frame of up to max_frame_samples samples.
+    RenderFrameQueue(size_t capacity_frames, size_t max_frame_samples);
+
+    RenderFrameQueue(const RenderFrameQueue&) = delete;
+    RenderFrameQueue& operator=(const RenderFrameQueue&) = delete;
+
+    // Caps how many frames may be queued at once, rounded up to a power of
+    // two and at most capacity(). Any thread; the memory stays allocated, so
+    // the queue can be resized while the stream threads are using it.
+    void SetLimit(size_t frames);
+    size_t limit() const { return limit_.load(std::memory_order_relaxed); }
+
+    // Producer (playback thread). Copies the frame into the next free slot;
+    // false if limit() frames are queued or the frame is too large, and the
+    // frame is dropped. Never blocks.
+    bool Push(const int16_t* samples, size_t num_samples);
+
+    // Consumer (capture thread). Oldest queued frame, or null if empty. The
+    // slot stays valid until Pop().
+    const int16_t* Front(size_t* num_samples) const;
+    void Pop();
+
+    // Frames dropped because the queue was full
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    const size_t mask_;
+    const size_t slot_samples_;
+    std::vector<int16_t> samples_;
+    std::vector<size_t> lengths_;
+
+    // Free-running positions, each written by one side only and kept on
+    // separate cache lines
+    alignas(64) std::atomic<size_t> write_pos_{0};
+    alignas(64) std::atomic<size_t> read_pos_{0};
+    alignas(64) std::atomic<uint64_t> dropped_{0};
+    std::atomic<size_t> limit_;
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_RENDER_QUEUE_H_
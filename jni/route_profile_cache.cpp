@@ -0,0 +1,291 @@
+// Audio route profile cache for the APM JNI wrapper
+// See route_profile_cache.h for the model.
+
+#include "route_profile_cache.h"
+
+#include <android/log.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#define LOG_TAG "WebRTC-APM"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+using namespace webrtc;
+
+namespace apm_jni {
+
+namespace {
+
+constexpr uint32_t kProfileMagic = 0x31505241;  // "ARP1"
+constexpr uint32_t kProfileVersion = 1;
+
+constexpr uint32_t kSlotValid = 1u << 0;
+constexpr uint32_t kSlotAdaptiveLength = 1u << 1;
+constexpr uint32_t kSlotEchoPath = 1u << 2;
+constexpr uint32_t kSlotConservative = 1u << 3;
+
+uint32_t Checksum(const uint8_t* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+// File layout: one header, then kNumSlots fixed-size slots
+struct ProfileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_slots;
+    uint32_t slot_size;
+    uint64_t sequence;  // last-used stamp source for LRU eviction
+    uint8_t reserved[40];
+};
+
+struct ProfileSlot {
+    uint32_t checksum;  // over everything after this field
+    uint32_t flags;
+    uint64_t last_used;
+    char route[RouteProfileCache::kMaxRouteLength + 1];
+    uint32_t refined_length_blocks;
+    uint32_t coarse_length_blocks;
+    uint32_t refined_initial_length_blocks;
+    uint32_t coarse_initial_length_blocks;
+    uint32_t num_matched_filters;
+    float enr_suppress_lf;
+    float enr_suppress_hf;
+    uint8_t echo_path[kEchoPathStateSize];
+    uint8_t reserved[12];
+};
+
+static_assert(sizeof(ProfileHeader) == 64, "profile header layout");
+static_assert(sizeof(ProfileSlot) == 128, "profile slot layout");
+
+uint32_t SlotChecksum(const ProfileSlot& slot) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&slot);
+    return Checksum(bytes + sizeof(slot.checksum), sizeof(slot) - sizeof(slot.checksum));
+}
+
+ProfileSlot* Slots(void* mapping) {
+    return reinterpret_cast<ProfileSlot*>(static_cast<uint8_t*>(mapping) + sizeof(ProfileHeader));
+}
+
+bool ValidLength(uint32_t length_blocks) {
+    return length_blocks >= kMinProfileFilterLengthBlocks &&
+           length_blocks <= kMaxProfileFilterLengthBlocks;
+}
+
+bool ValidEnrSuppress(float enr_suppress) {
+    return std::isfinite(enr_suppress) && enr_suppress > 0.0f &&
+           enr_suppress <= kMaxProfileEnrSuppress;
+}
+
+// A checksum only catches torn writes, not a profile written by a build with
+// other limits. Delay compensation clamps the initial phase lengths to the
+// room response, so they may be shorter than the minimum length.
+bool ValidSlot(const ProfileSlot& slot) {
+    return ValidLength(slot.refined_length_blocks) && ValidLength(slot.coarse_length_blocks) &&
+           slot.refined_initial_length_blocks >= 1 &&
+           slot.refined_initial_length_blocks <= kMaxProfileFilterLengthBlocks &&
+           slot.coarse_initial_length_blocks >= 1 &&
+           slot.coarse_initial_length_blocks <= kMaxProfileFilterLengthBlocks &&
+           slot.num_matched_filters >= 1 && slot.num_matched_filters <= kMaxProfileMatchedFilters &&
+           ValidEnrSuppress(slot.enr_suppress_lf) && ValidEnrSuppress(slot.enr_suppress_hf);
+}
+
+ProfileSlot* FindSlot(void* mapping, const std::string& route) {
+    ProfileSlot* table = Slots(mapping);
+    for (size_t i = 0; i < RouteProfileCache::kNumSlots; i++) {
+        if ((table[i].flags & kSlotValid) &&
+            strncmp(table[i].route, route.c_str(), sizeof(table[i].route)) == 0) {
+            return &table[i];
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace
+
+// ============================================================================
+// RouteProfile <-> EchoCanceller3Config
+// ============================================================================
+
+RouteProfile ProfileFromConfig(const EchoCanceller3Config& config, size_t base_num_filters) {
+    RouteProfile profile;
+    profile.refined_length_blocks = config.filter.refined.length_blocks;
+    profile.coarse_length_blocks = config.filter.coarse.length_blocks;
+    profile.refined_initial_length_blocks = config.filter.refined_initial.length_blocks;
+    profile.coarse_initial_length_blocks = config.filter.coarse_initial.length_blocks;
+    profile.num_matched_filters = base_num_filters;
+    profile.conservative_initial_phase = config.filter.conservative_initial_phase;
+    profile.enr_suppress_lf = config.suppressor.normal_tuning.mask_lf.enr_suppress;
+    profile.enr_suppress_hf = config.suppressor.normal_tuning.mask_hf.enr_suppress;
+    return profile;
+}
+
+void ApplyProfileToConfig(const RouteProfile& profile, EchoCanceller3Config* config) {
+    config->filter.refined.length_blocks = profile.refined_length_blocks;
+    config->filter.coarse.length_blocks = profile.coarse_length_blocks;
+    config->filter.refined_initial.length_blocks = profile.refined_initial_length_blocks;
+    config->filter.coarse_initial.length_blocks = profile.coarse_initial_length_blocks;
+    config->delay.num_filters = profile.num_matched_filters;
+    config->filter.conservative_initial_phase = profile.conservative_initial_phase;
+    config->suppressor.normal_tuning.mask_lf.enr_suppress = profile.enr_suppress_lf;
+    config->suppressor.normal_tuning.mask_hf.enr_suppress = profile.enr_suppress_hf;
+}
+
+bool SameTuning(const RouteProfile& a, const RouteProfile& b) {
+    return a.refined_length_blocks == b.refined_length_blocks &&
+           a.coarse_length_blocks == b.coarse_length_blocks &&
+           a.refined_initial_length_blocks == b.refined_initial_length_blocks &&
+           a.coarse_initial_length_blocks == b.coarse_initial_length_blocks &&
+           a.num_matched_filters == b.num_matched_filters &&
+           a.conservative_initial_phase == b.conservative_initial_phase &&
+           a.enr_suppress_lf == b.enr_suppress_lf &&
+           a.enr_suppress_hf == b.enr_suppress_hf;
+}
+
+// ============================================================================
+// RouteProfileCache
+// ============================================================================
+
+RouteProfileCache::~RouteProfileCache() {
+    if (mapping_) munmap(mapping_, mapping_size_);
+}
+
+bool RouteProfileCache::Open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (mapping_) {
+        munmap(mapping_, mapping_size_);
+        mapping_ = nullptr;
+    }
+
+    const size_t size = sizeof(ProfileHeader) + kNumSlots * sizeof(ProfileSlot);
+    void* mapping = MAP_FAILED;
+    if (path.empty()) {
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            LOGE("Cannot open route profiles %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (static_cast<size_t>(st.st_size) == size || ftruncate(fd, size) == 0)) {
+            mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+    }
+    if (mapping == MAP_FAILED) {
+        LOGE("Cannot map route profiles: %s", strerror(errno));
+        return false;
+    }
+
+    mapping_ = mapping;
+    mapping_size_ = size;
+
+    // A file from another layout (or a new, zero-filled one) starts empty
+    ProfileHeader* header = static_cast<ProfileHeader*>(mapping_);
+    if (header->magic != kProfileMagic || header->version != kProfileVersion ||
+        header->num_slots != kNumSlots || header->slot_size != sizeof(ProfileSlot)) {
+        memset(mapping_, 0, size);
+        header->magic = kProfileMagic;
+        header->version = kProfileVersion;
+        header->num_slots = kNumSlots;
+        header->slot_size = sizeof(ProfileSlot);
+        LOGI("Route profiles initialized%s", path.empty() ? " (in memory)" : "");
+    }
+    return true;
+}
+
+bool RouteProfileCache::Lookup(const std::string& route, RouteProfile* profile) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!mapping_ || route.empty() || route.size() > kMaxRouteLength) return false;
+
+    ProfileSlot* slot = FindSlot(mapping_, route);
+    if (!slot) return false;
+    if (slot->checksum != SlotChecksum(*slot)) {
+        // Torn or corrupted entry: drop it rather than apply garbage
+        slot->flags = 0;
+        LOGE("Route profile for %s is corrupt, discarded", route.c_str());
+        return false;
+    }
+    if (!ValidSlot(*slot)) {
+        slot->flags = 0;
+        LOGE("Route profile for %s is out of range, discarded", route.c_str());
+        return false;
+    }
+
+    RouteProfile result;
+    result.refined_length_blocks = slot->refined_length_blocks;
+    result.coarse_length_blocks = slot->coarse_length_blocks;
+    result.refined_initial_length_blocks = slot->refined_initial_length_blocks;
+    result.coarse_initial_length_blocks = slot->coarse_initial_length_blocks;
+    result.num_matched_filters = slot->num_matched_filters;
+    result.conservative_initial_phase = (slot->flags & kSlotConservative) != 0;
+    result.enr_suppress_lf = slot->enr_suppress_lf;
+    result.enr_suppress_hf = slot->enr_suppress_hf;
+    result.adaptive_length = (slot->flags & kSlotAdaptiveLength) != 0;
+    // The parse also rejects an out-of-range delay or length and non-finite
+    // ERL/ERLE; the tuning is still usable without the echo path
+    result.has_echo_path = (slot->flags & kSlotEchoPath) != 0 &&
+                           ParseEchoPathState(slot->echo_path, kEchoPathStateSize, &result.echo_path);
+
+    ProfileHeader* header = static_cast<ProfileHeader*>(mapping_);
+    slot->last_used = ++header->sequence;
+    slot->checksum = SlotChecksum(*slot);
+
+    *profile = result;
+    return true;
+}
+
+bool RouteProfileCache::Store(const std::string& route, const RouteProfile& profile) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!mapping_ || route.empty() || route.size() > kMaxRouteLength) return false;
+
+    ProfileSlot* slot = FindSlot(mapping_, route);
+    if (!slot) {
+        ProfileSlot* table = Slots(mapping_);
+        slot = &table[0];
+        for (size_t i = 0; i < kNumSlots; i++) {
+            if (!(table[i].flags & kSlotValid)) {
+                slot = &table[i];
+                break;
+            }
+            if (table[i].last_used < slot->last_used) slot = &table[i];
+        }
+    }
+
+    ProfileSlot updated = {};
+    updated.flags = kSlotValid;
+    if (profile.adaptive_length) updated.flags |= kSlotAdaptiveLength;
+    if (profile.conservative_initial_phase) updated.flags |= kSlotConservative;
+    strncpy(updated.route, route.c_str(), kMaxRouteLength);
+    updated.refined_length_blocks = static_cast<uint32_t>(profile.refined_length_blocks);
+    updated.coarse_length_blocks = static_cast<uint32_t>(profile.coarse_length_blocks);
+    updated.refined_initial_length_blocks = static_cast<uint32_t>(profile.refined_initial_length_blocks);
+    updated.coarse_initial_length_blocks = static_cast<uint32_t>(profile.coarse_initial_length_blocks);
+    updated.num_matched_filters = static_cast<uint32_t>(profile.num_matched_filters);
+    updated.enr_suppress_lf = profile.enr_suppress_lf;
+    updated.enr_suppress_hf = profile.enr_suppress_hf;
+    if (profile.has_echo_path) {
+        std::vector<uint8_t> blob = SerializeEchoPathState(profile.echo_path);
+        memcpy(updated.echo_path, blob.data(), kEchoPathStateSize);
+        updated.flags |= kSlotEchoPath;
+    }
+
+    ProfileHeader* header = static_cast<ProfileHeader*>(mapping_);
+    updated.last_used = ++header->sequence;
+    updated.checksum = SlotChecksum(updated);
+    memcpy(slot, &updated, sizeof(ProfileSlot));
+    msync(mapping_, mapping_size_, MS_ASYNC);
+    return true;
+}
+
+}  // namespace apm_jni
@@ -0,0 +1,92 @@
+// Audio route profile cache for the APM JNI wrapper
+//
+// Each audio route (speakerphone, wired headset, a specific Bluetooth sink)
+// gets a profile. It holds the AEC3 tuning the wrapper applies (filter
+// lengths, matched-filter range, suppression masks, adaptive length) and the
+// last converged echo path. A route change then reconfigures the running
+// echo control in place and warm starts it, instead of recreating the
+// instance and searching for the delay from scratch.
+//
+// Profiles live in a small fixed-size file mapped with mmap, so lookups and
+// updates are plain memory accesses and survive process restarts. The file
+// uses native byte order and is meant for the app's private storage only.
+
+#ifndef APM_JNI_ROUTE_PROFILE_CACHE_H_
+#define APM_JNI_ROUTE_PROFILE_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "adaptive_echo_control.h"
+#include "api/audio/echo_canceller3_config.h"
+
+namespace apm_jni {
+
+// Tuning ranges the JNI setters accept. Lookup drops stored profiles outside
+// them, so a damaged or stale file never reaches AEC3.
+constexpr size_t kMinProfileFilterLengthBlocks = 4;
+constexpr size_t kMaxProfileFilterLengthBlocks = 60;
+constexpr size_t kMaxProfileMatchedFilters = 21;  // a 2000 ms delay range
+constexpr float kMaxProfileEnrSuppress = 10.0f;
+
+struct RouteProfile {
+    // Tuned EchoCanceller3Config fields
+    size_t refined_length_blocks = 0;
+    size_t coarse_length_blocks = 0;
+    size_t refined_initial_length_blocks = 0;
+    size_t coarse_initial_length_blocks = 0;
+    size_t num_matched_filters = 0;
+    bool conservative_initial_phase = false;
+    float enr_suppress_lf = 0.0f;
+    float enr_suppress_hf = 0.0f;
+
+    bool adaptive_length = false;
+    bool has_echo_path = false;
+    EchoPathState echo_path;
+};
+
+// Captures / applies the fields a RouteProfile holds. base_num_filters is
+// the matched filter count as tuned, before delay estimation or a warm start
+// widened config.delay.num_filters for the session.
+RouteProfile ProfileFromConfig(const webrtc::EchoCanceller3Config& config,
+                               size_t base_num_filters);
+void ApplyProfileToConfig(const RouteProfile& profile, webrtc::EchoCanceller3Config* config);
+
+// True if both profiles tune the config identically (echo path aside)
+bool SameTuning(const RouteProfile& a, const RouteProfile& b);
+
+class RouteProfileCache {
+public:
+    // Route identifiers are stored inline, up to this many bytes
+    static constexpr size_t kMaxRouteLength = 47;
+    static constexpr size_t kNumSlots = 32;
+
+    RouteProfileCache() = default;
+    ~RouteProfileCache();
+
+    RouteProfileCache(const RouteProfileCache&) = delete;
+    RouteProfileCache& operator=(const RouteProfileCache&) = delete;
+
+    // Maps the profile file at path, creating or resetting it if it is
+    // missing or from another version. An empty path keeps the profiles in
+    // memory only.
+    bool Open(const std::string& path);
+    bool is_open() const { return mapping_ != nullptr; }
+
+    bool Lookup(const std::string& route, RouteProfile* profile);
+
+    // Inserts or replaces the route's profile, evicting the least recently
+    // used route when all slots are taken
+    bool Store(const std::string& route, const RouteProfile& profile);
+
+private:
+    std::mutex mutex_;
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_ROUTE_PROFILE_CACHE_H_
@@ -0,0 +1,326 @@
+// Sample format conversion kernels for the APM JNI boundary
+//
+// The SIMD kernels mirror the scalar reference exactly: int16 -> float is an
+// exact multiplication by 2^-15, and float -> int16 saturates before (SSE2,
+// AVX2) or while (NEON, vqmovn) narrowing, then truncates toward zero.
+
+#include "sample_conversion.h"
+
+#include "rtc_base/system/arch.h"
+
+#if defined(WEBRTC_HAS_NEON)
+#include <arm_neon.h>
+#endif
+#if defined(WEBRTC_ARCH_X86_FAMILY)
+#include <emmintrin.h>
+#include <immintrin.h>
+#include "system_wrappers/include/cpu_features_wrapper.h"
+#endif
+
+namespace apm_jni {
+namespace {
+
+constexpr float kS16ToFloatScale = 1.0f / 32768.0f;
+constexpr float kFloatToS16Scale = 32768.0f;
+
+#if defined(WEBRTC_HAS_NEON)
+void S16ToFloatPlane_Neon(const int16_t* src, float* dst, size_t count) {
+    const float32x4_t scale = vdupq_n_f32(kS16ToFloatScale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t samples = vld1q_s16(src + i);
+        int32x4_t lo = vmovl_s16(vget_low_s16(samples));
+        int32x4_t hi = vmovl_s16(vget_high_s16(samples));
+        vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_s32(lo), scale));
+        vst1q_f32(dst + i + 4, vmulq_f32(vcvtq_f32_s32(hi), scale));
+    }
+    S16ToFloatPlane_Scalar(src + i, dst + i, count - i);
+}
+
+void FloatToS16Plane_Neon(const float* src, int16_t* dst, size_t count) {
+    const float32x4_t scale = vdupq_n_f32(kFloatToS16Scale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // vcvtq truncates toward zero and saturates to int32; vqmovn then
+        // saturates to int16, matching the scalar clamp.
+        int32x4_t lo = vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i), scale));
+        int32x4_t hi = vcvtq_s32_f32(vmulq_f32(vld1q_f32(src + i + 4), scale));
+        vst1q_s16(dst + i, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+    }
+    FloatToS16Plane_Scalar(src + i, dst + i, count - i);
+}
+
+void S16ToFloatStereo_Neon(const int16_t* src, float* left, float* right, size_t num_frames) {
+    const float32x4_t scale = vdupq_n_f32(kS16ToFloatScale);
+    size_t i = 0;
+    for (; i + 8 <= num_frames; i += 8) {
+        // vld2 deinterleaves while loading
+        int16x8x2_t samples = vld2q_s16(src + 2 * i);
+        float* planes[2] = {left, right};
+        for (int ch = 0; ch < 2; ch++) {
+            int32x4_t lo = vmovl_s16(vget_low_s16(samples.val[ch]));
+            int32x4_t hi = vmovl_s16(vget_high_s16(samples.val[ch]));
+            vst1q_f32(planes[ch] + i, vmulq_f32(vcvtq_f32_s32(lo), scale));
+            vst1q_f32(planes[ch] + i + 4, vmulq_f32(vcvtq_f32_s32(hi), scale));
+        }
+    }
+    S16ToFloatStereo_Scalar(src + 2 * i, left + i, right + i, num_frames - i);
+}
+
+void FloatToS16Stereo_Neon(const float* left, const float* right, int16_t* dst, size_t num_frames) {
+    const float32x4_t scale = vdupq_n_f32(kFloatToS16Scale);
+    size_t i = 0;
+    for (; i + 8 <= num_frames; i += 8) {
+        int16x8x2_t samples;
+        const float* planes[2] = {left, right};
+        for (int ch = 0; ch < 2; ch++) {
+            int32x4_t lo = vcvtq_s32_f32(vmulq_f32(vld1q_f32(planes[ch] + i), scale));
+            int32x4_t hi = vcvtq_s32_f32(vmulq_f32(vld1q_f32(planes[ch] + i + 4), scale));
+            samples.val[ch] = vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi));
+        }
+        // vst2 interleaves while storing
+        vst2q_s16(dst + 2 * i, samples);
+    }
+    FloatToS16Stereo_Scalar(left + i, right + i, dst + 2 * i, num_frames - i);
+}
+#endif  // defined(WEBRTC_HAS_NEON)
+
+#if defined(WEBRTC_ARCH_X86_FAMILY)
+void S16ToFloatPlane_Sse2(const int16_t* src, float* dst, size_t count) {
+    const __m128 scale = _mm_set1_ps(kS16ToFloatScale);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        // Sign-extend by placing each sample in the high half and shifting down
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+        _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+    S16ToFloatPlane_Scalar(src + i, dst + i, count - i);
+}
+
+void FloatToS16Plane_Sse2(const float* src, int16_t* dst, size_t count) {
+    const __m128 scale = _mm_set1_ps(kFloatToS16Scale);
+    const __m128 max_value = _mm_set1_ps(32767.0f);
+    const __m128 min_value = _mm_set1_ps(-32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // Clamp in float first: cvttps returns INT_MIN for out-of-range input
+        __m128 lo = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        __m128 hi = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+        lo = _mm_min_ps(_mm_max_ps(lo, min_value), max_value);
+        hi = _mm_min_ps(_mm_max_ps(hi, min_value), max_value);
+        __m128i packed = _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+    }
+    FloatToS16Plane_Scalar(src + i, dst + i, count - i);
+}
+
+void S16ToFloatStereo_Sse2(const int16_t* src, float* left, float* right, size_t num_frames) {
+    const __m128 scale = _mm_set1_ps(kS16ToFloatScale);
+    size_t i = 0;
+    for (; i + 4 <= num_frames; i += 4) {
+        // Each 32-bit lane holds one frame: left in the low half, right in
+        // the high half. Arithmetic shifts sign-extend either half.
+        __m128i frames = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+        __m128i l = _mm_srai_epi32(_mm_slli_epi32(frames, 16), 16);
+        __m128i r = _mm_srai_epi32(frames, 16);
+        _mm_storeu_ps(left + i, _mm_mul_ps(_mm_cvtepi32_ps(l), scale));
+        _mm_storeu_ps(right + i, _mm_mul_ps(_mm_cvtepi32_ps(r), scale));
+    }
+    S16ToFloatStereo_Scalar(src + 2 * i, left + i, right + i, num_frames - i);
+}
+
+void FloatToS16Stereo_Sse2(const float* left, const float* right, int16_t* dst, size_t num_frames) {
+    const __m128 scale = _mm_set1_ps(kFloatToS16Scale);
+    const __m128 max_value = _mm_set1_ps(32767.0f);
+    const __m128 min_value = _mm_set1_ps(-32768.0f);
+    size_t i = 0;
+    for (; i + 4 <= num_frames; i += 4) {
+        __m128 l = _mm_mul_ps(_mm_loadu_ps(left + i), scale);
+        __m128 r = _mm_mul_ps(_mm_loadu_ps(right + i), scale);
+        l = _mm_min_ps(_mm_max_ps(l, min_value), max_value);
+        r = _mm_min_ps(_mm_max_ps(r, min_value), max_value);
+        __m128i li = _mm_cvttps_epi32(l);
+        __m128i ri = _mm_cvttps_epi32(r);
+        // Interleave as int32, then narrow (values are already in range)
+        __m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(li, ri), _mm_unpackhi_epi32(li, ri));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), packed);
+    }
+    FloatToS16Stereo_Scalar(left + i, right + i, dst + 2 * i, num_frames - i);
+}
+
+__attribute__((target("avx2")))
+void S16ToFloatPlane_Avx2(const int16_t* src, float* dst, size_t count) {
+    const __m256 scale = _mm256_set1_ps(kS16ToFloatScale);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(lo)), scale));
+        _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(hi)), scale));
+    }
+    S16ToFloatPlane_Scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void FloatToS16Plane_Avx2(const float* src, int16_t* dst, size_t count) {
+    const __m256 scale = _mm256_set1_ps(kFloatToS16Scale);
+    const __m256 max_value = _mm256_set1_ps(32767.0f);
+    const __m256 min_value = _mm256_set1_ps(-32768.0f);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 lo = _mm256_mul_ps(_mm256_loadu_ps(src + i), scale);
+        __m256 hi = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale);
+        lo = _mm256_min_ps(_mm256_max_ps(lo, min_value), max_value);
+        hi = _mm256_min_ps(_mm256_max_ps(hi, min_value), max_value);
+        // packs works per 128-bit lane; restore sample order across lanes
+        __m256i packed = _mm256_packs_epi32(_mm256_cvttps_epi32(lo), _mm256_cvttps_epi32(hi));
+        packed = _mm256_permute4x64_epi64(packed, 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+    }
+    FloatToS16Plane_Scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+void S16ToFloatStereo_Avx2(const int16_t* src, float* left, float* right, size_t num_frames) {
+    const __m256 scale = _mm256_set1_ps(kS16ToFloatScale);
+    size_t i = 0;
+    for (; i + 8 <= num_frames; i += 8) {
+        __m256i frames = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i));
+        __m256i l = _mm256_srai_epi32(_mm256_slli_epi32(frames, 16), 16);
+        __m256i r = _mm256_srai_epi32(frames, 16);
+        _mm256_storeu_ps(left + i, _mm256_mul_ps(_mm256_cvtepi32_ps(l), scale));
+        _mm256_storeu_ps(right + i, _mm256_mul_ps(_mm256_cvtepi32_ps(r), scale));
+    }
+    S16ToFloatStereo_Scalar(src + 2 * i, left + i, right + i, num_frames - i);
+}
+
+__attribute__((target("avx2")))
+void FloatToS16Stereo_Avx2(const float* left, const float* right, int16_t* dst, size_t num_frames) {
+    const __m256 scale = _mm256_set1_ps(kFloatToS16Scale);
+    const __m256 max_value = _mm256_set1_ps(32767.0f);
+    const __m256 min_value = _mm256_set1_ps(-32768.0f);
+    size_t i = 0;
+    for (; i + 8 <= num_frames; i += 8) {
+        __m256 l = _mm256_mul_ps(_mm256_loadu_ps(left + i), scale);
+        __m256 r = _mm256_mul_ps(_mm256_loadu_ps(right + i), scale);
+        l = _mm256_min_ps(_mm256_max_ps(l, min_value), max_value);
+        r = _mm256_min_ps(_mm256_max_ps(r, min_value), max_value);
+        __m256i li = _mm256_cvttps_epi32(l);
+        __m256i ri = _mm256_cvttps_epi32(r);
+        // Unpack and pack both work per 128-bit lane, which keeps each
+        // lane's four frames together and in order
+        __m256i packed = _mm256_packs_epi32(_mm256_unpacklo_epi32(li, ri),
+                                            _mm256_unpackhi_epi32(li, ri));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 2 * i), packed);
+    }
+    FloatToS16Stereo_Scalar(left + i, right + i, dst + 2 * i, num_frames - i);
+}
+#endif  // defined(WEBRTC_ARCH_X86_FAMILY)
+
+// Runnable kernel sets, fastest first; the scalar reference is always last
+std::vector<ConversionKernels> RunnableKernels() {
+    std::vector<ConversionKernels> kernels;
+#if defined(WEBRTC_HAS_NEON)
+    kernels.push_back({S16ToFloatPlane_Neon, FloatToS16Plane_Neon,
+                       S16ToFloatStereo_Neon, FloatToS16Stereo_Neon, "neon"});
+#elif defined(WEBRTC_ARCH_X86_FAMILY)
+    if (webrtc::GetCPUInfo(webrtc::kAVX2) != 0) {
+        kernels.push_back({S16ToFloatPlane_Avx2, FloatToS16Plane_Avx2,
+                           S16ToFloatStereo_Avx2, FloatToS16Stereo_Avx2, "avx2"});
+    }
+    kernels.push_back({S16ToFloatPlane_Sse2, FloatToS16Plane_Sse2,
+                       S16ToFloatStereo_Sse2, FloatToS16Stereo_Sse2, "sse2"});
+#endif
+    kernels.push_back({S16ToFloatPlane_Scalar, FloatToS16Plane_Scalar,
+                       S16ToFloatStereo_Scalar, FloatToS16Stereo_Scalar, "scalar"});
+    return kernels;
+}
+
+const ConversionKernels& Kernels() {
+    static const ConversionKernels kernels = RunnableKernels().front();
+    return kernels;
+}
+
+}  // namespace
+
+void S16ToFloatPlane_Scalar(const int16_t* src, float* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = static_cast<float>(src[i]) * kS16ToFloatScale;
+    }
+}
+
+void FloatToS16Plane_Scalar(const float* src, int16_t* dst, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        float sample = src[i] * kFloatToS16Scale;
+        if (sample > 32767.0f) sample = 32767.0f;
+        if (sample < -32768.0f) sample = -32768.0f;
+        dst[i] = static_cast<int16_t>(sample);
+    }
+}
+
+void S16ToFloatStereo_Scalar(const int16_t* src, float* left, float* right, size_t num_frames) {
+    for (size_t i = 0; i < num_frames; i++) {
+        left[i] = static_cast<float>(src[2 * i]) * kS16ToFloatScale;
+        right[i] = static_cast<float>(src[2 * i + 1]) * kS16ToFloatScale;
+    }
+}
+
+void FloatToS16Stereo_Scalar(const float* left, const float* right, int16_t* dst, size_t num_frames) {
+    for (size_t i = 0; i < num_frames; i++) {
+        FloatToS16Plane_Scalar(&left[i], &dst[2 * i], 1);
+        FloatToS16Plane_Scalar(&right[i], &dst[2 * i + 1], 1);
+    }
+}
+
+void S16ToFloatPlane(const int16_t* src, float* dst, size_t count) {
+    Kernels().s16_to_float(src, dst, count);
+}
+
+void FloatToS16Plane(const float* src, int16_t* dst, size_t count) {
+    Kernels().float_to_s16(src, dst, count);
+}
+
+void S16ToFloat(const int16_t* src, float* const* dst, size_t num_frames, size_t num_channels) {
+    if (num_channels == 1) {
+        S16ToFloatPlane(src, dst[0], num_frames);
+        return;
+    }
+    if (num_channels == 2) {
+        Kernels().s16_to_float_stereo(src, dst[0], dst[1], num_frames);
+        return;
+    }
+    for (size_t i = 0; i < num_frames; i++) {
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            dst[ch][i] = static_cast<float>(src[i * num_channels + ch]) * kS16ToFloatScale;
+        }
+    }
+}
+
+void FloatToS16(const float* const* src, int16_t* dst, size_t num_frames, size_t num_channels) {
+    if (num_channels == 1) {
+        FloatToS16Plane(src[0], dst, num_frames);
+        return;
+    }
+    if (num_channels == 2) {
+        Kernels().float_to_s16_stereo(src[0], src[1], dst, num_frames);
+        return;
+    }
+    for (size_t i = 0; i < num_frames; i++) {
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            FloatToS16Plane_Scalar(&src[ch][i], &dst[i * num_channels + ch], 1);
+        }
+    }
+}
+
+const char* ConversionBackend() {
+    return Kernels().name;
+}
+
+std::vector<ConversionKernels> SupportedConversionKernels() {
+    return RunnableKernels();
+}
+
+}  // namespace apm_jni
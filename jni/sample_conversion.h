@@ -0,0 +1,58 @@
+// Sample format conversion kernels for the APM JNI boundary
+//
+// Converts between the interleaved int16 audio exchanged with Java and the
+// normalized float channel planes WebRTC M120 processes. NEON (arm64/armv7),
+// SSE2 and AVX2 (x86 host builds) kernels are bit-exact with the portable
+// scalar reference. On x86 the fastest set the CPU supports is selected once
+// at runtime. NEON is selected at compile time (WEBRTC_HAS_NEON; it is
+// mandatory on arm64), so an arm build contains no other SIMD set.
+//
+// benchmark/sample_conversion_test.cpp checks every set this build can run
+// against the scalar reference. The CI host job runs it on x86 (SSE2, AVX2);
+// the NEON kernels are only exercised when it is built for arm and run on a
+// device.
+
+#ifndef APM_JNI_SAMPLE_CONVERSION_H_
+#define APM_JNI_SAMPLE_CONVERSION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace apm_jni {
+
+// Plane kernels: int16 <-> float in [-1.0, 1.0). FloatToS16Plane scales by
+// 32768, saturates to [-32768, 32767] and truncates toward zero.
+void S16ToFloatPlane(const int16_t* src, float* dst, size_t count);
+void FloatToS16Plane(const float* src, int16_t* dst, size_t count);
+
+// Interleaved int16 frame <-> deinterleaved float channel planes. Mono and
+// stereo convert and (de)interleave in one vectorized pass.
+void S16ToFloat(const int16_t* src, float* const* dst, size_t num_frames, size_t num_channels);
+void FloatToS16(const float* const* src, int16_t* dst, size_t num_frames, size_t num_channels);
+
+// Portable scalar reference kernels, always available
+void S16ToFloatPlane_Scalar(const int16_t* src, float* dst, size_t count);
+void FloatToS16Plane_Scalar(const float* src, int16_t* dst, size_t count);
+void S16ToFloatStereo_Scalar(const int16_t* src, float* left, float* right, size_t num_frames);
+void FloatToS16Stereo_Scalar(const float* left, const float* right, int16_t* dst, size_t num_frames);
+
+// Name of the kernel set selected at runtime ("neon", "avx2", "sse2", "scalar")
+const char* ConversionBackend();
+
+// One kernel set: mono planes and interleaved stereo, both directions
+struct ConversionKernels {
+    void (*s16_to_float)(const int16_t* src, float* dst, size_t count);
+    void (*float_to_s16)(const float* src, int16_t* dst, size_t count);
+    void (*s16_to_float_stereo)(const int16_t* src, float* left, float* right, size_t num_frames);
+    void (*float_to_s16_stereo)(const float* left, const float* right, int16_t* dst, size_t num_frames);
+    const char* name;
+};
+
+// Every kernel set compiled in that this CPU can run, the selected one
+// first and the scalar reference last
+std::vector<ConversionKernels> SupportedConversionKernels();
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_SAMPLE_CONVERSION_H_
@@ -0,0 +1,305 @@
+// Multi-session processing engine for the APM JNI wrapper
+// See session_engine.h for the model.
+
+#include "session_engine.h"
+
+#include <android/log.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#define LOG_TAG "WebRTC-APM"
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+
+namespace apm_jni {
+
+namespace {
+
+// ANDROID_PRIORITY_URGENT_AUDIO, as used for the platform's audio threads
+constexpr int kWorkerPriority = -19;
+
+// Capture frames a worker runs per turn before requeueing the session, so
+// one busy session cannot hold a worker while others wait
+constexpr int kFramesPerTurn = 4;
+
+// Session ids carry a process-wide serial above the slot index, so an id
+// from a removed session (or a stopped engine) never matches a new one
+constexpr int kSlotBits = 6;
+static_assert((1 << kSlotBits) == SessionEngine::kMaxSessions, "slot bits cover the session table");
+std::atomic<uint32_t> g_next_serial{1};
+
+}  // namespace
+
+struct SessionEngine::Session {
+    Session(int id_, CaptureFn capture_, RenderFn render_, size_t frame_samples_,
+            size_t render_frame_samples_, size_t queue_frames, int home_)
+        : id(id_), home(home_), frame_samples(frame_samples_),
+          render_frame_samples(render_frame_samples_),
+          capture(std::move(capture_)), render(std::move(render_)),
+          render_in(queue_frames, render_frame_samples_), capture_in(queue_frames, frame_samples_),
+          capture_out(queue_frames, frame_samples_), frame(frame_samples_) {}
+
+    const int id;
+    const int home;
+    const size_t frame_samples;
+    const size_t render_frame_samples;
+    const CaptureFn capture;
+    const RenderFn render;
+
+    RenderFrameQueue render_in;
+    RenderFrameQueue capture_in;
+    RenderFrameQueue capture_out;
+
+    // Worker-side copy of the frame being processed
+    std::vector<int16_t> frame;
+
+    // Set while the session is queued or running; whoever sets it owns the
+    // session's worker side
+    std::atomic<bool> scheduled{false};
+};
+
+SessionEngine::SessionEngine(int num_workers, size_t max_frame_samples)
+    : max_frame_samples_(max_frame_samples) {
+    for (std::atomic<Session*>& session : sessions_) session.store(nullptr, std::memory_order_relaxed);
+
+    num_workers = std::min(std::max(num_workers, 1), kMaxWorkers);
+    for (int i = 0; i < num_workers; i++) workers_.push_back(std::make_unique<Worker>());
+    for (int i = 0; i < num_workers; i++) {
+        workers_[i]->thread = std::thread(&SessionEngine::Run, this, i);
+    }
+}
+
+SessionEngine::~SessionEngine() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        stop_ = true;
+    }
+    work_available_.notify_all();
+    for (std::unique_ptr<Worker>& worker : workers_) worker->thread.join();
+
+    for (std::atomic<Session*>& session : sessions_) delete session.load(std::memory_order_relaxed);
+}
+
+int SessionEngine::AddSession(CaptureFn capture, RenderFn render, size_t frame_samples,
+                              size_t render_frame_samples, size_t queue_frames) {
+    if (frame_samples == 0 || frame_samples > max_frame_samples_) return -1;
+    if (render_frame_samples == 0 || render_frame_samples > max_frame_samples_) return -1;
+
+    std::lock_guard<std::mutex> lock(sessions_mutex_);
+    for (int slot = 0; slot < kMaxSessions; slot++) {
+        if (sessions_[slot].load(std::memory_order_relaxed)) continue;
+
+        const uint32_t serial = g_next_serial.fetch_add(1, std::memory_order_relaxed) & 0xffffff;
+        const int id = static_cast<int>(serial << kSlotBits) | slot;
+        Session* session = new Session(id, std::move(capture), std::move(render), frame_samples,
+                                       render_frame_samples, queue_frames, slot % num_workers());
+        sessions_[slot].store(session, std::memory_order_release);
+        return id;
+    }
+    return -1;
+}
+
+bool SessionEngine::RemoveSession(int id) {
+    Session* session;
+    {
+        std::lock_guard<std::mutex> lock(sessions_mutex_);
+        session = Find(id);
+        if (!session) return false;
+        sessions_[id & (kMaxSessions - 1)].store(nullptr, std::memory_order_release);
+    }
+
+    // A queued turn is dropped. A running one is waited out; its worker may
+    // requeue the session on the way out, so drop again after each turn.
+    // Once the session is neither queued nor running under the lock, only
+    // its (stopped) submitters could schedule it again.
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        turn_done_.wait(lock, [this, session] {
+            Unqueue(session);
+            for (const std::unique_ptr<Worker>& worker : workers_) {
+                if (worker->running == session) return false;
+            }
+            return true;
+        });
+    }
+    delete session;
+    return true;
+}
+
+SessionEngine::Session* SessionEngine::Find(int id) const {
+    if (id < 0) return nullptr;
+    Session* session = sessions_[id & (kMaxSessions - 1)].load(std::memory_order_acquire);
+    return session && session->id == id ? session : nullptr;
+}
+
+size_t SessionEngine::FrameSamples(int id) const {
+    Session* session = Find(id);
+    return session ? session->frame_samples : 0;
+}
+
+size_t SessionEngine::RenderFrameSamples(int id) const {
+    Session* session = Find(id);
+    return session ? session->render_frame_samples : 0;
+}
+
+bool SessionEngine::SubmitRender(int id, const int16_t* samples, size_t num_samples) {
+    Session* session = Find(id);
+    if (!session || num_samples != session->render_frame_samples) return false;
+    if (session->render_in.Push(samples, num_samples)) return true;
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool SessionEngine::SubmitCapture(int id, const int16_t* samples, size_t num_samples) {
+    Session* session = Find(id);
+    if (!session || num_samples != session->frame_samples) return false;
+    if (!session->capture_in.Push(samples, num_samples)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Pairs with the fence in RunTurn: either the worker finishing a turn
+    // sees this frame, or this sees the flag cleared and schedules
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!session->scheduled.exchange(true, std::memory_order_acq_rel)) Schedule(session);
+    return true;
+}
+
+bool SessionEngine::ReceiveCapture(int id, int16_t* samples, size_t max_samples) {
+    Session* session = Find(id);
+    if (!session) return false;
+    size_t num_samples = 0;
+    const int16_t* frame = session->capture_out.Front(&num_samples);
+    if (!frame || num_samples > max_samples) return false;
+    memcpy(samples, frame, num_samples * sizeof(int16_t));
+    session->capture_out.Pop();
+    return true;
+}
+
+SessionEngine::Stats SessionEngine::stats() const {
+    Stats stats;
+    stats.workers = num_workers();
+    for (const std::atomic<Session*>& session : sessions_) {
+        stats.sessions += session.load(std::memory_order_relaxed) != nullptr;
+    }
+    stats.frames = frames_.load(std::memory_order_relaxed);
+    stats.turns = turns_.load(std::memory_order_relaxed);
+    stats.steals = steals_.load(std::memory_order_relaxed);
+    stats.dropped = dropped_.load(std::memory_order_relaxed);
+    stats.errors = errors_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void SessionEngine::Schedule(Session* session) {
+    Worker& worker = *workers_[session->home];
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        worker.queue[(worker.head + worker.count) % kMaxSessions] = session;
+        worker.count++;
+    }
+    work_available_.notify_one();
+}
+
+// Own queue first, oldest first; then the newest session queued on another
+// worker, which the owner is least likely to reach soon
+SessionEngine::Session* SessionEngine::TakeWork(int worker) {
+    Worker& own = *workers_[worker];
+    if (own.count > 0) {
+        Session* session = own.queue[own.head];
+        own.head = (own.head + 1) % kMaxSessions;
+        own.count--;
+        return session;
+    }
+    for (size_t i = 1; i < workers_.size(); i++) {
+        Worker& victim = *workers_[(worker + i) % workers_.size()];
+        if (victim.count > 0) {
+            victim.count--;
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return victim.queue[(victim.head + victim.count) % kMaxSessions];
+        }
+    }
+    return nullptr;
+}
+
+// Removes the session from its home queue (the only one it is ever queued
+// on) and reports whether it was there
+bool SessionEngine::Unqueue(Session* session) {
+    Worker& worker = *workers_[session->home];
+    for (size_t i = 0; i < worker.count; i++) {
+        if (worker.queue[(worker.head + i) % kMaxSessions] != session) continue;
+        for (; i + 1 < worker.count; i++) {
+            worker.queue[(worker.head + i) % kMaxSessions] =
+                worker.queue[(worker.head + i + 1) % kMaxSessions];
+        }
+        worker.count--;
+        return true;
+    }
+    return false;
+}
+
+void SessionEngine::RunTurn(Session* session) {
+    turns_.fetch_add(1, std::memory_order_relaxed);
+
+    for (int i = 0; i < kFramesPerTurn; i++) {
+        size_t num_samples = 0;
+        const int16_t* capture = session->capture_in.Front(&num_samples);
+        if (!capture) break;
+
+        // Every far-end frame queued so far goes first, including any
+        // submitted after this capture frame. That can only move far-end
+        // audio earlier relative to capture, which AEC3 tolerates; late
+        // far-end audio would not be.
+        size_t render_samples = 0;
+        while (const int16_t* render = session->render_in.Front(&render_samples)) {
+            if (session->render(render, render_samples) != 0) {
+                errors_.fetch_add(1, std::memory_order_relaxed);
+            }
+            session->render_in.Pop();
+        }
+
+        memcpy(session->frame.data(), capture, num_samples * sizeof(int16_t));
+        session->capture_in.Pop();
+        if (session->capture(session->frame.data(), num_samples) != 0) {
+            errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+        frames_.fetch_add(1, std::memory_order_relaxed);
+        if (!session->capture_out.Push(session->frame.data(), num_samples)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Give the session up, then look again for frames submitted meanwhile
+    // (see SubmitCapture)
+    session->scheduled.store(false, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    size_t num_samples = 0;
+    if (session->capture_in.Front(&num_samples) &&
+        !session->scheduled.exchange(true, std::memory_order_acq_rel)) {
+        Schedule(session);
+    }
+}
+
+void SessionEngine::Run(int worker) {
+    if (setpriority(PRIO_PROCESS, 0, kWorkerPriority) != 0) {
+        LOGD("Session engine worker keeps default priority: %s", strerror(errno));
+    }
+
+    Worker& self = *workers_[worker];
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    while (true) {
+        Session* session = nullptr;
+        work_available_.wait(lock, [&] { return stop_ || (session = TakeWork(worker)); });
+        if (stop_) break;
+
+        self.running = session;
+        lock.unlock();
+        RunTurn(session);
+        lock.lock();
+        self.running = nullptr;
+        turn_done_.notify_all();
+    }
+}
+
+}  // namespace apm_jni
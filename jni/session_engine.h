@@ -0,0 +1,140 @@
+// Multi-session processing engine for the APM JNI wrapper
+//
+// A conferencing gateway runs one APM instance per participant. If every
+// leg drives its own instance from its own thread, the thread count grows
+// with the call and so do the context switches. The engine instead runs
+// all registered sessions on a few worker threads, one per core.
+//
+// Each session has lock-free single-producer/single-consumer rings (see
+// render_queue.h): far-end frames and capture frames in, processed capture
+// frames out. Submitting a capture frame schedules the session on its home
+// worker unless it is already scheduled. A session is therefore processed
+// by at most one worker at a time, and its frames stay in order. A worker
+// runs a few of a session's frames per turn, each after the far-end frames
+// queued before it. Idle workers steal sessions from busy workers' run
+// queues, so throughput follows the number of cores, not of legs.
+
+#ifndef APM_JNI_SESSION_ENGINE_H_
+#define APM_JNI_SESSION_ENGINE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "render_queue.h"
+
+namespace apm_jni {
+
+class SessionEngine {
+public:
+    // Process one interleaved int16 frame and return an AudioProcessing
+    // status. Only ever called from a worker, never concurrently for one
+    // session.
+    using CaptureFn = std::function<int(int16_t* samples, size_t num_samples)>;
+    using RenderFn = std::function<int(const int16_t* samples, size_t num_samples)>;
+
+    static constexpr int kMaxSessions = 64;
+    static constexpr int kMaxWorkers = 16;
+
+    struct Stats {
+        int workers = 0;
+        int sessions = 0;
+        uint64_t frames = 0;   // capture frames processed
+        uint64_t turns = 0;    // times a worker picked up a session
+        uint64_t steals = 0;   // turns taken from another worker's queue
+        uint64_t dropped = 0;  // frames dropped on a full queue
+        uint64_t errors = 0;   // frames whose processing returned an error
+    };
+
+    // num_workers is clamped to 1..kMaxWorkers
+    SessionEngine(int num_workers, size_t max_frame_samples);
+    ~SessionEngine();
+
+    SessionEngine(const SessionEngine&) = delete;
+    SessionEngine& operator=(const SessionEngine&) = delete;
+
+    // Registers a session whose capture frames have frame_samples samples
+    // and far-end frames render_frame_samples, with queues of queue_frames
+    // frames. Returns its id (ids are never reused within a process), or -1
+    // if the engine is full.
+    int AddSession(CaptureFn capture, RenderFn render, size_t frame_samples,
+                   size_t render_frame_samples, size_t queue_frames);
+
+    // Unregisters a session, dropping a queued turn and blocking until a
+    // running one has finished. Its submitters and receiver must have
+    // stopped. False if there is no such session.
+    bool RemoveSession(int id);
+
+    // Capture and far-end frame sizes of a session, or 0 if there is no
+    // such session
+    size_t FrameSamples(int id) const;
+    size_t RenderFrameSamples(int id) const;
+
+    // One thread per direction per session. False if the queue is full (the
+    // frame is dropped) or the frame is not of the session's size.
+    bool SubmitRender(int id, const int16_t* samples, size_t num_samples);
+    bool SubmitCapture(int id, const int16_t* samples, size_t num_samples);
+
+    // One thread per session. Copies out the oldest processed capture frame;
+    // false if there is none yet.
+    bool ReceiveCapture(int id, int16_t* samples, size_t max_samples);
+
+    Stats stats() const;
+    int num_workers() const { return static_cast<int>(workers_.size()); }
+
+private:
+    struct Session;
+
+    // Sessions waiting for a turn. Each session is queued at most once, so
+    // a fixed ring of kMaxSessions entries never overflows. Guarded by
+    // queue_mutex_.
+    struct Worker {
+        Session* queue[kMaxSessions];
+        size_t head = 0;
+        size_t count = 0;
+        // Session the worker is on, until it is done touching it, so removal
+        // can wait it out
+        Session* running = nullptr;
+        std::thread thread;
+    };
+
+    Session* Find(int id) const;
+    void Schedule(Session* session);
+    // Both with queue_mutex_ held
+    Session* TakeWork(int worker);
+    bool Unqueue(Session* session);
+    void RunTurn(Session* session);
+    void Run(int worker);
+
+    const size_t max_frame_samples_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+
+    // Control calls (add/remove) are serialized; lookups are lock-free
+    std::mutex sessions_mutex_;
+    std::atomic<Session*> sessions_[kMaxSessions];
+
+    // All run queues share one lock: it is held only to push or pop a
+    // pointer, and a single lock lets a worker see every queue at once, so
+    // it either finds work or sleeps on work_available_. turn_done_ is
+    // signalled whenever a worker finishes a turn.
+    std::mutex queue_mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable turn_done_;
+    bool stop_ = false;
+
+    std::atomic<uint64_t> frames_{0};
+    std::atomic<uint64_t> turns_{0};
+    std::atomic<uint64_t> steals_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> errors_{0};
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_SESSION_ENGINE_H_
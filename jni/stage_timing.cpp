@@ -0,0 +1,38 @@
+// Per-stage hot path timing for the APM JNI wrapper
+// See stage_timing.h.
+
+#include "stage_timing.h"
+
+#include <algorithm>
+
+namespace apm_jni {
+
+// Finer at the low end, where most stages sit, up to 3x the 10 ms budget
+const int32_t StageTimings::kBucketUpperUs[kNumBuckets - 1] = {
+    25, 50, 75, 100, 150, 200, 300, 400, 500, 750, 1000, 1500,
+    2000, 3000, 4000, 5000, 6000, 8000, 10000, 12500, 15000, 20000, 30000,
+};
+
+StageTimings::StageTimings() {
+    for (auto& stage : counts_) {
+        for (auto& count : stage) count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void StageTimings::Record(Stage stage, int64_t duration_us) {
+    const int32_t* end = kBucketUpperUs + kNumBuckets - 1;
+    const size_t bucket = std::lower_bound(kBucketUpperUs, end, duration_us) - kBucketUpperUs;
+    counts_[stage][bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void StageTimings::Read(uint32_t* counts, bool reset) {
+    for (size_t stage = 0; stage < kNumStages; stage++) {
+        for (size_t bucket = 0; bucket < kNumBuckets; bucket++) {
+            std::atomic<uint32_t>& count = counts_[stage][bucket];
+            *counts++ = reset ? count.exchange(0, std::memory_order_relaxed)
+                              : count.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+}  // namespace apm_jni
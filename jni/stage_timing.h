@@ -0,0 +1,95 @@
+// Per-stage hot path timing for the APM JNI wrapper
+//
+// Always compiled, switched at runtime. Each stage of the capture and render
+// paths the wrapper can see gets a fixed-bucket histogram of its wall time.
+// This includes the AEC3 calls APM makes into the echo control. Recording is
+// one monotonic clock read on each side and one relaxed atomic increment, so
+// it is safe on the audio threads. When disabled it costs one relaxed load.
+//
+// The finest grain is the EchoControl interface. BlockProcessor, the echo
+// remover and APM's own submodules (HPF, NS, AGC) run inside the prebuilt
+// WebRTC library with no hook between them, so they only show up as part of
+// kAec3ProcessCapture or of what kCaptureApm leaves over.
+
+#ifndef APM_JNI_STAGE_TIMING_H_
+#define APM_JNI_STAGE_TIMING_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace apm_jni {
+
+class StageTimings {
+public:
+    // Order is part of the JNI contract (see docs/NATIVE_API.md)
+    enum Stage {
+        kCaptureFrame,         // whole per-frame capture call
+        kCaptureConvertIn,     // int16 -> float
+        kRenderQueueDrain,     // queued render frames run before capture
+        kDelayEstimation,      // wrapper delay estimator, capture side
+        kCaptureApm,           // ProcessStream (first stage when pipelined)
+        kAec3AnalyzeCapture,   // EchoControl::AnalyzeCapture inside APM
+        kAec3ProcessCapture,   // EchoControl::ProcessCapture, shadow included
+        kPostApm,              // pipelined second stage (NS, AGC), on the worker
+        kCaptureConvertOut,    // float -> int16
+        kRenderFrame,          // whole per-frame render call
+        kRenderApm,            // AnalyzeReverseStream
+        kAec3AnalyzeRender,    // EchoControl::AnalyzeRender inside APM
+        kNumStages
+    };
+
+    // Bucket i counts durations up to kBucketUpperUs[i]; the last bucket is
+    // open-ended
+    static constexpr size_t kNumBuckets = 24;
+    static const int32_t kBucketUpperUs[kNumBuckets - 1];
+
+    StageTimings();
+
+    StageTimings(const StageTimings&) = delete;
+    StageTimings& operator=(const StageTimings&) = delete;
+
+    void SetEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void Record(Stage stage, int64_t duration_us);
+
+    // Copies kNumStages * kNumBuckets counts, stage-major, optionally
+    // clearing them. Counts recorded during the copy may land either side.
+    void Read(uint32_t* counts, bool reset);
+
+    static int64_t NowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    std::atomic<bool> enabled_{false};
+    std::atomic<uint32_t> counts_[kNumStages][kNumBuckets];
+};
+
+// Times the enclosing scope into one stage; no-op if timings is null or off
+class ScopedStageTimer {
+public:
+    ScopedStageTimer(StageTimings* timings, StageTimings::Stage stage)
+        : timings_(timings && timings->enabled() ? timings : nullptr),
+          stage_(stage),
+          start_us_(timings_ ? StageTimings::NowUs() : 0) {}
+
+    ~ScopedStageTimer() {
+        if (timings_) timings_->Record(stage_, StageTimings::NowUs() - start_us_);
+    }
+
+    ScopedStageTimer(const ScopedStageTimer&) = delete;
+    ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+    StageTimings* const timings_;
+    const StageTimings::Stage stage_;
+    const int64_t start_us_;
+};
+
+}  // namespace apm_jni
+
+#endif  // APM_JNI_STAGE_TIMING_H_
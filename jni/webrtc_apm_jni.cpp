@@ -8,15 +8,34 @@
 
 #include <jni.h>
 #include <android/log.h>
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <cstdint>
 #include <cstring>
+#include <vector>
 
 // WebRTC M120 headers
 #include "modules/audio_processing/include/audio_processing.h"
 #include "rtc_base/ref_counted_object.h"
 #include "common_audio/resampler/include/resampler.h"
 #include "api/audio/echo_canceller3_config.h"
-#include "api/audio/echo_canceller3_factory.h"
+
+#include "adaptive_echo_control.h"
+#include "background_worker.h"
+#include "capture_pipeline.h"
+#include "deadline_governor.h"
+#include "delay_estimator.h"
+#include "device_resampler.h"
+#include "instance_arena.h"
+#include "instance_pool.h"
+#include "render_queue.h"
+#include "route_profile_cache.h"
+#include "sample_conversion.h"
+#include "session_engine.h"
+#include "stage_timing.h"
 
 #define LOG_TAG "WebRTC-APM"
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
@@ -25,44 +44,379 @@
 
 using namespace webrtc;
 
+// Upper bound on frames per ProcessInterleavedBatch call (320 ms), which
+// bounds the staging buffers sized with every stream format
+static const int kMaxBatchFrames = 32;
+
+// Float conversion buffer for one 10 ms frame, deinterleaved into one plane
+// per channel. Sized once per stream format so processing never allocates.
+struct FrameBuffer {
+    std::vector<float> samples;
+    std::vector<float*> channels;
+
+    void Resize(size_t num_frames, size_t num_channels) {
+        samples.assign(num_frames * num_channels, 0.0f);
+        channels.resize(num_channels);
+        for (size_t ch = 0; ch < num_channels; ch++) {
+            channels[ch] = samples.data() + ch * num_frames;
+        }
+    }
+};
+
+struct ApmContext;
+
+// Where far-end frames go (ApmContext::render_queue_state). Stopping keeps
+// them queued until the capture thread has run what is already queued.
+enum RenderQueueState {
+    kRenderDirect = 0,
+    kRenderQueued,
+    kRenderQueueStopping,
+};
+
+// Applies the deadline governor tier the capture thread last asked for, on
+// the background worker (see ApplyGovernorTier)
+struct GovernorTierTask : apm_jni::BackgroundTask {
+    ApmContext* ctx = nullptr;
+    void Run() override;
+};
+
 // Context structure to hold APM instance and configuration
 struct ApmContext {
+    // Arena the APM was built in (null unless arena allocation is on).
+    // Declared first so it is released after everything built in it.
+    std::unique_ptr<apm_jni::InstanceArena> apm_arena;
+
     rtc::scoped_refptr<AudioProcessing> apm;
     std::unique_ptr<Resampler> resampler;
 
+    // Per-stage timing histograms, shared with the echo control and the
+    // pipeline worker
+    std::shared_ptr<apm_jni::StageTimings> timings = std::make_shared<apm_jni::StageTimings>();
+
+    // Pipelined capture (null when off): the second stage runs noise
+    // suppression, gain control and the transient suppressor in post_apm on
+    // the pipeline's worker, on AEC3 output relayed from the first stage.
+    // Declared first so the worker is joined before post_apm is released.
+    rtc::scoped_refptr<AudioProcessing> post_apm;
+    std::unique_ptr<apm_jni::CapturePipeline> pipeline;
+
+    // Deadline governor, created on first enable and kept until the context
+    // is recycled. The capture thread never takes config_mutex: it stores
+    // the tier it wants in governor_target_tier and posts governor_task.
+    // While a degraded tier runs, requested_config holds the APM config as
+    // the app last set it.
+    std::unique_ptr<apm_jni::DeadlineGovernor> governor;
+    std::atomic<bool> governed{false};
+    std::atomic<int> governor_target_tier{0};
+    GovernorTierTask governor_task;
+    std::mutex config_mutex;
+    int governor_tier = 0;
+    AudioProcessing::Config requested_config;
+
+    // Reconfiguration handle for the AEC3 echo control (null if AEC3 is off)
+    std::shared_ptr<apm_jni::EchoControlHandle> echo_control;
+
+    // Wrapper-side delay estimation, created on first enable and kept until
+    // the context is recycled. The flag is published after the estimator so
+    // the stream threads never see it half constructed.
+    std::unique_ptr<apm_jni::CoarseToFineDelayEstimator> delay_estimator;
+    std::atomic<bool> delay_estimation{false};
+    std::atomic<int> published_delay_ms{-1};
+
+    // Far-end frames handed from the playback thread to the capture thread
+    // (see render_queue.h). Created at full size on first enable and kept
+    // until the context is recycled, so a playback thread inside Push()
+    // never sees it freed: enabling, resizing and disabling only change the
+    // state and the queue's limit. The capture thread drains it from then
+    // on whenever render_queue_live is set.
+    std::unique_ptr<apm_jni::RenderFrameQueue> render_queue;
+    std::atomic<bool> render_queue_live{false};
+    std::atomic<int> render_queue_state{kRenderDirect};
+
+    // Session engine registration, -1 while not registered
+    int engine_session = -1;
+
+    // Per-route AEC3 profiles (opened on demand) and the route in use
+    std::unique_ptr<apm_jni::RouteProfileCache> route_profiles;
+    std::string route;
+
+    // delay.num_filters as tuned at creation, by delay compensation or by a
+    // route profile. Delay estimation and warm starts widen the running
+    // config beyond it; profiles store this one.
+    size_t tuned_num_filters = 0;
+
+    // How the instance was built, restored when it is recycled (see
+    // RecycleContext). pool_key identifies the build in the instance pool.
+    uint64_t pool_key = 0;
+    AudioProcessing::Config initial_config;
+    EchoCanceller3Config initial_aec3_config;
+
     // Audio configuration
     int sample_rate_hz = 16000;
     int num_channels = 1;
+    int num_render_channels = 1;
 
-    // Stream configuration
+    // Stream configuration. The far-end stream shares the sample rate but
+    // may carry more channels than the microphone (see SetRenderFormat).
     StreamConfig input_config;
     StreamConfig output_config;
+    StreamConfig render_config;
+
+    // Render and capture are called from different threads, so each
+    // direction owns its conversion buffer.
+    FrameBuffer capture_buffer;
+    FrameBuffer render_buffer;
+
+    // Device-rate conversion for the *AtDeviceRate calls (0 and null until
+    // nativeSetDeviceRate). Rebuilt on every stream format change.
+    int device_rate_hz = 0;
+    std::unique_ptr<apm_jni::DeviceResampler> capture_resampler;
+    std::unique_ptr<apm_jni::DeviceResampler> render_resampler;
+
+    // Int16 staging for ProcessInterleavedBatch, sized for kMaxBatchFrames
+    // frames of the current format so a batch call never allocates
+    std::vector<int16_t> batch_render;
+    std::vector<int16_t> batch_capture;
+    std::vector<jint> batch_status;
 
     ApmContext() {
+        governor_task.ctx = this;
+        SetStreamFormat(sample_rate_hz, num_channels, num_render_channels);
+    }
+
+    ~ApmContext() {
+        // A tier change may still be queued on the worker
+        if (governor) apm_jni::BackgroundWorker::Get().Wait(&governor_task);
+    }
+
+    void SetStreamFormat(int rate_hz, int channels, int render_channels) {
+        sample_rate_hz = rate_hz;
+        num_channels = channels;
+        num_render_channels = render_channels;
         input_config = StreamConfig(sample_rate_hz, num_channels);
         output_config = StreamConfig(sample_rate_hz, num_channels);
+        render_config = StreamConfig(sample_rate_hz, num_render_channels);
+        capture_buffer.Resize(input_config.num_frames(), num_channels);
+        render_buffer.Resize(render_config.num_frames(), num_render_channels);
+        batch_capture.resize(kMaxBatchFrames * input_config.num_samples());
+        batch_render.resize(kMaxBatchFrames * render_config.num_samples());
+        batch_status.resize(2 * kMaxBatchFrames);
+        if (device_rate_hz > 0) SetDeviceRate(device_rate_hz);
+    }
+
+    // 0 turns device-rate processing off
+    void SetDeviceRate(int rate_hz) {
+        device_rate_hz = rate_hz;
+        if (rate_hz == 0) {
+            capture_resampler.reset();
+            render_resampler.reset();
+            return;
+        }
+        capture_resampler = std::make_unique<apm_jni::DeviceResampler>(
+            rate_hz, sample_rate_hz, num_channels, true);
+        render_resampler = std::make_unique<apm_jni::DeviceResampler>(
+            rate_hz, sample_rate_hz, num_render_channels, false);
+    }
+
+    // Interleaved int16 samples in one 10 ms capture frame
+    int frame_samples() const {
+        return static_cast<int>(input_config.num_samples());
+    }
+
+    // Interleaved int16 samples in one 10 ms far-end frame
+    int render_frame_samples() const {
+        return static_cast<int>(render_config.num_samples());
     }
 };
 
+// JNI lookups cached once in JNI_OnLoad, so the per-frame path does no
+// reflection. The class global ref keeps the cached field ID valid. Falls back
+// to a per-call lookup if the class could not be resolved at load time.
+static jclass g_apm_class = nullptr;
+static jfieldID g_obj_data_field = nullptr;
+
+static jfieldID GetObjDataField(JNIEnv* env, jobject thiz) {
+    if (g_obj_data_field) return g_obj_data_field;
+    jclass cls = env->GetObjectClass(thiz);
+    return env->GetFieldID(cls, "objData", "J");
+}
+
 // Helper functions
 static void SetContext(JNIEnv* env, jobject thiz, ApmContext* ctx) {
-    jclass cls = env->GetObjectClass(thiz);
-    jfieldID fid = env->GetFieldID(cls, "objData", "J");
-    env->SetLongField(thiz, fid, reinterpret_cast<jlong>(ctx));
+    env->SetLongField(thiz, GetObjDataField(env, thiz), reinterpret_cast<jlong>(ctx));
 }
 
 static ApmContext* GetContext(JNIEnv* env, jobject thiz) {
-    jclass cls = env->GetObjectClass(thiz);
-    jfieldID fid = env->GetFieldID(cls, "objData", "J");
-    return reinterpret_cast<ApmContext*>(env->GetLongField(thiz, fid));
+    return reinterpret_cast<ApmContext*>(env->GetLongField(thiz, GetObjDataField(env, thiz)));
+}
+
+// Native handle passed directly from Java (the value of Apm.objData)
+static ApmContext* FromHandle(jlong handle) {
+    return reinterpret_cast<ApmContext*>(handle);
+}
+
+// In pipelined mode noise suppression, gain control and the transient
+// suppressor live in the second stage's APM. Setters go through GetApmConfig/ApplyApmConfig, which keep
+// that split and any deadline governor degradation invisible.
+static AudioProcessing::Config ReadApmConfig(ApmContext* ctx) {
+    AudioProcessing::Config config = ctx->apm->GetConfig();
+    if (ctx->post_apm) {
+        AudioProcessing::Config post = ctx->post_apm->GetConfig();
+        config.noise_suppression = post.noise_suppression;
+        config.gain_controller1 = post.gain_controller1;
+        config.gain_controller2 = post.gain_controller2;
+        config.transient_suppression = post.transient_suppression;
+    }
+    return config;
+}
+
+static void WriteApmConfig(ApmContext* ctx, const AudioProcessing::Config& config) {
+    if (!ctx->post_apm) {
+        ctx->apm->ApplyConfig(config);
+        return;
+    }
+    AudioProcessing::Config first = config;
+    first.noise_suppression.enabled = false;
+    first.gain_controller1.enabled = false;
+    first.gain_controller2.enabled = false;
+    first.transient_suppression.enabled = false;
+
+    // The second stage also repeats pre-gain and the high-pass filter, so
+    // NS and AGC1 analyze what they would in one APM. Its echo control is
+    // the relay of the first stage's AEC3 output (see capture_pipeline.h).
+    AudioProcessing::Config second = config;
+    second.echo_canceller.enabled = true;
+    second.echo_canceller.mobile_mode = false;
+
+    ctx->apm->ApplyConfig(first);
+    ctx->post_apm->ApplyConfig(second);
+}
+
+// Deadline governor tiers, each including the cheaper settings before it:
+//   1: transient suppressor off, noise suppression one level lower
+//   2: AEC3 filter capped at 24 blocks
+//   3: AEC3 filter capped at the upstream 13 blocks, noise suppression low
+// There is no coarse-filter-only tier: AEC3 always runs both filters and
+// its config has no switch for the refined one.
+static AudioProcessing::Config DegradeApmConfig(AudioProcessing::Config config, int tier) {
+    using NoiseSuppression = AudioProcessing::Config::NoiseSuppression;
+    if (tier >= 1) {
+        config.transient_suppression.enabled = false;
+        if (config.noise_suppression.level > NoiseSuppression::kLow) {
+            config.noise_suppression.level =
+                static_cast<NoiseSuppression::Level>(config.noise_suppression.level - 1);
+        }
+    }
+    if (tier >= 3) config.noise_suppression.level = NoiseSuppression::kLow;
+    return config;
+}
+
+static size_t FilterLengthCapForTier(int tier) {
+    if (tier >= 3) return 13;
+    if (tier >= 2) return 24;
+    return 0;
+}
+
+static AudioProcessing::Config GetApmConfig(ApmContext* ctx) {
+    std::lock_guard<std::mutex> lock(ctx->config_mutex);
+    return ctx->governor_tier > 0 ? ctx->requested_config : ReadApmConfig(ctx);
+}
+
+static void ApplyApmConfig(ApmContext* ctx, const AudioProcessing::Config& config) {
+    std::lock_guard<std::mutex> lock(ctx->config_mutex);
+    if (ctx->governor_tier > 0) {
+        ctx->requested_config = config;
+        WriteApmConfig(ctx, DegradeApmConfig(config, ctx->governor_tier));
+    } else {
+        WriteApmConfig(ctx, config);
+    }
+}
+
+// Switches to a governor tier. Runs on the background worker for the tiers
+// the capture thread asks for, and on the JNI thread with tier 0 when the
+// governor is turned off; a step down that races with turning it off is
+// dropped. Stepping down sheds load, so the AEC3 filter is capped without a
+// shadow warm-up.
+static void ApplyGovernorTier(ApmContext* ctx, int tier) {
+    std::lock_guard<std::mutex> lock(ctx->config_mutex);
+    if (tier > 0 && !ctx->governed.load(std::memory_order_acquire)) return;
+    if (tier == ctx->governor_tier) return;
+
+    if (ctx->governor_tier == 0) ctx->requested_config = ReadApmConfig(ctx);
+    WriteApmConfig(ctx, DegradeApmConfig(ctx->requested_config, tier));
+    if (ctx->echo_control) {
+        ctx->echo_control->SetFilterLengthCap(FilterLengthCapForTier(tier),
+                                              tier > ctx->governor_tier);
+    }
+
+    LOGI("Deadline governor: tier %d -> %d", ctx->governor_tier, tier);
+    ctx->governor_tier = tier;
+}
+
+void GovernorTierTask::Run() {
+    ApplyGovernorTier(ctx, ctx->governor_target_tier.load(std::memory_order_acquire));
+}
+
+// APM running the gain controller, whose analog level the app exchanges
+static AudioProcessing* GainControlApm(ApmContext* ctx) {
+    return ctx->post_apm ? ctx->post_apm.get() : ctx->apm.get();
+}
+
+static std::string JStringToString(JNIEnv* env, jstring value) {
+    if (!value) return std::string();
+    const char* chars = env->GetStringUTFChars(value, nullptr);
+    if (!chars) return std::string();
+    std::string result(chars);
+    env->ReleaseStringUTFChars(value, chars);
+    return result;
 }
 
 extern "C" {
 
+// ============================================================================
+// JNI Lifecycle
+// ============================================================================
+
+JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM* vm, void* reserved) {
+    JNIEnv* env = nullptr;
+    if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR;
+    }
+
+    jclass cls = env->FindClass("com/webrtc/audioprocessing/Apm");
+    if (!cls) {
+        env->ExceptionClear();
+        LOGE("Apm class not found at load time, using per-call field lookup");
+        return JNI_VERSION_1_6;
+    }
+
+    g_apm_class = static_cast<jclass>(env->NewGlobalRef(cls));
+    g_obj_data_field = env->GetFieldID(cls, "objData", "J");
+    if (!g_obj_data_field) {
+        env->ExceptionClear();
+        LOGE("Apm.objData field not found at load time");
+    }
+    env->DeleteLocalRef(cls);
+
+    return JNI_VERSION_1_6;
+}
+
 // ============================================================================
 // AEC3 Configuration Helper
 // ============================================================================
 
+// Refined/coarse filter length of CreateAec3Config (800 ms echo paths)
+static const size_t kExtendedFilterLengthBlocks = 40;
+
+// Matched filter geometry (aec3_common.h): each filter spans 32 sub-blocks
+// and successive filters are shifted by 24. A sub-block is 4 ms of render
+// audio whatever the down-sampling factor.
+static const int kMatchedFilterWindowMs = 128;
+static const int kMatchedFilterShiftMs = 96;
+static const int kMaxCompensatedDelayMs = 2000;
+static const int kDefaultRoomResponseBlocks = 20;
+
 /**
  * Create custom AEC3 configuration based on suppression level
  *
@@ -77,8 +431,8 @@ static EchoCanceller3Config CreateAec3Config(int suppressionLevel) {
     EchoCanceller3Config config;
 
     // CRITICAL: Maintain 800ms filter support from patch
-    config.filter.refined.length_blocks = 40;  // 800ms support
-    config.filter.coarse.length_blocks = 40;
+    config.filter.refined.length_blocks = kExtendedFilterLengthBlocks;  // 800ms support
+    config.filter.coarse.length_blocks = kExtendedFilterLengthBlocks;
 
     // Configure suppression based on user's preference
     // enr_suppress controls how aggressively echo is removed
@@ -106,29 +460,130 @@ static EchoCanceller3Config CreateAec3Config(int suppressionLevel) {
     return config;
 }
 
+// Matched filters needed to cover delays up to maxDelayMs. AEC3 also sizes
+// its render delay buffer from this count.
+static size_t NumMatchedFiltersForDelay(int maxDelayMs) {
+    int extra_filters = 0;
+    if (maxDelayMs > kMatchedFilterWindowMs) {
+        extra_filters = (maxDelayMs - kMatchedFilterWindowMs + kMatchedFilterShiftMs - 1) /
+                        kMatchedFilterShiftMs;
+    }
+    return static_cast<size_t>(1 + extra_filters);
+}
+
+/**
+ * Delay-compensated filter placement
+ *
+ * Instead of covering the Bluetooth latency with FIR taps that mostly model
+ * silence, widen the matched filter lag range so the render delay buffer is
+ * aligned to the measured delay, and size the adaptive filter for the room
+ * response alone. The render buffers grow with delay.num_filters.
+ *
+ * @param maxDelayMs   largest delay to search for, 0 restores the extended filter
+ * @param lengthBlocks adaptive filter length after alignment (4 ms blocks)
+ */
+static void ApplyDelayCompensation(EchoCanceller3Config* config, int maxDelayMs, size_t lengthBlocks) {
+    const EchoCanceller3Config defaults;
+
+    if (maxDelayMs <= 0) {
+        config->delay.num_filters = defaults.delay.num_filters;
+        config->filter.refined.length_blocks = kExtendedFilterLengthBlocks;
+        config->filter.coarse.length_blocks = kExtendedFilterLengthBlocks;
+        config->filter.refined_initial = defaults.filter.refined_initial;
+        config->filter.coarse_initial = defaults.filter.coarse_initial;
+        return;
+    }
+
+    config->delay.num_filters = NumMatchedFiltersForDelay(maxDelayMs);
+    config->filter.refined.length_blocks = lengthBlocks;
+    config->filter.coarse.length_blocks = lengthBlocks;
+
+    // The patched initial phase would otherwise run 60-block filters
+    config->filter.refined_initial.length_blocks =
+        std::min(config->filter.refined_initial.length_blocks, lengthBlocks);
+    config->filter.coarse_initial.length_blocks =
+        std::min(config->filter.coarse_initial.length_blocks, lengthBlocks);
+}
+
+// Matched filters for the running config: the tuned count, widened to the
+// wrapper delay estimator's range while it runs (the render delay buffer
+// must hold the whole range)
+static size_t SessionNumFilters(ApmContext* ctx) {
+    size_t num_filters = ctx->tuned_num_filters;
+    if (ctx->delay_estimation.load(std::memory_order_acquire)) {
+        num_filters = std::max(num_filters,
+                               NumMatchedFiltersForDelay(ctx->delay_estimator->max_delay_ms()));
+    }
+    return num_filters;
+}
+
+// Start the next AEC3 instance from a known echo path. The render buffer must
+// reach the stored delay, and a wrapper estimator starts from it too.
+static void WarmStartEchoPath(ApmContext* ctx, const apm_jni::EchoPathState& state) {
+    EchoCanceller3Config config = ctx->echo_control->config();
+    size_t num_filters = NumMatchedFiltersForDelay(state.delay_ms);
+    if (num_filters > config.delay.num_filters) {
+        config.delay.num_filters = num_filters;
+        ctx->echo_control->Reconfigure(config);
+    }
+
+    if (ctx->delay_estimation.load(std::memory_order_acquire)) {
+        ctx->echo_control->SetExternalDelay(state.delay_ms);
+        ctx->published_delay_ms.store(state.delay_ms, std::memory_order_relaxed);
+    }
+
+    ctx->echo_control->ImportEchoPath(state);
+    LOGI("AEC3 echo path imported: delay=%d ms, %d-block filter, erl=%.1f dB",
+         state.delay_ms, state.filter_length_blocks, state.erl_db);
+}
+
+// Record the current route's tuning, and its echo path if it has converged
+// (otherwise the one stored before is kept)
+static bool SaveRouteProfile(ApmContext* ctx) {
+    if (ctx->route.empty() || !ctx->route_profiles) return false;
+
+    apm_jni::RouteProfile previous;
+    bool known = ctx->route_profiles->Lookup(ctx->route, &previous);
+
+    apm_jni::RouteProfile profile =
+        apm_jni::ProfileFromConfig(ctx->echo_control->config(), ctx->tuned_num_filters);
+    profile.adaptive_length = ctx->echo_control->adaptive_length();
+    profile.has_echo_path = ctx->echo_control->ExportEchoPath(&profile.echo_path);
+    if (!profile.has_echo_path && known && previous.has_echo_path) {
+        profile.has_echo_path = true;
+        profile.echo_path = previous.echo_path;
+    }
+    return ctx->route_profiles->Store(ctx->route, profile);
+}
+
 // ============================================================================
 // APM Lifecycle
 // ============================================================================
 
-JNIEXPORT jboolean JNICALL
-Java_com_webrtc_audioprocessing_Apm_nativeCreateApmInstance(
-    JNIEnv* env,
-    jobject thiz,
-    jboolean aecExtendFilter,
-    jboolean speechIntelligibilityEnhance,
-    jboolean delayAgnostic,
-    jboolean beamforming,
-    jboolean nextGenerationAec,
-    jboolean experimentalNs,
-    jboolean experimentalAgc,
-    jint aecSuppressionLevel) {
-
-    LOGI("Creating APM instance (AEC3 800ms support, M120)");
-    LOGD("  aecExtendFilter=%d, delayAgnostic=%d, nextGenAec=%d, suppressionLevel=%d",
-         aecExtendFilter, delayAgnostic, nextGenerationAec, aecSuppressionLevel);
+// Identifies the creation flags that change what gets built. Serves as the
+// instance pool key and the APM arena key. The suppression level is folded
+// to 0-2 first: CreateAec3Config builds High for anything but 0 and 1, so
+// those levels share one key, and a negative level cannot fill the upper
+// bits of the level field.
+static uint64_t ContextKey(bool nextGenerationAec, bool experimentalNs, bool experimentalAgc,
+                           int aecSuppressionLevel) {
+    if (aecSuppressionLevel != 0 && aecSuppressionLevel != 1) aecSuppressionLevel = 2;
+    return 0x41504d0000000000ull |
+        (nextGenerationAec ? 1u : 0u) | (experimentalNs ? 2u : 0u) |
+        (experimentalAgc ? 4u : 0u) | (static_cast<uint32_t>(aecSuppressionLevel) << 8);
+}
 
+// Builds a context with a fully initialized APM, or returns null
+static ApmContext* BuildContext(bool nextGenerationAec, bool experimentalNs, bool experimentalAgc,
+                                int aecSuppressionLevel) {
     // Create context
     ApmContext* ctx = new ApmContext();
+    ctx->pool_key = ContextKey(nextGenerationAec, experimentalNs, experimentalAgc,
+                               aecSuppressionLevel);
+
+    // With arena allocation on, the APM and its submodules are built into
+    // one block, sized by what the last build with the same flags needed
+    apm_jni::ArenaScope arena_scope(ctx->pool_key);
 
     // Configure AudioProcessing
     AudioProcessing::Config config;
@@ -140,11 +595,15 @@ Java_com_webrtc_audioprocessing_Apm_nativeCreateApmInstance(
 
         // Create custom AEC3 configuration with user's suppression level
         EchoCanceller3Config aec3_config = CreateAec3Config(aecSuppressionLevel);
+        ctx->initial_aec3_config = aec3_config;
+        ctx->tuned_num_filters = aec3_config.delay.num_filters;
 
-        // Build APM with custom AEC3 factory
+        // Build APM with custom AEC3 factory. The adaptive factory wraps
+        // EchoCanceller3 so the config can be changed on a running stream.
         // IMPORTANT: Pass config to factory constructor, then call Create() with NO arguments
+        ctx->echo_control = std::make_shared<apm_jni::EchoControlHandle>(aec3_config, ctx->timings);
         ctx->apm = AudioProcessingBuilder()
-            .SetEchoControlFactory(std::make_unique<EchoCanceller3Factory>(aec3_config))
+            .SetEchoControlFactory(std::make_unique<apm_jni::AdaptiveEchoControlFactory>(ctx->echo_control))
             .Create();  // ← Must be .Create() with no arguments!
 
         LOGI("AEC3 enabled (delay-agnostic mode, 800ms support, custom suppression)");
@@ -159,7 +618,7 @@ Java_com_webrtc_audioprocessing_Apm_nativeCreateApmInstance(
     if (!ctx->apm) {
         LOGE("Failed to create APM instance");
         delete ctx;
-        return JNI_FALSE;
+        return nullptr;
     }
 
     // Noise suppression
@@ -181,14 +640,104 @@ Java_com_webrtc_audioprocessing_Apm_nativeCreateApmInstance(
 
     // Apply AudioProcessing configuration (M120 API)
     ctx->apm->ApplyConfig(config);
+    ctx->initial_config = config;
+    ctx->apm_arena = arena_scope.TakeArena();
+    return ctx;
+}
+
+// Returns a finished session's context to the state BuildContext left it
+// in: every wrapper feature off, the creation configs back, default stream
+// format. Initialize() then rebuilds the APM's processing state, including
+// a fresh AEC3 instance, so this is done on free rather than on checkout.
+// APM keeps its internal format, so a next session in the same format
+// starts without reinitializing.
+static void RecycleContext(ApmContext* ctx) {
+    if (ctx->echo_control) ctx->echo_control->SetOutputTap(nullptr);
+    ctx->pipeline.reset();
+    ctx->post_apm = nullptr;
+
+    ctx->governed.store(false, std::memory_order_relaxed);
+    if (ctx->governor) apm_jni::BackgroundWorker::Get().Wait(&ctx->governor_task);
+    ctx->governor.reset();
+    ctx->governor_target_tier.store(0, std::memory_order_relaxed);
+    ctx->governor_tier = 0;
+
+    ctx->render_queue_state.store(kRenderDirect, std::memory_order_relaxed);
+    ctx->render_queue_live.store(false, std::memory_order_relaxed);
+    ctx->render_queue.reset();
+    ctx->delay_estimation.store(false, std::memory_order_relaxed);
+    ctx->delay_estimator.reset();
+    ctx->published_delay_ms.store(-1, std::memory_order_relaxed);
+
+    ctx->route_profiles.reset();
+    ctx->route.clear();
+    ctx->tuned_num_filters = ctx->initial_aec3_config.delay.num_filters;
+    ctx->resampler.reset();
+    ctx->SetDeviceRate(0);
+
+    ctx->timings->SetEnabled(false);
+    uint32_t counts[apm_jni::StageTimings::kNumStages * apm_jni::StageTimings::kNumBuckets];
+    ctx->timings->Read(counts, true);
+
+    ctx->SetStreamFormat(16000, 1, 1);
+    ctx->apm->ApplyConfig(ctx->initial_config);
+    if (ctx->echo_control) ctx->echo_control->Reset(ctx->initial_aec3_config);
+    ctx->apm->set_stream_delay_ms(0);
+    ctx->apm->Initialize();
+}
+
+// Contexts kept for reuse across sessions. Never destroyed, so no APM
+// teardown runs at process exit.
+static apm_jni::InstancePool<ApmContext>& ContextPool() {
+    static apm_jni::InstancePool<ApmContext>* pool = new apm_jni::InstancePool<ApmContext>();
+    return *pool;
+}
+
+// Upper bound on pooled contexts; each holds a full APM with AEC3
+static const int kMaxPooledContexts = 8;
+
+JNIEXPORT jboolean JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeCreateApmInstance(
+    JNIEnv* env,
+    jobject thiz,
+    jboolean aecExtendFilter,
+    jboolean speechIntelligibilityEnhance,
+    jboolean delayAgnostic,
+    jboolean beamforming,
+    jboolean nextGenerationAec,
+    jboolean experimentalNs,
+    jboolean experimentalAgc,
+    jint aecSuppressionLevel) {
+
+    // A pooled context is ready to run, so checkout skips building entirely
+    if (ContextPool().capacity() > 0) {
+        std::unique_ptr<ApmContext> pooled = ContextPool().Checkout(
+            ContextKey(nextGenerationAec, experimentalNs, experimentalAgc, aecSuppressionLevel));
+        if (pooled) {
+            SetContext(env, thiz, pooled.release());
+            LOGI("APM instance taken from the pool");
+            return JNI_TRUE;
+        }
+    }
+
+    LOGI("Creating APM instance (AEC3 800ms support, M120)");
+    LOGD("  aecExtendFilter=%d, delayAgnostic=%d, nextGenAec=%d, suppressionLevel=%d",
+         aecExtendFilter, delayAgnostic, nextGenerationAec, aecSuppressionLevel);
+
+    ApmContext* ctx = BuildContext(nextGenerationAec, experimentalNs, experimentalAgc,
+                                   aecSuppressionLevel);
+    if (!ctx) return JNI_FALSE;
 
     // Store context in Java object
     SetContext(env, thiz, ctx);
 
-    LOGI("APM instance created successfully");
+    LOGI("APM instance created successfully (sample conversion: %s)",
+         apm_jni::ConversionBackend());
     return JNI_TRUE;
 }
 
+static void RemoveEngineSession(ApmContext* ctx);
+
 JNIEXPORT void JNICALL
 Java_com_webrtc_audioprocessing_Apm_nativeFreeApmInstance(
     JNIEnv* env,
@@ -196,12 +745,135 @@ Java_com_webrtc_audioprocessing_Apm_nativeFreeApmInstance(
 
     ApmContext* ctx = GetContext(env, thiz);
     if (ctx) {
+        SetContext(env, thiz, nullptr);
+        RemoveEngineSession(ctx);
+        if (ContextPool().capacity() > 0) {
+            RecycleContext(ctx);
+            const bool kept = ContextPool().Return(ctx->pool_key, std::unique_ptr<ApmContext>(ctx));
+            LOGI("%s APM instance", kept ? "Pooled" : "Freed");
+            return;
+        }
         LOGI("Freeing APM instance");
         delete ctx;
-        SetContext(env, thiz, nullptr);
     }
 }
 
+/**
+ * Keep up to capacity finished instances for reuse (0, the default, turns
+ * pooling off and frees the idle ones). nativeFreeApmInstance then resets
+ * an instance and keeps it, and nativeCreateApmInstance with the same
+ * AEC3/NS/AGC flags and suppression level takes it without building.
+ *
+ * @return 0 on success, kBadParameterError if capacity is outside 0-8
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSetPoolCapacity(
+    JNIEnv* env,
+    jclass clazz,
+    jint capacity) {
+
+    if (capacity < 0 || capacity > kMaxPooledContexts) {
+        LOGE("Invalid instance pool capacity: %d", capacity);
+        return AudioProcessing::kBadParameterError;
+    }
+    ContextPool().SetCapacity(capacity);
+    LOGI("Instance pool capacity %d", capacity);
+    return 0;
+}
+
+/**
+ * Build instances for the given creation flags ahead of time (e.g. while
+ * the app starts, before the first call) until count of them are idle.
+ * Runs on the calling thread.
+ *
+ * @return idle instances for these flags, -1 if pooling is off,
+ *         kBadParameterError if count is outside 1 to the capacity
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativePrewarmPool(
+    JNIEnv* env,
+    jclass clazz,
+    jboolean nextGenerationAec,
+    jboolean experimentalNs,
+    jboolean experimentalAgc,
+    jint aecSuppressionLevel,
+    jint count) {
+
+    apm_jni::InstancePool<ApmContext>& pool = ContextPool();
+    if (pool.capacity() == 0) return -1;
+    if (count < 1 || static_cast<size_t>(count) > pool.capacity()) {
+        return AudioProcessing::kBadParameterError;
+    }
+
+    const uint64_t key = ContextKey(nextGenerationAec, experimentalNs, experimentalAgc,
+                                    aecSuppressionLevel);
+    size_t idle = pool.Idle(key);
+    while (idle < static_cast<size_t>(count)) {
+        ApmContext* ctx = BuildContext(nextGenerationAec, experimentalNs, experimentalAgc,
+                                       aecSuppressionLevel);
+        if (!ctx) break;
+        if (!pool.Return(key, std::unique_ptr<ApmContext>(ctx))) break;
+        idle = pool.Idle(key);
+    }
+    LOGI("Instance pool prewarmed: %zu idle", idle);
+    return static_cast<jint>(idle);
+}
+
+/**
+ * Free idle pooled instances until at most keep are left, e.g. from
+ * onTrimMemory. The capacity is unchanged.
+ *
+ * @return number of instances freed
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeTrimPool(
+    JNIEnv* env,
+    jclass clazz,
+    jint keep) {
+
+    const size_t trimmed = ContextPool().Trim(keep > 0 ? keep : 0);
+    if (trimmed > 0) LOGI("Instance pool trimmed: %zu freed", trimmed);
+    return static_cast<jint>(trimmed);
+}
+
+/**
+ * Pool counters: {idle, capacity, hits, misses, recycled, discarded}.
+ *
+ * @return 0 on success, -3 if the array is too small
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeGetPoolStats(
+    JNIEnv* env,
+    jclass clazz,
+    jlongArray stats) {
+
+    if (!stats || env->GetArrayLength(stats) < 6) return -3;
+    const apm_jni::InstancePool<ApmContext>::Stats pool = ContextPool().stats();
+    const jlong values[6] = {
+        static_cast<jlong>(pool.idle), static_cast<jlong>(pool.capacity),
+        static_cast<jlong>(pool.hits), static_cast<jlong>(pool.misses),
+        static_cast<jlong>(pool.recycled), static_cast<jlong>(pool.discarded),
+    };
+    env->SetLongArrayRegion(stats, 0, 6, values);
+    return 0;
+}
+
+/**
+ * Build APM and AEC3 instances into one pre-sized block each instead of
+ * hundreds of separate heap allocations (see instance_arena.h). Applies
+ * process-wide to instances created afterwards, including the AEC3
+ * instances a running stream builds when it reconfigures.
+ */
+JNIEXPORT void JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSetArenaAllocation(
+    JNIEnv* env,
+    jclass clazz,
+    jboolean enable) {
+
+    apm_jni::SetArenaAllocation(enable);
+    LOGD("Arena allocation %s", enable ? "enabled" : "disabled");
+}
+
 // ============================================================================
 // High-Pass Filter
 // ============================================================================
@@ -215,9 +887,9 @@ Java_com_webrtc_audioprocessing_Apm_high_1pass_1filter_1enable(
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    AudioProcessing::Config config = ctx->apm->GetConfig();
+    AudioProcessing::Config config = GetApmConfig(ctx);
     config.high_pass_filter.enabled = enable;
-    ctx->apm->ApplyConfig(config);
+    ApplyApmConfig(ctx, config);
 
     LOGD("High-pass filter %s", enable ? "enabled" : "disabled");
     return 0;
@@ -237,87 +909,455 @@ Java_com_webrtc_audioprocessing_Apm_aec_1enable(
     if (!ctx || !ctx->apm) return -1;
 
     // For AEC3, this is controlled by config
-    AudioProcessing::Config config = ctx->apm->GetConfig();
+    AudioProcessing::Config config = GetApmConfig(ctx);
     config.echo_canceller.enabled = enable;
     config.echo_canceller.mobile_mode = false;  // Use full AEC3
-    ctx->apm->ApplyConfig(config);
+    ApplyApmConfig(ctx, config);
 
     LOGD("AEC3 %s", enable ? "enabled" : "disabled");
     return 0;
 }
 
+/**
+ * Change the AEC3 suppression level on a running stream (same levels as
+ * nativeCreateApmInstance). Only the suppressor tuning changes. It is applied
+ * to the running AEC3 instance in place on the next capture frame, without
+ * rebuilding it.
+ *
+ * @param level 0=Low, 1=Moderate, 2=High (aggressive)
+ * @return 0 on success, -1 if AEC3 is not enabled, kBadParameterError otherwise
+ */
 JNIEXPORT jint JNICALL
 Java_com_webrtc_audioprocessing_Apm_aec_1set_1suppression_1level(
     JNIEnv* env,
     jobject thiz,
     jint level) {
 
-    // AEC3 suppression level is internal, not configurable via API
-    // This is a no-op for compatibility
-    LOGD("AEC suppression level set to %d (internal to AEC3)", level);
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->echo_control) return -1;
+    if (level < 0 || level > 2) return AudioProcessing::kBadParameterError;
+
+    EchoCanceller3Config::Suppressor suppressor = ctx->echo_control->config().suppressor;
+    const EchoCanceller3Config::Suppressor tuned = CreateAec3Config(level).suppressor;
+    suppressor.normal_tuning.mask_lf.enr_suppress = tuned.normal_tuning.mask_lf.enr_suppress;
+    suppressor.normal_tuning.mask_hf.enr_suppress = tuned.normal_tuning.mask_hf.enr_suppress;
+    ctx->echo_control->SetSuppressorTuning(suppressor);
     return 0;
 }
 
+/**
+ * Set the AEC3 suppressor masking thresholds (normal tuning) on a running
+ * stream, like aec_set_suppression_level but with the raw values. Echo to
+ * nearend ratios below enrTransparent are left untouched and ratios above
+ * enrSuppress are fully suppressed.
+ *
+ * @return 0 on success, -1 if AEC3 is not enabled, kBadParameterError unless
+ *         0 < enrTransparent <= enrSuppress <= 10 for both bands
+ */
 JNIEXPORT jint JNICALL
-Java_com_webrtc_audioprocessing_Apm_aec_1clock_1drift_1compensation_1enable(
+Java_com_webrtc_audioprocessing_Apm_nativeSetSuppressionMasks(
     JNIEnv* env,
     jobject thiz,
-    jboolean enable) {
+    jfloat lfEnrTransparent,
+    jfloat lfEnrSuppress,
+    jfloat hfEnrTransparent,
+    jfloat hfEnrSuppress) {
 
-    // AEC3 handles this internally
-    LOGD("Clock drift compensation (handled internally by AEC3)");
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->echo_control) return -1;
+
+    auto valid = [](float transparent, float suppress) {
+        return transparent > 0.0f && transparent <= suppress && suppress <= 10.0f;
+    };
+    if (!valid(lfEnrTransparent, lfEnrSuppress) || !valid(hfEnrTransparent, hfEnrSuppress)) {
+        LOGE("Invalid suppression masks: lf=%.3f/%.3f hf=%.3f/%.3f",
+             lfEnrTransparent, lfEnrSuppress, hfEnrTransparent, hfEnrSuppress);
+        return AudioProcessing::kBadParameterError;
+    }
+
+    EchoCanceller3Config::Suppressor suppressor = ctx->echo_control->config().suppressor;
+    suppressor.normal_tuning.mask_lf.enr_transparent = lfEnrTransparent;
+    suppressor.normal_tuning.mask_lf.enr_suppress = lfEnrSuppress;
+    suppressor.normal_tuning.mask_hf.enr_transparent = hfEnrTransparent;
+    suppressor.normal_tuning.mask_hf.enr_suppress = hfEnrSuppress;
+    ctx->echo_control->SetSuppressorTuning(suppressor);
+
+    LOGD("AEC3 suppression masks: lf=%.3f/%.3f hf=%.3f/%.3f",
+         lfEnrTransparent, lfEnrSuppress, hfEnrTransparent, hfEnrSuppress);
     return 0;
 }
 
-// ============================================================================
-// AECM (Echo Cancellation Mobile)
-// ============================================================================
-
+/**
+ * Let the AEC3 filter length follow the echo path. Sessions start with a
+ * standard-length filter and grow to the configured length only when the
+ * estimated delay (or low ERLE) calls for it, shrinking again when the path
+ * shortens. Switches warm up a replacement instance, so audio is not reset.
+ *
+ * @return 0 on success, -1 if there is no instance or AEC3 was not enabled
+ */
 JNIEXPORT jint JNICALL
-Java_com_webrtc_audioprocessing_Apm_aecm_1enable(
+Java_com_webrtc_audioprocessing_Apm_nativeSetAdaptiveFilterLength(
     JNIEnv* env,
     jobject thiz,
     jboolean enable) {
 
     ApmContext* ctx = GetContext(env, thiz);
-    if (!ctx || !ctx->apm) return -1;
-
-    AudioProcessing::Config config = ctx->apm->GetConfig();
-    config.echo_canceller.enabled = enable;
-    config.echo_canceller.mobile_mode = true;  // Use mobile mode
-    ctx->apm->ApplyConfig(config);
+    if (!ctx || !ctx->echo_control) return -1;
 
-    LOGD("AECM (mobile) %s", enable ? "enabled" : "disabled");
+    ctx->echo_control->SetAdaptiveLength(enable);
+    LOGD("AEC3 adaptive filter length %s", enable ? "requested" : "disabled");
     return 0;
 }
 
+/**
+ * @return refined filter length (blocks) of the active AEC3 instance, or -1
+ *         if there is none yet
+ */
 JNIEXPORT jint JNICALL
-Java_com_webrtc_audioprocessing_Apm_aecm_1set_1suppression_1level(
+Java_com_webrtc_audioprocessing_Apm_nativeGetFilterLengthBlocks(
     JNIEnv* env,
-    jobject thiz,
-    jint level) {
+    jobject thiz) {
 
-    // Mobile mode suppression handled internally
-    LOGD("AECM suppression level: %d", level);
-    return 0;
-}
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->echo_control) return -1;
 
-// ============================================================================
-// Noise Suppression
-// ============================================================================
+    return ctx->echo_control->FilterLengthBlocks();
+}
 
+/**
+ * Switch to delay-compensated filter placement (see ApplyDelayCompensation).
+ * Takes effect immediately before audio starts, otherwise after a warm-up of
+ * the replacement AEC3 instance.
+ *
+ * @param maxDelayMs         delay range to cover (up to 2000 ms), 0 to disable
+ * @param filterLengthBlocks room response length, 4-60 blocks (0 = 20)
+ * @return 0 on success, -1 if AEC3 is not enabled, kBadParameterError otherwise
+ */
 JNIEXPORT jint JNICALL
-Java_com_webrtc_audioprocessing_Apm_ns_1enable(
+Java_com_webrtc_audioprocessing_Apm_nativeSetDelayCompensation(
     JNIEnv* env,
     jobject thiz,
-    jboolean enable) {
+    jint maxDelayMs,
+    jint filterLengthBlocks) {
 
     ApmContext* ctx = GetContext(env, thiz);
-    if (!ctx || !ctx->apm) return -1;
+    if (!ctx || !ctx->echo_control) return -1;
+
+    if (filterLengthBlocks == 0) filterLengthBlocks = kDefaultRoomResponseBlocks;
+    if (maxDelayMs < 0 || maxDelayMs > kMaxCompensatedDelayMs ||
+        filterLengthBlocks < static_cast<jint>(apm_jni::kMinProfileFilterLengthBlocks) ||
+        filterLengthBlocks > static_cast<jint>(apm_jni::kMaxProfileFilterLengthBlocks)) {
+        LOGE("Invalid delay compensation: maxDelayMs=%d filterLengthBlocks=%d",
+             maxDelayMs, filterLengthBlocks);
+        return AudioProcessing::kBadParameterError;
+    }
 
-    AudioProcessing::Config config = ctx->apm->GetConfig();
+    EchoCanceller3Config config = ctx->echo_control->config();
+    ApplyDelayCompensation(&config, maxDelayMs, static_cast<size_t>(filterLengthBlocks));
+    ctx->tuned_num_filters = config.delay.num_filters;
+    config.delay.num_filters = SessionNumFilters(ctx);
+    ctx->echo_control->Reconfigure(config);
+
+    if (maxDelayMs > 0) {
+        LOGI("AEC3 delay compensation: %zu matched filters, %d-block filter",
+             config.delay.num_filters, filterLengthBlocks);
+    } else {
+        LOGI("AEC3 delay compensation disabled (%zu-block filter)", kExtendedFilterLengthBlocks);
+    }
+    return 0;
+}
+
+/**
+ * Estimate the echo delay in the wrapper (coarse-to-fine search, see
+ * delay_estimator.h) and feed it to AEC3 as an external delay, which removes
+ * AEC3's own matched-filter search from the per-block path. The estimate is
+ * not subject to the 500 ms clamp of set_stream_delay_ms.
+ *
+ * @param maxDelayMs delay range to search, 100-2000 ms (0 = 1000). A new
+ *                   range on a running stream restarts the search.
+ * @return 0 on success, -1 if AEC3 is not enabled, kBadParameterError otherwise
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSetDelayEstimation(
+    JNIEnv* env,
+    jobject thiz,
+    jboolean enable,
+    jint maxDelayMs) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->echo_control) return -1;
+
+    EchoCanceller3Config config = ctx->echo_control->config();
+    if (!enable) {
+        ctx->delay_estimation.store(false, std::memory_order_release);
+        ctx->echo_control->SetExternalDelay(-1);
+        config.delay.use_external_delay_estimator = false;
+        config.delay.num_filters = ctx->tuned_num_filters;
+        ctx->echo_control->Reconfigure(config);
+        LOGI("Wrapper delay estimation disabled");
+        return 0;
+    }
+
+    if (maxDelayMs == 0) maxDelayMs = 1000;
+    if (maxDelayMs < 100 || maxDelayMs > kMaxCompensatedDelayMs) {
+        LOGE("Invalid delay estimation range: %d ms", maxDelayMs);
+        return AudioProcessing::kBadParameterError;
+    }
+
+    // Built once for the largest range and kept for the life of the context:
+    // the audio threads may be inside it, so only its range is changed, by a
+    // request the capture thread applies on its next frame
+    if (!ctx->delay_estimator) {
+        ctx->delay_estimator =
+            std::make_unique<apm_jni::CoarseToFineDelayEstimator>(kMaxCompensatedDelayMs);
+    }
+    bool running = ctx->delay_estimation.load(std::memory_order_acquire);
+    if (!running || ctx->delay_estimator->max_delay_ms() != maxDelayMs) {
+        ctx->delay_estimator->Reset(maxDelayMs);
+    }
+
+    // The render delay buffer must hold the whole range
+    config.delay.use_external_delay_estimator = true;
+    config.delay.num_filters = std::max(config.delay.num_filters, NumMatchedFiltersForDelay(maxDelayMs));
+    ctx->echo_control->Reconfigure(config);
+
+    ctx->published_delay_ms.store(-1, std::memory_order_relaxed);
+    ctx->delay_estimation.store(true, std::memory_order_release);
+    LOGI("Wrapper delay estimation enabled (0-%d ms)", maxDelayMs);
+    return 0;
+}
+
+/**
+ * @return last confirmed delay estimate in ms, or -1 if none yet
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeGetEstimatedDelayMs(
+    JNIEnv* env,
+    jobject thiz) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->delay_estimation.load(std::memory_order_acquire)) return -1;
+
+    return ctx->delay_estimator->delay_ms();
+}
+
+/**
+ * Export the converged echo path (delay, filter length, ERL/ERLE) as a
+ * compact blob, to be stored per audio route and imported at the start of
+ * the next call on it.
+ *
+ * @return blob, or null if AEC3 is not enabled or has not converged yet
+ */
+JNIEXPORT jbyteArray JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeExportEchoPath(
+    JNIEnv* env,
+    jobject thiz) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->echo_control) return nullptr;
+
+    apm_jni::EchoPathState state;
+    if (!ctx->echo_control->ExportEchoPath(&state)) return nullptr;
+
+    std::vector<uint8_t> blob = apm_jni::SerializeEchoPathState(state);
+    jbyteArray result = env->NewByteArray(static_cast<jsize>(blob.size()));
+    if (!result) return nullptr;
+    env->SetByteArrayRegion(result, 0, static_cast<jsize>(blob.size()),
+                            reinterpret_cast<const jbyte*>(blob.data()));
+    return result;
+}
+
+/**
+ * Warm start AEC3 from an exported echo path. Call before the first frame;
+ * on a running stream the warm instance replaces the active one after the
+ * usual shadow warm-up.
+ *
+ * @return 0 on success, -1 if AEC3 is not enabled, kBadParameterError if the
+ *         blob is invalid or its delay is out of range
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeImportEchoPath(
+    JNIEnv* env,
+    jobject thiz,
+    jbyteArray blob) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->echo_control) return -1;
+    if (!blob) return AudioProcessing::kBadParameterError;
+
+    jsize length = env->GetArrayLength(blob);
+    std::vector<uint8_t> data(static_cast<size_t>(length));
+    env->GetByteArrayRegion(blob, 0, length, reinterpret_cast<jbyte*>(data.data()));
+
+    apm_jni::EchoPathState state;
+    if (!apm_jni::ParseEchoPathState(data.data(), data.size(), &state) ||
+        state.delay_ms > kMaxCompensatedDelayMs) {
+        LOGE("Invalid echo path blob (%d bytes)", length);
+        return AudioProcessing::kBadParameterError;
+    }
+
+    WarmStartEchoPath(ctx, state);
+    return 0;
+}
+
+/**
+ * Open (or create) the route profile file, e.g. in the app's files dir.
+ * Without it, nativeSetAudioRoute keeps profiles in memory only.
+ *
+ * @return 0 on success, -1 without an instance, kFileError if the file
+ *         cannot be created or mapped
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeOpenRouteProfiles(
+    JNIEnv* env,
+    jobject thiz,
+    jstring path) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx) return -1;
+
+    auto profiles = std::make_unique<apm_jni::RouteProfileCache>();
+    if (!profiles->Open(JStringToString(env, path))) return AudioProcessing::kFileError;
+    ctx->route_profiles = std::move(profiles);
+    return 0;
+}
+
+/**
+ * Switch the AEC3 tuning to another audio route without recreating the
+ * instance. The outgoing route's tuning and converged echo path are saved;
+ * the incoming route's profile, if any, is applied in place and its echo
+ * path warm starts the replacement AEC3 instance.
+ *
+ * @param route route/device identifier chosen by the app, e.g.
+ *              "bt:00:11:22:33:44:55" or "wired" (1-47 bytes)
+ * @return 1 if a stored profile was applied, 0 for a route seen for the first
+ *         time (current tuning kept), -1 if AEC3 is not enabled,
+ *         kBadParameterError for an invalid identifier
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSetAudioRoute(
+    JNIEnv* env,
+    jobject thiz,
+    jstring route) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->echo_control) return -1;
+
+    std::string next = JStringToString(env, route);
+    if (next.empty() || next.size() > apm_jni::RouteProfileCache::kMaxRouteLength) {
+        LOGE("Invalid audio route identifier");
+        return AudioProcessing::kBadParameterError;
+    }
+    if (!ctx->route_profiles) {
+        ctx->route_profiles = std::make_unique<apm_jni::RouteProfileCache>();
+        ctx->route_profiles->Open(std::string());
+    }
+    if (next == ctx->route) return 1;
+
+    SaveRouteProfile(ctx);
+    ctx->echo_control->ClearEchoPath();
+    ctx->route = next;
+
+    apm_jni::RouteProfile profile;
+    if (!ctx->route_profiles->Lookup(next, &profile)) {
+        LOGI("Audio route %s: no profile yet", next.c_str());
+        return 0;
+    }
+
+    EchoCanceller3Config config = ctx->echo_control->config();
+    if (!apm_jni::SameTuning(apm_jni::ProfileFromConfig(config, ctx->tuned_num_filters), profile)) {
+        apm_jni::ApplyProfileToConfig(profile, &config);
+        ctx->tuned_num_filters = profile.num_matched_filters;
+        config.delay.num_filters = SessionNumFilters(ctx);
+        ctx->echo_control->Reconfigure(config);
+    }
+    if (profile.adaptive_length != ctx->echo_control->adaptive_length()) {
+        ctx->echo_control->SetAdaptiveLength(profile.adaptive_length);
+    }
+    if (profile.has_echo_path) WarmStartEchoPath(ctx, profile.echo_path);
+
+    LOGI("Audio route %s: profile applied (%zu-block filter%s)", next.c_str(),
+         profile.refined_length_blocks, profile.has_echo_path ? ", warm start" : "");
+    return 1;
+}
+
+/**
+ * Save the current route's tuning and converged echo path now (e.g. at the
+ * end of a call); nativeSetAudioRoute also does this on every switch.
+ *
+ * @return 0 on success, -1 if AEC3 is not enabled or no route is set
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSaveRouteProfile(
+    JNIEnv* env,
+    jobject thiz) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->echo_control) return -1;
+
+    return SaveRouteProfile(ctx) ? 0 : -1;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_aec_1clock_1drift_1compensation_1enable(
+    JNIEnv* env,
+    jobject thiz,
+    jboolean enable) {
+
+    // AEC3 handles this internally
+    LOGD("Clock drift compensation (handled internally by AEC3)");
+    return 0;
+}
+
+// ============================================================================
+// AECM (Echo Cancellation Mobile)
+// ============================================================================
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_aecm_1enable(
+    JNIEnv* env,
+    jobject thiz,
+    jboolean enable) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->apm) return -1;
+
+    AudioProcessing::Config config = GetApmConfig(ctx);
+    config.echo_canceller.enabled = enable;
+    config.echo_canceller.mobile_mode = true;  // Use mobile mode
+    ApplyApmConfig(ctx, config);
+
+    LOGD("AECM (mobile) %s", enable ? "enabled" : "disabled");
+    return 0;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_aecm_1set_1suppression_1level(
+    JNIEnv* env,
+    jobject thiz,
+    jint level) {
+
+    // Mobile mode suppression handled internally
+    LOGD("AECM suppression level: %d", level);
+    return 0;
+}
+
+// ============================================================================
+// Noise Suppression
+// ============================================================================
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_ns_1enable(
+    JNIEnv* env,
+    jobject thiz,
+    jboolean enable) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->apm) return -1;
+
+    AudioProcessing::Config config = GetApmConfig(ctx);
     config.noise_suppression.enabled = enable;
-    ctx->apm->ApplyConfig(config);
+    ApplyApmConfig(ctx, config);
 
     LOGD("Noise suppression %s", enable ? "enabled" : "disabled");
     return 0;
@@ -332,7 +1372,7 @@ Java_com_webrtc_audioprocessing_Apm_ns_1set_1level(
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    AudioProcessing::Config config = ctx->apm->GetConfig();
+    AudioProcessing::Config config = GetApmConfig(ctx);
 
     // Map level [0,1,2,3] to NS level
     switch (level) {
@@ -352,7 +1392,7 @@ Java_com_webrtc_audioprocessing_Apm_ns_1set_1level(
             config.noise_suppression.level = AudioProcessing::Config::NoiseSuppression::kHigh;
     }
 
-    ctx->apm->ApplyConfig(config);
+    ApplyApmConfig(ctx, config);
     LOGD("NS level set to %d", level);
     return 0;
 }
@@ -370,9 +1410,9 @@ Java_com_webrtc_audioprocessing_Apm_agc_1enable(
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    AudioProcessing::Config config = ctx->apm->GetConfig();
+    AudioProcessing::Config config = GetApmConfig(ctx);
     config.gain_controller1.enabled = enable;
-    ctx->apm->ApplyConfig(config);
+    ApplyApmConfig(ctx, config);
 
     LOGD("AGC %s", enable ? "enabled" : "disabled");
     return 0;
@@ -387,9 +1427,9 @@ Java_com_webrtc_audioprocessing_Apm_agc_1set_1target_1level_1dbfs(
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    AudioProcessing::Config config = ctx->apm->GetConfig();
+    AudioProcessing::Config config = GetApmConfig(ctx);
     config.gain_controller1.target_level_dbfs = level;
-    ctx->apm->ApplyConfig(config);
+    ApplyApmConfig(ctx, config);
 
     LOGD("AGC target level: %d dBFS", level);
     return 0;
@@ -404,9 +1444,9 @@ Java_com_webrtc_audioprocessing_Apm_agc_1set_1compression_1gain_1db(
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    AudioProcessing::Config config = ctx->apm->GetConfig();
+    AudioProcessing::Config config = GetApmConfig(ctx);
     config.gain_controller1.compression_gain_db = gain;
-    ctx->apm->ApplyConfig(config);
+    ApplyApmConfig(ctx, config);
 
     LOGD("AGC compression gain: %d dB", gain);
     return 0;
@@ -421,9 +1461,9 @@ Java_com_webrtc_audioprocessing_Apm_agc_1enable_1limiter(
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    AudioProcessing::Config config = ctx->apm->GetConfig();
+    AudioProcessing::Config config = GetApmConfig(ctx);
     config.gain_controller1.enable_limiter = enable;
-    ctx->apm->ApplyConfig(config);
+    ApplyApmConfig(ctx, config);
 
     LOGD("AGC limiter %s", enable ? "enabled" : "disabled");
     return 0;
@@ -454,7 +1494,7 @@ Java_com_webrtc_audioprocessing_Apm_agc_1set_1mode(
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    AudioProcessing::Config config = ctx->apm->GetConfig();
+    AudioProcessing::Config config = GetApmConfig(ctx);
 
     switch (mode) {
         case 0:
@@ -470,7 +1510,7 @@ Java_com_webrtc_audioprocessing_Apm_agc_1set_1mode(
             config.gain_controller1.mode = AudioProcessing::Config::GainController1::kAdaptiveDigital;
     }
 
-    ctx->apm->ApplyConfig(config);
+    ApplyApmConfig(ctx, config);
     LOGD("AGC mode set to %d", mode);
     return 0;
 }
@@ -484,7 +1524,7 @@ Java_com_webrtc_audioprocessing_Apm_agc_1set_1stream_1analog_1level(
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    ctx->apm->set_stream_analog_level(level);
+    GainControlApm(ctx)->set_stream_analog_level(level);
     return 0;
 }
 
@@ -496,7 +1536,7 @@ Java_com_webrtc_audioprocessing_Apm_agc_1stream_1analog_1level(
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    return ctx->apm->recommended_stream_analog_level();
+    return GainControlApm(ctx)->recommended_stream_analog_level();
 }
 
 // ============================================================================
@@ -546,146 +1586,1365 @@ Java_com_webrtc_audioprocessing_Apm_vad_1stream_1has_1voice(
 // Stream Processing
 // ============================================================================
 
-JNIEXPORT jint JNICALL
-Java_com_webrtc_audioprocessing_Apm_ProcessStream(
-    JNIEnv* env,
-    jobject thiz,
-    jshortArray nearEnd,
-    jint offset) {
-
-    ApmContext* ctx = GetContext(env, thiz);
-    if (!ctx || !ctx->apm) return -1;
-
-    // Get array
-    jsize length = env->GetArrayLength(nearEnd);
-    jshort* data = env->GetShortArrayElements(nearEnd, nullptr);
+// Largest interleaved frame of a supported format (48 kHz stereo)
+static const size_t kMaxFrameSamples = 960;
 
-    if (!data) return -2;
+// Wrapper error: a frame queue (render queue, session engine) is full and
+// the frame was dropped
+static const int kQueueFull = -4;
 
-    // Expected frame size: 10ms at 16kHz = 160 samples
-    const int frame_size = 160;
+// Render queue size the queue is allocated with (see nativeSetRenderQueue)
+static const int kMaxRenderQueueFrames = 64;
 
-    if (length - offset < frame_size) {
-        env->ReleaseShortArrayElements(nearEnd, data, 0);
-        return -3;
+static bool IsSupportedStreamFormat(int sample_rate_hz, int num_channels) {
+    switch (sample_rate_hz) {
+        case 8000:
+        case 16000:
+        case 32000:
+        case 48000:
+            break;
+        default:
+            return false;
     }
+    return num_channels == 1 || num_channels == 2;
+}
 
-    // Convert to normalized float [-1.0, 1.0]
-    // WebRTC M120 expects normalized floats, NOT raw int16 values!
-    float float_buffer[frame_size];
-    for (int i = 0; i < frame_size; i++) {
-        float_buffer[i] = static_cast<float>(data[offset + i]) / 32768.0f;
-    }
+// Convert interleaved int16 samples to normalized float [-1.0, 1.0] planes
+// WebRTC M120 expects normalized floats, NOT raw int16 values!
+// Kernels are vectorized (see sample_conversion.h).
+static void CaptureToFloat(ApmContext* ctx, const int16_t* samples) {
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kCaptureConvertIn);
+    apm_jni::S16ToFloat(samples, ctx->capture_buffer.channels.data(),
+               ctx->input_config.num_frames(), ctx->input_config.num_channels());
+}
 
-    // Process capture stream (microphone)
-    float* channel_ptr = float_buffer;
-    int result = ctx->apm->ProcessStream(
-        &channel_ptr,
-        ctx->input_config,
-        ctx->output_config,
-        &channel_ptr);
+static void CaptureToS16(ApmContext* ctx, int16_t* samples) {
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kCaptureConvertOut);
+    apm_jni::FloatToS16(ctx->capture_buffer.channels.data(), samples,
+               ctx->output_config.num_frames(), ctx->output_config.num_channels());
+}
 
-    // Convert back to int16, with proper clamping
-    for (int i = 0; i < frame_size; i++) {
-        float sample = float_buffer[i] * 32768.0f;
-        if (sample > 32767.0f) sample = 32767.0f;
-        if (sample < -32768.0f) sample = -32768.0f;
-        data[offset + i] = static_cast<jshort>(sample);
-    }
+static void RenderToFloat(ApmContext* ctx, const int16_t* samples) {
+    apm_jni::S16ToFloat(samples, ctx->render_buffer.channels.data(),
+               ctx->render_config.num_frames(), ctx->render_config.num_channels());
+}
 
-    env->ReleaseShortArrayElements(nearEnd, data, 0);
-    return result;
+// Resolve the sample pointer of a direct java.nio.ByteBuffer holding at least
+// one frame. The buffer must be allocated with ByteBuffer.allocateDirect() and
+// use ByteOrder.nativeOrder(); offset is in samples, not bytes. Returns 0, -2
+// if the buffer is not direct or its address is misaligned, or -3 if it is too
+// short for one frame at offset.
+static int GetDirectFrame(JNIEnv* env, jobject buffer, jint offset, int frame_samples,
+                          int16_t** samples) {
+    void* address = env->GetDirectBufferAddress(buffer);
+    if (!address) return -2;
+    if (reinterpret_cast<uintptr_t>(address) % alignof(int16_t) != 0) return -2;
+
+    jlong capacity_samples = env->GetDirectBufferCapacity(buffer) / sizeof(int16_t);
+    if (offset < 0 || capacity_samples - offset < frame_samples) return -3;
+
+    *samples = static_cast<int16_t*>(address) + offset;
+    return 0;
 }
 
-JNIEXPORT jint JNICALL
-Java_com_webrtc_audioprocessing_Apm_ProcessReverseStream(
-    JNIEnv* env,
-    jobject thiz,
-    jshortArray farEnd,
-    jint offset) {
+static int ProcessRenderBuffer(ApmContext* ctx);
 
-    ApmContext* ctx = GetContext(env, thiz);
-    if (!ctx || !ctx->apm) return -1;
+static bool RenderQueued(const ApmContext* ctx) {
+    return ctx->render_queue_state.load(std::memory_order_acquire) != kRenderDirect;
+}
 
-    // Get array
-    jsize length = env->GetArrayLength(farEnd);
-    jshort* data = env->GetShortArrayElements(farEnd, nullptr);
+// Runs the far-end frames queued since the last capture frame, oldest first.
+// A stop request takes effect here, after the frames queued before it, so
+// far-end frames stay in order across the switch. A frame pushed by a
+// playback call that checked the state just before the switch runs on the
+// next capture frame.
+static void DrainRenderQueue(ApmContext* ctx) {
+    const int state = ctx->render_queue_state.load(std::memory_order_acquire);
+    apm_jni::RenderFrameQueue* queue = ctx->render_queue.get();
+    size_t num_samples = 0;
+    const int16_t* frame = queue->Front(&num_samples);
+    if (state == kRenderDirect && !frame) return;
+
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kRenderQueueDrain);
+    for (; frame; frame = queue->Front(&num_samples)) {
+        // Frames are queued at the stream or the device rate; one from
+        // before a format change cannot be converted, skip it
+        if (num_samples == static_cast<size_t>(ctx->render_frame_samples())) {
+            RenderToFloat(ctx, frame);
+            ProcessRenderBuffer(ctx);
+        } else if (ctx->render_resampler &&
+                   num_samples == ctx->render_resampler->device_frame_samples()) {
+            ctx->render_resampler->ToApm(frame, ctx->render_buffer.channels.data());
+            ProcessRenderBuffer(ctx);
+        }
+        queue->Pop();
+    }
 
-    if (!data) return -2;
+    if (state == kRenderQueueStopping) {
+        // Fails if the queue was re-enabled in the meantime
+        int expected = kRenderQueueStopping;
+        ctx->render_queue_state.compare_exchange_strong(expected, kRenderDirect,
+                                                        std::memory_order_acq_rel);
+    }
+}
 
-    const int frame_size = 160;
+// Process capture stream (microphone) in place in ctx->capture_buffer
+static int ProcessCaptureBuffer(ApmContext* ctx) {
+    float* const* channels = ctx->capture_buffer.channels.data();
+    const bool governed = ctx->governed.load(std::memory_order_acquire);
+    const int64_t start_us = governed ? apm_jni::StageTimings::NowUs() : 0;
 
-    if (length - offset < frame_size) {
-        env->ReleaseShortArrayElements(farEnd, data, JNI_ABORT);
-        return -3;
+    if (ctx->render_queue_live.load(std::memory_order_acquire)) {
+        DrainRenderQueue(ctx);
     }
 
-    // Convert to normalized float [-1.0, 1.0]
-    // WebRTC M120 expects normalized floats, NOT raw int16 values!
-    float float_buffer[frame_size];
-    for (int i = 0; i < frame_size; i++) {
-        float_buffer[i] = static_cast<float>(data[offset + i]) / 32768.0f;
+    // The estimator needs the unprocessed microphone signal
+    if (ctx->delay_estimation.load(std::memory_order_acquire)) {
+        apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kDelayEstimation);
+        ctx->delay_estimator->AnalyzeCapture(channels[0], ctx->input_config.num_frames());
+        int delay_ms = ctx->delay_estimator->delay_ms();
+        if (delay_ms >= 0 && delay_ms != ctx->published_delay_ms.load(std::memory_order_relaxed)) {
+            ctx->echo_control->SetExternalDelay(delay_ms);
+            ctx->published_delay_ms.store(delay_ms, std::memory_order_relaxed);
+            LOGD("Estimated echo delay: %d ms", delay_ms);
+        }
     }
 
-    // Process render stream (speaker reference for AEC)
-    float* channel_ptr = float_buffer;
-    int result = ctx->apm->ProcessReverseStream(
-        &channel_ptr,
-        ctx->input_config,
-        ctx->output_config,
-        &channel_ptr);
+    int result;
+    if (ctx->pipeline) {
+        result = ctx->pipeline->Process(channels, ctx->input_config.num_frames(),
+                                        ctx->input_config.num_channels());
+    } else {
+        apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kCaptureApm);
+        result = ctx->apm->ProcessStream(
+            channels,
+            ctx->input_config,
+            ctx->output_config,
+            channels);
+    }
 
-    env->ReleaseShortArrayElements(farEnd, data, JNI_ABORT);
+    if (governed) {
+        const int tier = ctx->governor->OnFrame(apm_jni::StageTimings::NowUs() - start_us);
+        if (tier >= 0) {
+            ctx->governor_target_tier.store(tier, std::memory_order_release);
+            apm_jni::BackgroundWorker::Get().Post(&ctx->governor_task);
+        }
+    }
     return result;
 }
 
+// Process render stream (speaker reference for AEC) in ctx->render_buffer.
+// The far-end output is never handed back to Java, so APM only analyzes the
+// frame: no output format is negotiated and no output copy is made.
+static int ProcessRenderBuffer(ApmContext* ctx) {
+    const float* const* channels = ctx->render_buffer.channels.data();
+    if (ctx->delay_estimation.load(std::memory_order_acquire)) {
+        ctx->delay_estimator->AnalyzeRender(channels[0], ctx->render_config.num_frames());
+    }
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kRenderApm);
+    return ctx->apm->AnalyzeReverseStream(channels, ctx->render_config);
+}
+
+static bool EngineRegistered(ApmContext* ctx);
+
+// Brings APM to the current stream format on the calling thread. Otherwise
+// APM reinitializes on the first process call in the new format, and builds
+// the AEC3 instance, arena block included, on an audio thread.
+static void InitializeStreamFormat(ApmContext* ctx) {
+    ProcessingConfig processing_config;
+    processing_config.input_stream() = ctx->input_config;
+    processing_config.output_stream() = ctx->output_config;
+    processing_config.reverse_input_stream() = ctx->render_config;
+    processing_config.reverse_output_stream() = ctx->render_config;
+    ctx->apm->Initialize(processing_config);
+    if (ctx->post_apm) ctx->post_apm->Initialize(processing_config);
+}
+
+// Stream format (sample rate and channel count) used by every processing
+// call. Sets the far-end channel count to match; SetRenderFormat can widen it
+// afterwards. Must not be changed while a stream thread is inside a process
+// call, and is refused while the instance is registered with the session
+// engine, whose queues are sized for the format at registration.
 JNIEXPORT jint JNICALL
-Java_com_webrtc_audioprocessing_Apm_set_1stream_1delay_1ms(
+Java_com_webrtc_audioprocessing_Apm_nativeSetStreamFormat(
     JNIEnv* env,
     jobject thiz,
-    jint delay) {
+    jint sampleRateHz,
+    jint numChannels) {
 
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->apm) return -1;
 
-    // Set delay hint for AEC3
-    ctx->apm->set_stream_delay_ms(delay);
-    LOGD("Stream delay hint set to %d ms", delay);
+    if (EngineRegistered(ctx)) {
+        LOGE("Remove the session from the engine before changing the stream format");
+        return AudioProcessing::kBadParameterError;
+    }
+
+    if (!IsSupportedStreamFormat(sampleRateHz, numChannels)) {
+        LOGE("Unsupported stream format: %d Hz, %d channel(s)", sampleRateHz, numChannels);
+        return AudioProcessing::kBadParameterError;
+    }
+
+    ctx->SetStreamFormat(sampleRateHz, numChannels, numChannels);
+    InitializeStreamFormat(ctx);
+    LOGI("Stream format: %d Hz, %d channel(s), %d samples per frame",
+         sampleRateHz, numChannels, ctx->frame_samples());
     return 0;
 }
 
-// ============================================================================
-// Resampler (for compatibility)
-// ============================================================================
-
-JNIEXPORT jboolean JNICALL
-Java_com_webrtc_audioprocessing_Apm_SamplingInit(
+// Interleaved samples expected per 10 ms frame for the current format
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeGetFrameSize(
     JNIEnv* env,
-    jobject thiz,
-    jint inFreq,
-    jint outFreq,
-    jlong numChannels) {
+    jobject thiz) {
 
     ApmContext* ctx = GetContext(env, thiz);
-    if (!ctx) return JNI_FALSE;
+    if (!ctx) return -1;
 
-    ctx->resampler.reset(new Resampler(inFreq, outFreq, numChannels));
-    LOGD("Resampler initialized: %d Hz -> %d Hz", inFreq, outFreq);
-    return JNI_TRUE;
+    return ctx->frame_samples();
 }
 
+// How AEC3 treats a far-end stream with more than one channel
+enum RenderChannelMode {
+    kRenderDownmix = 0,         // APM downmixes to mono before AEC3
+    kRenderDetectStereo = 1,    // AEC3 runs mono until it detects true stereo
+    kRenderAlwaysMultichannel = 2,
+};
+
+/**
+ * Far-end channel count, for a playback stream wider than the microphone
+ * (e.g. stereo speakers with a mono microphone). The interleaved frames
+ * are deinterleaved in one vectorized pass; the sample rate follows
+ * nativeSetStreamFormat, which resets the count to the capture's.
+ *
+ * @param numChannels far-end channels, 1 or 2
+ * @param multiChannelMode 0 = downmix to mono, 1 = let AEC3 switch to
+ *        multichannel processing only while the content is true stereo
+ *        (not duplicated mono), 2 = always multichannel. 1 and 2 need AEC3.
+ * @return 0 on success, -1 if there is no instance (or no AEC3 for modes
+ *         1 and 2), kBadParameterError for bad arguments or while the
+ *         instance is registered with the session engine
+ */
 JNIEXPORT jint JNICALL
-Java_com_webrtc_audioprocessing_Apm_SamplingReset(
+Java_com_webrtc_audioprocessing_Apm_nativeSetRenderFormat(
     JNIEnv* env,
     jobject thiz,
-    jint inFreq,
-    jint outFreq,
-    jlong numChannels) {
+    jint numChannels,
+    jint multiChannelMode) {
 
     ApmContext* ctx = GetContext(env, thiz);
-    if (!ctx || !ctx->resampler) return -1;
+    if (!ctx || !ctx->apm) return -1;
 
-    return ctx->resampler->Reset(inFreq, outFreq, numChannels);
+    if (EngineRegistered(ctx)) {
+        LOGE("Remove the session from the engine before changing the render format");
+        return AudioProcessing::kBadParameterError;
+    }
+
+    if (!IsSupportedStreamFormat(ctx->sample_rate_hz, numChannels) ||
+        multiChannelMode < kRenderDownmix || multiChannelMode > kRenderAlwaysMultichannel) {
+        LOGE("Unsupported render format: %d channel(s), mode %d", numChannels, multiChannelMode);
+        return AudioProcessing::kBadParameterError;
+    }
+    if (multiChannelMode != kRenderDownmix && !ctx->echo_control) return -1;
+
+    AudioProcessing::Config config = GetApmConfig(ctx);
+    config.pipeline.multi_channel_render = multiChannelMode != kRenderDownmix;
+    ApplyApmConfig(ctx, config);
+
+    if (ctx->echo_control) {
+        EchoCanceller3Config aec3_config = ctx->echo_control->config();
+        const bool detect = multiChannelMode == kRenderDetectStereo;
+        if (aec3_config.multi_channel.detect_stereo_content != detect) {
+            aec3_config.multi_channel.detect_stereo_content = detect;
+            ctx->echo_control->Reconfigure(aec3_config);
+        }
+    }
+
+    ctx->SetStreamFormat(ctx->sample_rate_hz, ctx->num_channels, numChannels);
+    InitializeStreamFormat(ctx);
+    LOGI("Render format: %d channel(s), mode %d, %d samples per frame",
+         numChannels, multiChannelMode, ctx->render_frame_samples());
+    return 0;
+}
+
+// Interleaved samples expected per 10 ms far-end frame
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeGetRenderFrameSize(
+    JNIEnv* env,
+    jobject thiz) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx) return -1;
+
+    return ctx->render_frame_samples();
+}
+
+/**
+ * Device sample rate for the *AtDeviceRate calls, which take 10 ms frames
+ * at this rate and resample them to and from the stream format inside the
+ * processing call (see device_resampler.h). The channel counts follow the
+ * stream and render formats. Change it only while no stream thread is
+ * inside a process call.
+ *
+ * @param deviceRateHz 8000-48000 in steps of 100 Hz (e.g. 44100), 0 = off
+ * @return 0 on success, -1 if there is no instance, kBadParameterError for
+ *         an unsupported rate
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSetDeviceRate(
+    JNIEnv* env,
+    jobject thiz,
+    jint deviceRateHz) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->apm) return -1;
+
+    if (deviceRateHz != 0 && !apm_jni::DeviceResampler::IsSupportedRate(deviceRateHz)) {
+        LOGE("Unsupported device rate: %d Hz", deviceRateHz);
+        return AudioProcessing::kBadParameterError;
+    }
+
+    ctx->SetDeviceRate(deviceRateHz);
+    if (deviceRateHz > 0) {
+        LOGI("Device rate: %d Hz <-> %d Hz, %zu samples per capture frame",
+             deviceRateHz, ctx->sample_rate_hz, ctx->capture_resampler->device_frame_samples());
+    } else {
+        LOGI("Device-rate processing disabled");
+    }
+    return 0;
+}
+
+// Interleaved samples per 10 ms capture frame at the device rate, or -1 if
+// no device rate is set
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeGetDeviceFrameSize(
+    JNIEnv* env,
+    jobject thiz) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->capture_resampler) return -1;
+
+    return static_cast<jint>(ctx->capture_resampler->device_frame_samples());
+}
+
+/**
+ * Queue far-end frames instead of processing them on the playback thread.
+ * ProcessReverseStream then only copies the frame into a lock-free ring
+ * (returning -4 if it is full) and the next ProcessStream call runs the
+ * queued frames before the capture frame. Safe to call while the stream
+ * threads are running. Turning the queue off takes effect on the next
+ * ProcessStream call, once the frames already queued have run.
+ *
+ * @param capacityFrames queue size in 10 ms frames, 2-64 (rounded up to a
+ *                       power of two), or 0 to process render frames directly
+ * @return 0 on success, -1 if there is no instance, kBadParameterError otherwise
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSetRenderQueue(
+    JNIEnv* env,
+    jobject thiz,
+    jint capacityFrames) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->apm) return -1;
+
+    if (capacityFrames == 0) {
+        // The capture thread drains the queue before switching back
+        int expected = kRenderQueued;
+        if (ctx->render_queue_state.compare_exchange_strong(expected, kRenderQueueStopping,
+                                                            std::memory_order_acq_rel)) {
+            LOGI("Render queue disabled (%llu frames dropped)",
+                 static_cast<unsigned long long>(ctx->render_queue->dropped()));
+        }
+        return 0;
+    }
+    if (capacityFrames < 2 || capacityFrames > kMaxRenderQueueFrames) {
+        LOGE("Invalid render queue capacity: %d frames", capacityFrames);
+        return AudioProcessing::kBadParameterError;
+    }
+
+    if (!ctx->render_queue) {
+        ctx->render_queue = std::make_unique<apm_jni::RenderFrameQueue>(kMaxRenderQueueFrames,
+                                                                        kMaxFrameSamples);
+        ctx->render_queue_live.store(true, std::memory_order_release);
+    }
+    ctx->render_queue->SetLimit(capacityFrames);
+    ctx->render_queue_state.store(kRenderQueued, std::memory_order_release);
+    LOGI("Render queue enabled (%zu frames)", ctx->render_queue->limit());
+    return 0;
+}
+
+/**
+ * Split capture processing across two threads. The calling thread runs the
+ * high-pass filter and AEC3; a worker thread runs noise suppression and gain
+ * control on the previous frame at the same time, on that frame's AEC3
+ * output, with their analysis on the same signal as in one APM. Adds exactly one frame
+ * (10 ms) of capture latency; the first frame after enabling is silence.
+ * Change it only while no stream thread is inside a process call.
+ *
+ * @return 0 on success, -1 if there is no instance, -6 if the second-stage
+ *         APM cannot be created
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSetPipelinedCapture(
+    JNIEnv* env,
+    jobject thiz,
+    jboolean enable) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->apm) return -1;
+    if (static_cast<bool>(enable) == (ctx->pipeline != nullptr)) return 0;
+
+    AudioProcessing::Config config = GetApmConfig(ctx);
+    if (!enable) {
+        if (ctx->echo_control) ctx->echo_control->SetOutputTap(nullptr);
+        ctx->pipeline.reset();
+        ctx->post_apm = nullptr;
+        ApplyApmConfig(ctx, config);
+        LOGI("Pipelined capture disabled");
+        return 0;
+    }
+
+    // The second stage reaches post_apm through ctx: it is set below, before
+    // any frame is handed to the worker
+    AudioProcessing* first = ctx->apm.get();
+    std::shared_ptr<apm_jni::StageTimings> timings = ctx->timings;
+    ctx->pipeline = std::make_unique<apm_jni::CapturePipeline>(
+        [first, timings](float* const* channels, size_t num_frames, size_t num_channels) {
+            apm_jni::ScopedStageTimer timer(timings.get(), apm_jni::StageTimings::kCaptureApm);
+            StreamConfig stream(static_cast<int>(num_frames * 100), num_channels);
+            return first->ProcessStream(channels, stream, stream, channels);
+        },
+        [ctx, timings](float* const* channels, size_t num_frames, size_t num_channels) {
+            apm_jni::ScopedStageTimer timer(timings.get(), apm_jni::StageTimings::kPostApm);
+            StreamConfig stream(static_cast<int>(num_frames * 100), num_channels);
+            return ctx->post_apm->ProcessStream(channels, stream, stream, channels);
+        },
+        kMaxFrameSamples);
+
+    ctx->post_apm = AudioProcessingBuilder()
+        .SetEchoControlFactory(std::make_unique<apm_jni::EchoOutputRelayFactory>(ctx->pipeline.get()))
+        .Create();
+    if (!ctx->post_apm) {
+        LOGE("Failed to create second-stage APM instance");
+        ctx->pipeline.reset();
+        return AudioProcessing::kBadParameterError;
+    }
+    ApplyApmConfig(ctx, config);
+    if (ctx->echo_control) ctx->echo_control->SetOutputTap(ctx->pipeline.get());
+    LOGI("Pipelined capture enabled (AEC3 | NS + AGC, +10 ms latency)");
+    return 0;
+}
+
+/**
+ * Per-stage capture processing time since the previous call.
+ *
+ * @param timingsUs receives {stage 1 mean, stage 1 max, stage 2 mean,
+ *                  stage 2 max} in microseconds
+ * @return 0 on success, -1 if pipelined capture is off, -3 if the array is
+ *         shorter than 4
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeGetPipelineTimings(
+    JNIEnv* env,
+    jobject thiz,
+    jintArray timingsUs) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->pipeline) return -1;
+    if (!timingsUs || env->GetArrayLength(timingsUs) < 4) return -3;
+
+    apm_jni::CapturePipeline::StageTiming first;
+    apm_jni::CapturePipeline::StageTiming second;
+    ctx->pipeline->ReadTimings(&first, &second);
+    const jint values[4] = {first.mean_us, first.max_us, second.mean_us, second.max_us};
+    env->SetIntArrayRegion(timingsUs, 0, 4, values);
+    return 0;
+}
+
+/**
+ * Switch per-stage timing on or off. While on, every capture and render
+ * stage the wrapper sees (see StageTimings::Stage) records its wall time
+ * into a fixed-bucket histogram.
+ *
+ * @return 0 on success, -1 if there is no instance
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSetStageTiming(
+    JNIEnv* env,
+    jobject thiz,
+    jboolean enable) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx) return -1;
+
+    ctx->timings->SetEnabled(enable);
+    LOGI("Stage timing %s", enable ? "enabled" : "disabled");
+    return 0;
+}
+
+/**
+ * Copy the stage timing histograms, stage-major: counts[stage * 24 + bucket].
+ * Stage order and bucket bounds are listed in docs/NATIVE_API.md.
+ *
+ * @param reset clear the histograms after reading
+ * @return number of counts written, -1 if there is no instance, -3 if the
+ *         array is too short
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeGetStageTimings(
+    JNIEnv* env,
+    jobject thiz,
+    jintArray counts,
+    jboolean reset) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx) return -1;
+
+    const jsize size = apm_jni::StageTimings::kNumStages * apm_jni::StageTimings::kNumBuckets;
+    if (!counts || env->GetArrayLength(counts) < size) return -3;
+
+    uint32_t values[size];
+    ctx->timings->Read(values, reset);
+    static_assert(sizeof(jint) == sizeof(uint32_t), "histogram counts are copied as jint");
+    env->SetIntArrayRegion(counts, 0, size, reinterpret_cast<const jint*>(values));
+    return size;
+}
+
+/**
+ * Watch each capture frame's processing time against a share of the 10 ms
+ * frame and step down through cheaper tiers while it overruns (see
+ * DegradeApmConfig), stepping back up once there is headroom again. Turning
+ * it off restores full quality.
+ *
+ * @param budgetPercent deadline as a share of the frame, 20-100 (0 = 80).
+ *                      Can only be changed while the governor is off.
+ * @return 0 on success, -1 if there is no instance, kBadParameterError otherwise
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeSetDeadlineGovernor(
+    JNIEnv* env,
+    jobject thiz,
+    jboolean enable,
+    jint budgetPercent) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->apm) return -1;
+
+    if (!enable) {
+        ctx->governed.store(false, std::memory_order_release);
+        // A step down still queued then finds tier 0 and does nothing
+        ctx->governor_target_tier.store(0, std::memory_order_release);
+        ApplyGovernorTier(ctx, 0);
+        LOGI("Deadline governor disabled");
+        return 0;
+    }
+
+    if (budgetPercent == 0) budgetPercent = 80;
+    if (budgetPercent < 20 || budgetPercent > 100) {
+        LOGE("Invalid deadline budget: %d%%", budgetPercent);
+        return AudioProcessing::kBadParameterError;
+    }
+
+    // 10 ms frames at every supported rate
+    const int64_t budget_us = 10000 * budgetPercent / 100;
+    bool running = ctx->governed.load(std::memory_order_acquire);
+    if (running && ctx->governor->budget_us() != budget_us) {
+        LOGE("Disable the deadline governor before changing its budget");
+        return AudioProcessing::kBadParameterError;
+    }
+
+    // Built once and kept for the life of the context: the capture thread
+    // may still be in OnFrame from before the last disable, so a new budget
+    // is handed over by a reset it applies on its next frame
+    if (!ctx->governor) {
+        ctx->governor = std::make_unique<apm_jni::DeadlineGovernor>(budget_us);
+    } else if (!running) {
+        ctx->governor->Reset(budget_us);
+    }
+
+    ctx->governed.store(true, std::memory_order_release);
+    LOGI("Deadline governor enabled (%lld us budget)", static_cast<long long>(budget_us));
+    return 0;
+}
+
+/**
+ * @param stats receives {tier, frames, overruns, worst frame in us}; tier 0
+ *              is full quality and 3 the cheapest
+ * @return 0 on success, -1 if the governor was never enabled, -3 if the
+ *         array is shorter than 4
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeGetDeadlineStats(
+    JNIEnv* env,
+    jobject thiz,
+    jlongArray stats) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->governor) return -1;
+    if (!stats || env->GetArrayLength(stats) < 4) return -3;
+
+    const jlong values[4] = {
+        ctx->governor->tier(),
+        static_cast<jlong>(ctx->governor->frames()),
+        static_cast<jlong>(ctx->governor->overruns()),
+        ctx->governor->worst_us(),
+    };
+    env->SetLongArrayRegion(stats, 0, 4, values);
+    return 0;
+}
+
+static jint ProcessStreamArray(JNIEnv* env, ApmContext* ctx, jshortArray nearEnd, jint offset) {
+    if (!ctx || !ctx->apm) return -1;
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kCaptureFrame);
+
+    jsize length = env->GetArrayLength(nearEnd);
+    if (offset < 0 || length - offset < ctx->frame_samples()) return -3;
+
+    // Heap arrays are accessed through short critical sections instead of
+    // GetShortArrayElements, which copies the whole array on ART. The array is
+    // only pinned while converting; APM processing runs outside the section.
+    jshort* data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(nearEnd, nullptr));
+    if (!data) return -2;
+    CaptureToFloat(ctx, data + offset);
+    env->ReleasePrimitiveArrayCritical(nearEnd, data, JNI_ABORT);
+
+    int result = ProcessCaptureBuffer(ctx);
+
+    data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(nearEnd, nullptr));
+    if (!data) return -2;
+    CaptureToS16(ctx, data + offset);
+    env->ReleasePrimitiveArrayCritical(nearEnd, data, 0);
+
+    return result;
+}
+
+static jint AnalyzeReverseStreamArray(JNIEnv* env, ApmContext* ctx, jshortArray farEnd, jint offset) {
+    if (!ctx || !ctx->apm) return -1;
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kRenderFrame);
+
+    jsize length = env->GetArrayLength(farEnd);
+    if (offset < 0 || length - offset < ctx->render_frame_samples()) return -3;
+
+    jshort* data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(farEnd, nullptr));
+    if (!data) return -2;
+    if (RenderQueued(ctx)) {
+        bool queued = ctx->render_queue->Push(data + offset, ctx->render_frame_samples());
+        env->ReleasePrimitiveArrayCritical(farEnd, data, JNI_ABORT);
+        return queued ? AudioProcessing::kNoError : kQueueFull;
+    }
+    RenderToFloat(ctx, data + offset);
+    env->ReleasePrimitiveArrayCritical(farEnd, data, JNI_ABORT);
+
+    return ProcessRenderBuffer(ctx);
+}
+
+// Zero-copy variants: samples are read from and written to a direct
+// ByteBuffer in place, with no array pinning or copying by the VM.
+
+// One capture frame processed in place in samples
+static int ProcessCaptureFrame(ApmContext* ctx, int16_t* samples) {
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kCaptureFrame);
+    CaptureToFloat(ctx, samples);
+    int result = ProcessCaptureBuffer(ctx);
+    CaptureToS16(ctx, samples);
+    return result;
+}
+
+static jint ProcessStreamDirectBuffer(JNIEnv* env, ApmContext* ctx, jobject nearEnd, jint offset) {
+    if (!ctx || !ctx->apm) return -1;
+
+    int16_t* samples = nullptr;
+    int result = GetDirectFrame(env, nearEnd, offset, ctx->frame_samples(), &samples);
+    if (result != 0) return result;
+
+    return ProcessCaptureFrame(ctx, samples);
+}
+
+static jint AnalyzeReverseStreamDirectBuffer(JNIEnv* env, ApmContext* ctx, jobject farEnd, jint offset) {
+    if (!ctx || !ctx->apm) return -1;
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kRenderFrame);
+
+    int16_t* samples = nullptr;
+    int result = GetDirectFrame(env, farEnd, offset, ctx->render_frame_samples(), &samples);
+    if (result != 0) return result;
+
+    if (RenderQueued(ctx)) {
+        return ctx->render_queue->Push(samples, ctx->render_frame_samples())
+                   ? AudioProcessing::kNoError
+                   : kQueueFull;
+    }
+
+    RenderToFloat(ctx, samples);
+
+    return ProcessRenderBuffer(ctx);
+}
+
+// Device-rate variants: the frame is resampled straight into the APM's
+// float planes and back, with no int16 frame at the stream rate in between.
+
+static jint ProcessStreamDeviceRateArray(JNIEnv* env, ApmContext* ctx, jshortArray nearEnd,
+                                         jint offset) {
+    if (!ctx || !ctx->apm || !ctx->capture_resampler) return -1;
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kCaptureFrame);
+    apm_jni::DeviceResampler* resampler = ctx->capture_resampler.get();
+
+    jsize length = env->GetArrayLength(nearEnd);
+    if (offset < 0 || length - offset < static_cast<jsize>(resampler->device_frame_samples())) {
+        return -3;
+    }
+
+    jshort* data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(nearEnd, nullptr));
+    if (!data) return -2;
+    {
+        apm_jni::ScopedStageTimer convert(ctx->timings.get(), apm_jni::StageTimings::kCaptureConvertIn);
+        resampler->ToApm(data + offset, ctx->capture_buffer.channels.data());
+    }
+    env->ReleasePrimitiveArrayCritical(nearEnd, data, JNI_ABORT);
+
+    int result = ProcessCaptureBuffer(ctx);
+
+    data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(nearEnd, nullptr));
+    if (!data) return -2;
+    {
+        apm_jni::ScopedStageTimer convert(ctx->timings.get(), apm_jni::StageTimings::kCaptureConvertOut);
+        resampler->FromApm(ctx->capture_buffer.channels.data(), data + offset);
+    }
+    env->ReleasePrimitiveArrayCritical(nearEnd, data, 0);
+
+    return result;
+}
+
+static jint ProcessReverseStreamDeviceRateArray(JNIEnv* env, ApmContext* ctx, jshortArray farEnd,
+                                                jint offset) {
+    if (!ctx || !ctx->apm || !ctx->render_resampler) return -1;
+    apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kRenderFrame);
+    apm_jni::DeviceResampler* resampler = ctx->render_resampler.get();
+    const size_t frame_samples = resampler->device_frame_samples();
+
+    jsize length = env->GetArrayLength(farEnd);
+    if (offset < 0 || length - offset < static_cast<jsize>(frame_samples)) return -3;
+
+    jshort* data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(farEnd, nullptr));
+    if (!data) return -2;
+    if (RenderQueued(ctx)) {
+        // Queued at the device rate; the capture thread resamples it
+        bool queued = ctx->render_queue->Push(data + offset, frame_samples);
+        env->ReleasePrimitiveArrayCritical(farEnd, data, JNI_ABORT);
+        return queued ? AudioProcessing::kNoError : kQueueFull;
+    }
+    resampler->ToApm(data + offset, ctx->render_buffer.channels.data());
+    env->ReleasePrimitiveArrayCritical(farEnd, data, JNI_ABORT);
+
+    return ProcessRenderBuffer(ctx);
+}
+
+/**
+ * Far-end entry points. Every far-end call feeds the frame to
+ * AudioProcessing::AnalyzeReverseStream and never writes the array or
+ * buffer back, which these names say. The ProcessReverseStream* names are
+ * deprecated and forward here.
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_AnalyzeReverseStream(
+    JNIEnv* env,
+    jobject thiz,
+    jshortArray farEnd,
+    jint offset) {
+
+    return AnalyzeReverseStreamArray(env, GetContext(env, thiz), farEnd, offset);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_AnalyzeReverseStreamDirect(
+    JNIEnv* env,
+    jobject thiz,
+    jobject farEnd,
+    jint offset) {
+
+    return AnalyzeReverseStreamDirectBuffer(env, GetContext(env, thiz), farEnd, offset);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeAnalyzeReverseStream(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jshortArray farEnd,
+    jint offset) {
+
+    return AnalyzeReverseStreamArray(env, FromHandle(handle), farEnd, offset);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeAnalyzeReverseStreamDirect(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jobject farEnd,
+    jint offset) {
+
+    return AnalyzeReverseStreamDirectBuffer(env, FromHandle(handle), farEnd, offset);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_ProcessStream(
+    JNIEnv* env,
+    jobject thiz,
+    jshortArray nearEnd,
+    jint offset) {
+
+    return ProcessStreamArray(env, GetContext(env, thiz), nearEnd, offset);
+}
+
+// Deprecated, use AnalyzeReverseStream
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_ProcessReverseStream(
+    JNIEnv* env,
+    jobject thiz,
+    jshortArray farEnd,
+    jint offset) {
+
+    return Java_com_webrtc_audioprocessing_Apm_AnalyzeReverseStream(
+        env, thiz, farEnd, offset);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_ProcessStreamDirect(
+    JNIEnv* env,
+    jobject thiz,
+    jobject nearEnd,
+    jint offset) {
+
+    return ProcessStreamDirectBuffer(env, GetContext(env, thiz), nearEnd, offset);
+}
+
+// Deprecated, use AnalyzeReverseStreamDirect
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_ProcessReverseStreamDirect(
+    JNIEnv* env,
+    jobject thiz,
+    jobject farEnd,
+    jint offset) {
+
+    return Java_com_webrtc_audioprocessing_Apm_AnalyzeReverseStreamDirect(
+        env, thiz, farEnd, offset);
+}
+
+// Static variants taking the native handle (Apm.objData) directly, so the
+// hot path does no field access at all.
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeProcessStream(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jshortArray nearEnd,
+    jint offset) {
+
+    return ProcessStreamArray(env, FromHandle(handle), nearEnd, offset);
+}
+
+// Deprecated, use nativeAnalyzeReverseStream
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeProcessReverseStream(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jshortArray farEnd,
+    jint offset) {
+
+    return Java_com_webrtc_audioprocessing_Apm_nativeAnalyzeReverseStream(
+        env, clazz, handle, farEnd, offset);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeProcessStreamDirect(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jobject nearEnd,
+    jint offset) {
+
+    return ProcessStreamDirectBuffer(env, FromHandle(handle), nearEnd, offset);
+}
+
+// Deprecated, use nativeAnalyzeReverseStreamDirect
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeProcessReverseStreamDirect(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jobject farEnd,
+    jint offset) {
+
+    return Java_com_webrtc_audioprocessing_Apm_nativeAnalyzeReverseStreamDirect(
+        env, clazz, handle, farEnd, offset);
+}
+
+/**
+ * Process one 10 ms frame at the device rate (see nativeSetDeviceRate).
+ * Returns -1 if no device rate is set, otherwise as ProcessStream.
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_ProcessStreamAtDeviceRate(
+    JNIEnv* env,
+    jobject thiz,
+    jshortArray nearEnd,
+    jint offset) {
+
+    return ProcessStreamDeviceRateArray(env, GetContext(env, thiz), nearEnd, offset);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_ProcessReverseStreamAtDeviceRate(
+    JNIEnv* env,
+    jobject thiz,
+    jshortArray farEnd,
+    jint offset) {
+
+    return ProcessReverseStreamDeviceRateArray(env, GetContext(env, thiz), farEnd, offset);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeProcessStreamAtDeviceRate(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jshortArray nearEnd,
+    jint offset) {
+
+    return ProcessStreamDeviceRateArray(env, FromHandle(handle), nearEnd, offset);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeProcessReverseStreamAtDeviceRate(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jshortArray farEnd,
+    jint offset) {
+
+    return ProcessReverseStreamDeviceRateArray(env, FromHandle(handle), farEnd, offset);
+}
+
+// ============================================================================
+// Batch Processing
+// ============================================================================
+
+// Feeds numFrames render frames and numFrames capture frames to APM inside a
+// single JNI transition, interleaved as render[i] then capture[i] exactly as
+// the per-frame calls would be. Both arrays hold numFrames consecutive
+// frames of their stream's format; render may be null for capture-only
+// batches. status receives 2 * numFrames codes: the render and capture result
+// of each frame. Returns numFrames, or a negative wrapper error.
+static jint ProcessInterleavedBatchArrays(JNIEnv* env, ApmContext* ctx, jshortArray render,
+                                          jshortArray capture, jint numFrames, jintArray status) {
+    if (!ctx || !ctx->apm) return -1;
+    if (numFrames <= 0 || numFrames > kMaxBatchFrames || !capture || !status) {
+        return AudioProcessing::kBadParameterError;
+    }
+
+    const int frame_samples = ctx->frame_samples();
+    const int render_frame_samples = ctx->render_frame_samples();
+    const jsize total_samples = numFrames * frame_samples;
+    const jsize total_render_samples = numFrames * render_frame_samples;
+    if (env->GetArrayLength(capture) < total_samples) return -3;
+    if (render && env->GetArrayLength(render) < total_render_samples) return -3;
+    if (env->GetArrayLength(status) < 2 * numFrames) return -3;
+
+    // Staging is sized with the stream format (see SetStreamFormat)
+    if (ctx->batch_capture.size() < static_cast<size_t>(total_samples) ||
+        ctx->batch_render.size() < static_cast<size_t>(total_render_samples) ||
+        ctx->batch_status.size() < static_cast<size_t>(2 * numFrames)) {
+        return AudioProcessing::kBadParameterError;
+    }
+
+    // Region copies are plain memcpys and never pin the arrays, which matters
+    // here because APM runs for several frames between copy-in and copy-out.
+    env->GetShortArrayRegion(capture, 0, total_samples, ctx->batch_capture.data());
+    if (render) {
+        env->GetShortArrayRegion(render, 0, total_render_samples, ctx->batch_render.data());
+    }
+
+    for (int i = 0; i < numFrames; i++) {
+        int16_t* capture_frame = ctx->batch_capture.data() + i * frame_samples;
+
+        jint render_result = AudioProcessing::kNoError;
+        if (render) {
+            apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kRenderFrame);
+            RenderToFloat(ctx, ctx->batch_render.data() + i * render_frame_samples);
+            render_result = ProcessRenderBuffer(ctx);
+        }
+
+        jint capture_result;
+        {
+            apm_jni::ScopedStageTimer timer(ctx->timings.get(), apm_jni::StageTimings::kCaptureFrame);
+            CaptureToFloat(ctx, capture_frame);
+            capture_result = ProcessCaptureBuffer(ctx);
+            CaptureToS16(ctx, capture_frame);
+        }
+
+        ctx->batch_status[2 * i] = render_result;
+        ctx->batch_status[2 * i + 1] = capture_result;
+    }
+
+    env->SetShortArrayRegion(capture, 0, total_samples, ctx->batch_capture.data());
+    env->SetIntArrayRegion(status, 0, 2 * numFrames, ctx->batch_status.data());
+    return numFrames;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_ProcessInterleavedBatch(
+    JNIEnv* env,
+    jobject thiz,
+    jshortArray render,
+    jshortArray capture,
+    jint numFrames,
+    jintArray status) {
+
+    return ProcessInterleavedBatchArrays(env, GetContext(env, thiz), render, capture, numFrames, status);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeProcessInterleavedBatch(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jshortArray render,
+    jshortArray capture,
+    jint numFrames,
+    jintArray status) {
+
+    return ProcessInterleavedBatchArrays(env, FromHandle(handle), render, capture, numFrames, status);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_set_1stream_1delay_1ms(
+    JNIEnv* env,
+    jobject thiz,
+    jint delay) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->apm) return -1;
+
+    // Set delay hint for AEC3
+    ctx->apm->set_stream_delay_ms(delay);
+    LOGD("Stream delay hint set to %d ms", delay);
+    return 0;
+}
+
+// ============================================================================
+// Session Engine
+// ============================================================================
+
+// Engine shared by all instances (see session_engine.h). Control calls
+// hold g_engine_mutex; frame calls only load g_session_engine, inside an
+// EngineCall so that stopping the engine waits for them before deleting it.
+static std::mutex g_engine_mutex;
+static std::unique_ptr<apm_jni::SessionEngine> g_engine;
+static std::atomic<apm_jni::SessionEngine*> g_session_engine{nullptr};
+static std::atomic<int> g_engine_calls{0};
+
+// Pins the engine for one frame call. The count is raised before the
+// pointer is loaded, so once the stop has cleared the pointer and seen the
+// count at zero, no call can still reach the old engine.
+class EngineCall {
+public:
+    EngineCall() {
+        g_engine_calls.fetch_add(1, std::memory_order_seq_cst);
+        engine_ = g_session_engine.load(std::memory_order_seq_cst);
+    }
+    ~EngineCall() { g_engine_calls.fetch_sub(1, std::memory_order_release); }
+
+    EngineCall(const EngineCall&) = delete;
+    EngineCall& operator=(const EngineCall&) = delete;
+
+    apm_jni::SessionEngine* engine() const { return engine_; }
+
+private:
+    apm_jni::SessionEngine* engine_;
+};
+
+// Default per-session queue length in 10 ms frames
+static const int kDefaultEngineQueueFrames = 8;
+
+// Session ids are never reused, so a registration that outlived a stopped
+// engine simply no longer matches
+static void RemoveEngineSession(ApmContext* ctx) {
+    if (ctx->engine_session < 0) return;
+    std::lock_guard<std::mutex> lock(g_engine_mutex);
+    if (g_engine) g_engine->RemoveSession(ctx->engine_session);
+    ctx->engine_session = -1;
+}
+
+// Whether ctx is registered with the running engine; a registration that
+// outlived a stopped engine does not count
+static bool EngineRegistered(ApmContext* ctx) {
+    if (ctx->engine_session < 0) return false;
+    std::lock_guard<std::mutex> lock(g_engine_mutex);
+    return g_engine && g_engine->FrameSamples(ctx->engine_session) > 0;
+}
+
+/**
+ * Start the session engine: numWorkers threads (0 = one per core) that
+ * process every registered session's frames. Returns the number of
+ * workers, also if the engine was already running.
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeStartSessionEngine(
+    JNIEnv* env,
+    jclass clazz,
+    jint numWorkers) {
+
+    if (numWorkers < 0 || numWorkers > apm_jni::SessionEngine::kMaxWorkers) {
+        return AudioProcessing::kBadParameterError;
+    }
+    std::lock_guard<std::mutex> lock(g_engine_mutex);
+    if (!g_engine) {
+        if (numWorkers == 0) numWorkers = static_cast<int>(std::thread::hardware_concurrency());
+        g_engine = std::make_unique<apm_jni::SessionEngine>(numWorkers, kMaxFrameSamples);
+        g_session_engine.store(g_engine.get(), std::memory_order_release);
+        LOGI("Session engine started (%d workers)", g_engine->num_workers());
+    }
+    return g_engine->num_workers();
+}
+
+/**
+ * Stop the session engine, unregistering every session. Submit and receive
+ * calls racing with the stop return -1; the engine is deleted once the ones
+ * already inside it have returned.
+ */
+JNIEXPORT void JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeStopSessionEngine(
+    JNIEnv* env,
+    jclass clazz) {
+
+    std::lock_guard<std::mutex> lock(g_engine_mutex);
+    if (!g_engine) return;
+    g_session_engine.store(nullptr, std::memory_order_seq_cst);
+    // Frame calls only copy one frame, so this is a few microseconds at most
+    while (g_engine_calls.load(std::memory_order_acquire) > 0) std::this_thread::yield();
+    g_engine.reset();
+    LOGI("Session engine stopped");
+}
+
+/**
+ * Register an instance (Apm.objData) with the engine. From then on its
+ * frames go through the nativeEngine* calls, which only queue and dequeue,
+ * and an engine worker runs the instance's APM. The stream format is fixed
+ * at registration. Freeing the instance unregisters it.
+ *
+ * @param queueFrames per-direction queue length, 2-64 (0 = 8)
+ * @return session id, -1 if the engine is not running or there is no
+ *         instance, kBadParameterError for a bad length, an instance
+ *         already registered or a full engine
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeEngineAddSession(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle,
+    jint queueFrames) {
+
+    ApmContext* ctx = FromHandle(handle);
+    if (!ctx || !ctx->apm) return -1;
+    if (queueFrames == 0) queueFrames = kDefaultEngineQueueFrames;
+    if (queueFrames < 2 || queueFrames > 64) return AudioProcessing::kBadParameterError;
+
+    std::lock_guard<std::mutex> lock(g_engine_mutex);
+    if (!g_engine) return -1;
+    if (ctx->engine_session >= 0 && g_engine->FrameSamples(ctx->engine_session) > 0) {
+        LOGE("Instance is already registered with the session engine");
+        return AudioProcessing::kBadParameterError;
+    }
+
+    const int id = g_engine->AddSession(
+        [ctx](int16_t* samples, size_t) { return ProcessCaptureFrame(ctx, samples); },
+        [ctx](const int16_t* samples, size_t) {
+            RenderToFloat(ctx, samples);
+            return ProcessRenderBuffer(ctx);
+        },
+        ctx->frame_samples(), ctx->render_frame_samples(), queueFrames);
+    if (id < 0) {
+        LOGE("Session engine is full");
+        return AudioProcessing::kBadParameterError;
+    }
+    ctx->engine_session = id;
+    LOGI("Session %d registered (%d samples per frame)", id, ctx->frame_samples());
+    return id;
+}
+
+/**
+ * Unregister an instance (Apm.objData) from the engine. Its submitters and
+ * receiver must have stopped.
+ *
+ * @return 0 on success, -1 if the instance is not registered
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeEngineRemoveSession(
+    JNIEnv* env,
+    jclass clazz,
+    jlong handle) {
+
+    ApmContext* ctx = FromHandle(handle);
+    if (!ctx || ctx->engine_session < 0) return -1;
+    RemoveEngineSession(ctx);
+    return 0;
+}
+
+// Submit and receive share the checks; returns 0 or an error code
+static jint EngineFrameCall(JNIEnv* env, const EngineCall& call, jint session, jshortArray frame,
+                            jint offset, bool render, size_t* num_samples) {
+    apm_jni::SessionEngine* engine = call.engine();
+    if (!engine) return -1;
+    *num_samples = render ? engine->RenderFrameSamples(session) : engine->FrameSamples(session);
+    if (*num_samples == 0) return -1;
+    if (!frame || offset < 0 ||
+        env->GetArrayLength(frame) - offset < static_cast<jsize>(*num_samples)) {
+        return -3;
+    }
+    return 0;
+}
+
+/**
+ * Queue one far-end frame for a session. It is processed before the next
+ * capture frame submitted after it.
+ *
+ * @return 0 on success, -1 if there is no such session, -2/-3 for buffer
+ *         errors, -4 if the session's queue is full and the frame dropped
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeEngineSubmitRender(
+    JNIEnv* env,
+    jclass clazz,
+    jint session,
+    jshortArray farEnd,
+    jint offset) {
+
+    EngineCall call;
+    size_t num_samples;
+    jint status = EngineFrameCall(env, call, session, farEnd, offset, true, &num_samples);
+    if (status != 0) return status;
+
+    jshort* data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(farEnd, nullptr));
+    if (!data) return -2;
+    bool queued = call.engine()->SubmitRender(session, data + offset, num_samples);
+    env->ReleasePrimitiveArrayCritical(farEnd, data, JNI_ABORT);
+    return queued ? AudioProcessing::kNoError : kQueueFull;
+}
+
+/**
+ * Queue one capture frame for a session and wake a worker for it. The
+ * processed frame is collected with nativeEngineReceiveCapture.
+ *
+ * @return as nativeEngineSubmitRender
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeEngineSubmitCapture(
+    JNIEnv* env,
+    jclass clazz,
+    jint session,
+    jshortArray nearEnd,
+    jint offset) {
+
+    EngineCall call;
+    size_t num_samples;
+    jint status = EngineFrameCall(env, call, session, nearEnd, offset, false, &num_samples);
+    if (status != 0) return status;
+
+    jshort* data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(nearEnd, nullptr));
+    if (!data) return -2;
+    bool queued = call.engine()->SubmitCapture(session, data + offset, num_samples);
+    env->ReleasePrimitiveArrayCritical(nearEnd, data, JNI_ABORT);
+    return queued ? AudioProcessing::kNoError : kQueueFull;
+}
+
+/**
+ * Copy the session's oldest processed capture frame into the array.
+ *
+ * @return 0 if a frame was copied, 1 if none is ready yet, -1 if there is
+ *         no such session, -2/-3 for buffer errors
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeEngineReceiveCapture(
+    JNIEnv* env,
+    jclass clazz,
+    jint session,
+    jshortArray nearEnd,
+    jint offset) {
+
+    EngineCall call;
+    size_t num_samples;
+    jint status = EngineFrameCall(env, call, session, nearEnd, offset, false, &num_samples);
+    if (status != 0) return status;
+
+    jshort* data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(nearEnd, nullptr));
+    if (!data) return -2;
+    bool received = call.engine()->ReceiveCapture(session, data + offset, num_samples);
+    env->ReleasePrimitiveArrayCritical(nearEnd, data, received ? 0 : JNI_ABORT);
+    return received ? 0 : 1;
+}
+
+/**
+ * @param stats receives {workers, sessions, frames, turns, steals, dropped,
+ *              errors}; a turn is one worker pickup of a session
+ * @return 0 on success, -1 if the engine is not running, -3 if the array
+ *         is shorter than 7
+ */
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_nativeGetEngineStats(
+    JNIEnv* env,
+    jclass clazz,
+    jlongArray stats) {
+
+    std::lock_guard<std::mutex> lock(g_engine_mutex);
+    if (!g_engine) return -1;
+    if (!stats || env->GetArrayLength(stats) < 7) return -3;
+
+    const apm_jni::SessionEngine::Stats engine = g_engine->stats();
+    const jlong values[7] = {
+        engine.workers, engine.sessions,
+        static_cast<jlong>(engine.frames), static_cast<jlong>(engine.turns),
+        static_cast<jlong>(engine.steals), static_cast<jlong>(engine.dropped),
+        static_cast<jlong>(engine.errors),
+    };
+    env->SetLongArrayRegion(stats, 0, 7, values);
+    return 0;
+}
+
+// ============================================================================
+// Resampler (for compatibility)
+// ============================================================================
+
+JNIEXPORT jboolean JNICALL
+Java_com_webrtc_audioprocessing_Apm_SamplingInit(
+    JNIEnv* env,
+    jobject thiz,
+    jint inFreq,
+    jint outFreq,
+    jlong numChannels) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx) return JNI_FALSE;
+
+    ctx->resampler.reset(new Resampler(inFreq, outFreq, numChannels));
+    LOGD("Resampler initialized: %d Hz -> %d Hz", inFreq, outFreq);
+    return JNI_TRUE;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_webrtc_audioprocessing_Apm_SamplingReset(
+    JNIEnv* env,
+    jobject thiz,
+    jint inFreq,
+    jint outFreq,
+    jlong numChannels) {
+
+    ApmContext* ctx = GetContext(env, thiz);
+    if (!ctx || !ctx->resampler) return -1;
+
+    return ctx->resampler->Reset(inFreq, outFreq, numChannels);
 }
 
 JNIEXPORT jint JNICALL
@@ -702,6 +2961,15 @@ Java_com_webrtc_audioprocessing_Apm_SamplingResetIfNeeded(
     return ctx->resampler->ResetIfNeeded(inFreq, outFreq, numChannels);
 }
 
+/**
+ * Resample lengthIn samples into samplesOut. Prefer nativeSetDeviceRate,
+ * which resamples inside the processing call.
+ *
+ * @param outLen ignored; Java passes it by value, so the produced length
+ *               is the return value instead
+ * @return number of samples written to samplesOut, -1 if there is no
+ *         resampler or it failed, -2/-3 for buffer errors
+ */
 JNIEXPORT jint JNICALL
 Java_com_webrtc_audioprocessing_Apm_SamplingPush(
     JNIEnv* env,
@@ -714,26 +2982,31 @@ Java_com_webrtc_audioprocessing_Apm_SamplingPush(
 
     ApmContext* ctx = GetContext(env, thiz);
     if (!ctx || !ctx->resampler) return -1;
+    if (!samplesIn || !samplesOut || lengthIn < 0 || maxLen < 0 ||
+        env->GetArrayLength(samplesIn) < lengthIn || env->GetArrayLength(samplesOut) < maxLen) {
+        return -3;
+    }
 
-    jshort* in_data = env->GetShortArrayElements(samplesIn, nullptr);
-    jshort* out_data = env->GetShortArrayElements(samplesOut, nullptr);
-
-    if (!in_data || !out_data) {
-        if (in_data) env->ReleaseShortArrayElements(samplesIn, in_data, JNI_ABORT);
-        if (out_data) env->ReleaseShortArrayElements(samplesOut, out_data, JNI_ABORT);
+    // Resampling is pure computation, so both arrays are pinned only for
+    // its duration instead of being copied as GetShortArrayElements does
+    jshort* in_data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(samplesIn, nullptr));
+    if (!in_data) return -2;
+    jshort* out_data = static_cast<jshort*>(env->GetPrimitiveArrayCritical(samplesOut, nullptr));
+    if (!out_data) {
+        env->ReleasePrimitiveArrayCritical(samplesIn, in_data, JNI_ABORT);
         return -2;
     }
 
     size_t out_length = 0;
     int result = ctx->resampler->Push(
-        in_data, lengthIn,
-        out_data, maxLen,
+        in_data, static_cast<size_t>(lengthIn),
+        out_data, static_cast<size_t>(maxLen),
         out_length);
 
-    env->ReleaseShortArrayElements(samplesIn, in_data, JNI_ABORT);
-    env->ReleaseShortArrayElements(samplesOut, out_data, 0);
+    env->ReleasePrimitiveArrayCritical(samplesOut, out_data, result == 0 ? 0 : JNI_ABORT);
+    env->ReleasePrimitiveArrayCritical(samplesIn, in_data, JNI_ABORT);
 
-    return result;
+    return result == 0 ? static_cast<jint>(out_length) : -1;
 }
 
 JNIEXPORT jboolean JNICALL
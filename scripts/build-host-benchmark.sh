@@ -0,0 +1,187 @@
+#!/bin/bash
+# Build the AEC3 host benchmark (Linux x86_64) against the patched WebRTC tree
+#
+# Usage: scripts/build-host-benchmark.sh [--run|--sweep|--test|--arena-test] [benchmark args...]
+#   --run    run apm_benchmark after building (remaining args are passed on)
+#   --sweep  run aec3_filter_sweep after building (remaining args are passed on)
+#   --test   run sample_conversion_test (SIMD vs scalar kernels) after building
+#   --arena-test  run instance_arena_test (arena lifetimes, under ASan) after building
+
+set -e  # Exit on error
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(dirname "$SCRIPT_DIR")"
+WEBRTC_ROOT="${WEBRTC_ROOT:-$HOME/webrtc}"
+OUT_DIR="out/host-x64"
+
+RUN_TARGET=""
+if [ "$1" == "--run" ]; then
+    RUN_TARGET="apm_benchmark"
+    shift
+elif [ "$1" == "--sweep" ]; then
+    RUN_TARGET="aec3_filter_sweep"
+    shift
+elif [ "$1" == "--test" ]; then
+    RUN_TARGET="sample_conversion_test"
+    shift
+elif [ "$1" == "--arena-test" ]; then
+    RUN_TARGET="instance_arena_test"
+    shift
+fi
+
+echo "======================================"
+echo "Building AEC3 Host Benchmark"
+echo "Target: linux x64"
+echo "======================================"
+
+# Ensure depot_tools is in PATH
+export PATH="$HOME/depot_tools:$PATH"
+
+cd "$WEBRTC_ROOT/src"
+
+# Apply each AEC3 patch once (the Android build may already have done it)
+for patch in "$PROJECT_ROOT"/patches/*.patch; do
+    if git apply --check --reverse "$patch" 2>/dev/null; then
+        echo "✓ $(basename "$patch") already applied"
+    else
+        echo "Applying patch: $(basename "$patch")"
+        git apply --verbose "$patch"
+    fi
+done
+
+# Sources live next to the JNI wrapper so sample_conversion.h resolves the same way
+mkdir -p modules/audio_processing/apm_jni/host/android
+cp "$PROJECT_ROOT/benchmark/apm_benchmark.cpp" \
+   "$PROJECT_ROOT/benchmark/aec3_filter_sweep.cpp" \
+   "$PROJECT_ROOT/benchmark/instance_arena_test.cpp" \
+   "$PROJECT_ROOT/benchmark/sample_conversion_test.cpp" \
+   "$PROJECT_ROOT/jni/instance_arena.cpp" \
+   "$PROJECT_ROOT/jni/instance_arena.h" \
+   "$PROJECT_ROOT/jni/sample_conversion.cpp" \
+   "$PROJECT_ROOT/jni/sample_conversion.h" \
+   modules/audio_processing/apm_jni/
+cp "$PROJECT_ROOT/benchmark/host/android/log.h" modules/audio_processing/apm_jni/host/android/
+
+if ! grep -q 'rtc_executable("apm_benchmark")' modules/audio_processing/BUILD.gn; then
+    cat >> modules/audio_processing/BUILD.gn <<'BUILDGN'
+
+rtc_executable("apm_benchmark") {
+  testonly = true
+  sources = [
+    "apm_jni/apm_benchmark.cpp",
+    "apm_jni/sample_conversion.cpp",
+    "apm_jni/sample_conversion.h",
+  ]
+
+  deps = [
+    ":audio_processing",
+    "//api/audio:aec3_factory",
+    "//common_audio",
+    "//system_wrappers",
+  ]
+}
+BUILDGN
+    echo "✓ apm_benchmark target added to modules/audio_processing/BUILD.gn"
+fi
+
+if ! grep -q 'rtc_executable("aec3_filter_sweep")' modules/audio_processing/BUILD.gn; then
+    cat >> modules/audio_processing/BUILD.gn <<'BUILDGN'
+
+rtc_executable("aec3_filter_sweep") {
+  testonly = true
+  sources = [ "apm_jni/aec3_filter_sweep.cpp" ]
+
+  deps = [
+    ":audio_processing",
+    "//api/audio:aec3_config",
+    "//api/audio:aec3_factory",
+    "aec3",
+    "logging:apm_logging",
+  ]
+}
+BUILDGN
+    echo "✓ aec3_filter_sweep target added to modules/audio_processing/BUILD.gn"
+fi
+
+if ! grep -q 'rtc_executable("sample_conversion_test")' modules/audio_processing/BUILD.gn; then
+    cat >> modules/audio_processing/BUILD.gn <<'BUILDGN'
+
+rtc_executable("sample_conversion_test") {
+  testonly = true
+  sources = [
+    "apm_jni/sample_conversion.cpp",
+    "apm_jni/sample_conversion.h",
+    "apm_jni/sample_conversion_test.cpp",
+  ]
+
+  deps = [
+    "//rtc_base/system:arch",
+    "//system_wrappers",
+  ]
+}
+BUILDGN
+    echo "✓ sample_conversion_test target added to modules/audio_processing/BUILD.gn"
+fi
+
+if ! grep -q 'rtc_executable("instance_arena_test")' modules/audio_processing/BUILD.gn; then
+    cat >> modules/audio_processing/BUILD.gn <<'BUILDGN'
+
+rtc_executable("instance_arena_test") {
+  testonly = true
+  sources = [
+    "apm_jni/instance_arena.cpp",
+    "apm_jni/instance_arena.h",
+    "apm_jni/instance_arena_test.cpp",
+  ]
+
+  # android/log.h stand-in for the wrapper's logging
+  include_dirs = [ "apm_jni/host" ]
+  cflags = [
+    "-fsanitize=address",
+    "-fno-omit-frame-pointer",
+  ]
+  ldflags = [ "-fsanitize=address" ]
+
+  deps = [
+    ":audio_processing",
+    "//api/audio:aec3_config",
+    "//api/audio:aec3_factory",
+  ]
+}
+BUILDGN
+    echo "✓ instance_arena_test target added to modules/audio_processing/BUILD.gn"
+fi
+
+echo "Generating build configuration..."
+gn gen "$OUT_DIR" --args='
+target_os="linux"
+target_cpu="x64"
+is_debug=false
+is_component_build=false
+rtc_include_tests=false
+rtc_enable_protobuf=false
+rtc_build_examples=false
+rtc_build_tools=false
+treat_warnings_as_errors=false
+'
+
+echo "Building benchmarks..."
+ninja -C "$OUT_DIR" \
+    modules/audio_processing:apm_benchmark \
+    modules/audio_processing:aec3_filter_sweep \
+    modules/audio_processing:instance_arena_test \
+    modules/audio_processing:sample_conversion_test
+
+for binary in apm_benchmark aec3_filter_sweep instance_arena_test sample_conversion_test; do
+    if [ -x "$OUT_DIR/$binary" ]; then
+        echo "✓ Benchmark built: $WEBRTC_ROOT/src/$OUT_DIR/$binary"
+    else
+        echo "✗ $binary binary not found"
+        exit 1
+    fi
+done
+
+if [ -n "$RUN_TARGET" ]; then
+    echo ""
+    "$OUT_DIR/$RUN_TARGET" "$@"
+fi